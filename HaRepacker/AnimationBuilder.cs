@@ -60,16 +60,6 @@ namespace HaRepacker {
 
 		#endregion
 
-		private static Bitmap OptimizeBitmapTransparent(Bitmap source, WzVectorProperty origin, Point biggestPng,
-			Point SmallestEmptySpace, Point MaximumMapEndingPts) {
-			var Size = new Point(biggestPng.X - SmallestEmptySpace.X, biggestPng.Y - SmallestEmptySpace.Y);
-			var empty = new Bitmap(MaximumMapEndingPts.X - SmallestEmptySpace.X,
-				MaximumMapEndingPts.Y - SmallestEmptySpace.Y);
-			var process = Graphics.FromImage(empty);
-			process.DrawImage(source, Size.X - origin.X.Value, Size.Y - origin.Y.Value);
-			return empty;
-		}
-
 		private static int PropertySorter(WzCanvasProperty a, WzCanvasProperty b) {
 			var aIndex = 0;
 			var bIndex = 0;
@@ -81,86 +71,46 @@ namespace HaRepacker {
 		}
 
 		public static void ExtractAnimation(WzSubProperty parent, string savePath, bool apngFirstFrame) {
-			var bmpList = new List<Bitmap>(parent.WzProperties.Count);
-			var delayList = new List<int>(parent.WzProperties.Count);
-			var biggestPng = new Point(0, 0);
-			var SmallestEmptySpace = new Point(65535, 65535);
-			var MaximumPngMappingEndingPts = new Point(0, 0);
-			foreach (var subprop in parent.WzProperties) {
-				if (subprop is WzCanvasProperty) {
-					//System.Drawing.PointF origin = ((WzCanvasProperty)subprop).GetCanvasOriginPosition();
-					var png = ((WzCanvasProperty) subprop).PngProperty;
-					if (png.Height > biggestPng.Y) {
-						biggestPng.Y = png.Height;
-					}
-
-					if (png.Width > biggestPng.X) {
-						biggestPng.X = png.Width;
-					}
-				}
-			}
-
-			var sortedProps = new List<WzCanvasProperty>();
+			var sortedProps = new List<WzCanvasProperty>(parent.WzProperties.Count);
 			foreach (var subprop in parent.WzProperties) {
 				if (subprop is WzCanvasProperty property) {
 					sortedProps.Add(property);
-					var png = property.PngProperty;
-					var origin = property.GetCanvasOriginPosition();
-
-					var StartPoints = new Point(biggestPng.X - (int) origin.X, biggestPng.Y - (int) origin.Y);
-					var PngMapppingEndingPts = new Point(StartPoints.X + png.Width, StartPoints.Y + png.Height);
-					if (StartPoints.X < SmallestEmptySpace.X) {
-						SmallestEmptySpace.X = StartPoints.X;
-					}
-
-					if (StartPoints.Y < SmallestEmptySpace.Y) {
-						SmallestEmptySpace.Y = StartPoints.Y;
-					}
-
-					if (PngMapppingEndingPts.X > MaximumPngMappingEndingPts.X) {
-						MaximumPngMappingEndingPts.X = PngMapppingEndingPts.X;
-					}
-
-					if (PngMapppingEndingPts.Y > MaximumPngMappingEndingPts.Y) {
-						MaximumPngMappingEndingPts.Y = PngMapppingEndingPts.Y;
-					}
 				}
 			}
 
 			sortedProps.Sort(PropertySorter);
 			for (var i = 0; i < sortedProps.Count; i++) {
-				var subprop = sortedProps[i];
-				if (i.ToString() != subprop.Name) {
+				if (i.ToString() != sortedProps[i].Name) {
 					Warning.Error(string.Format(Resources.AnimError, i.ToString()));
 					return;
 				}
+			}
 
-				var bmp = subprop.PngProperty.GetImage(false);
+			// each frame is placed so that its origin lands on (0, 0); the encoder sizes the canvas to fit them all
+			var frames = new List<SharpApngFrame>(sortedProps.Count);
+			foreach (var subprop in sortedProps) {
 				var origin = subprop.GetCanvasOriginPosition();
-				bmpList.Add(OptimizeBitmapTransparent(bmp, new WzVectorProperty("", origin.X, origin.Y), biggestPng,
-					SmallestEmptySpace, MaximumPngMappingEndingPts));
-
 				var delay = subprop[WzCanvasProperty.AnimationDelayPropertyName]?.GetInt();
 				if (delay == null) {
 					delay = 100;
 				}
 
-				delayList.Add((int) delay);
+				frames.Add(new SharpApngFrame(subprop.PngProperty.GetImage(false), GetNumByDelay((int) delay),
+					GetDenByDelay((int) delay), new Point(-(int) origin.X, -(int) origin.Y)));
 			}
 
 			var apngBuilder = new SharpApng();
 			if (apngFirstFrame) {
-				apngBuilder.AddFrame(
-					new SharpApngFrame(CreateIncompatibilityFrame(new Size(bmpList[0].Width, bmpList[0].Height)), 1,
-						1));
+				var bounds = SharpApng.GetPlacedBounds(frames);
+				apngBuilder.AddFrame(new SharpApngFrame(CreateIncompatibilityFrame(bounds.Size), 1, 1,
+					bounds.Location));
 			}
 
-			for (var i = 0; i < bmpList.Count; i++) {
-				apngBuilder.AddFrame(new SharpApngFrame(bmpList[i], GetNumByDelay(delayList[i]),
-					GetDenByDelay(delayList[i])));
+			foreach (var frame in frames) {
+				apngBuilder.AddFrame(frame);
 			}
 
-			apngBuilder.WriteApng(savePath, apngFirstFrame, true);
+			apngBuilder.WritePlacedApng(savePath, apngFirstFrame, true, ApngPreset.Balanced, ApngEncodeFlags.None);
 		}
 
 		private static int GetNumByDelay(int delay) {
@@ -49,6 +49,111 @@ namespace HaSharedLibrary.SharpApng {
 		}
 
 		public void WriteApng(string path, bool firstFrameHidden, bool disposeAfter) {
+			var maxSize = CreateFrames();
+
+			SharpApngBasicWrapper.SaveApngManaged(path, m_frames.Count, maxSize.Width, maxSize.Height,
+				firstFrameHidden);
+
+			if (disposeAfter) {
+				Dispose();
+			}
+		}
+
+		public ApngEncodeResult WriteApng(string path, bool firstFrameHidden, bool disposeAfter, ApngPreset preset) {
+			var maxSize = CreateFrames();
+
+			var result = SharpApngBasicWrapper.SaveApngManaged(path, m_frames.Count, maxSize.Width, maxSize.Height,
+				firstFrameHidden, preset);
+
+			if (disposeAfter) {
+				Dispose();
+			}
+
+			return result;
+		}
+
+		public ApngContext WriteApng(string path, bool firstFrameHidden, bool disposeAfter, ApngPreset preset,
+			ApngEncodeFlags flags) {
+			var maxSize = CreateFrames();
+
+			var context = SharpApngBasicWrapper.SaveApngManaged(path, m_frames.Count, maxSize.Width, maxSize.Height,
+				firstFrameHidden, preset, flags);
+
+			if (disposeAfter) {
+				Dispose();
+			}
+
+			return context;
+		}
+
+		public byte[] WriteApngToMemory(bool firstFrameHidden, bool disposeAfter, ApngPreset preset,
+			ApngEncodeFlags flags) {
+			var maxSize = CreateFrames();
+
+			var data = SharpApngBasicWrapper.SaveApngToMemory(m_frames.Count, maxSize.Width, maxSize.Height,
+				firstFrameHidden, preset, flags);
+
+			if (disposeAfter) {
+				Dispose();
+			}
+
+			return data;
+		}
+
+		/// <summary>
+		/// Writes the frames at their Position on the smallest canvas that holds all of them, without padding
+		/// each frame to that canvas first
+		/// </summary>
+		public ApngContext WritePlacedApng(string path, bool firstFrameHidden, bool disposeAfter, ApngPreset preset,
+			ApngEncodeFlags flags) {
+			ApngContext context;
+			if (SharpApngBasicWrapper.CreateFrameAt == null || SharpApngBasicWrapper.SaveAPNGPlaced == null) {
+				// older native library: pad the frames here instead
+				var bounds = GetPlacedBounds(m_frames);
+				for (var i = 0; i < m_frames.Count; i++) {
+					var frame = m_frames[i];
+					var result = new Bitmap(bounds.Width, bounds.Height);
+					using (var g = Graphics.FromImage(result)) {
+						g.DrawImageUnscaled(frame.Bitmap, frame.Position.X - bounds.X, frame.Position.Y - bounds.Y);
+					}
+
+					frame.Bitmap.Dispose();
+					frame.Bitmap = result;
+				}
+
+				context = WriteApng(path, firstFrameHidden, false, preset, flags);
+			} else {
+				for (var i = 0; i < m_frames.Count; i++) {
+					var frame = m_frames[i];
+					SharpApngBasicWrapper.CreateFrameAtManaged(frame.Bitmap, frame.DelayNum, frame.DelayDen, i,
+						frame.Position);
+				}
+
+				context = SharpApngBasicWrapper.SaveApngPlacedManaged(path, m_frames.Count, firstFrameHidden, preset,
+					flags);
+			}
+
+			if (disposeAfter) {
+				Dispose();
+			}
+
+			return context;
+		}
+
+		/// <summary>
+		/// Union of every frame's rectangle at its Position
+		/// </summary>
+		public static Rectangle GetPlacedBounds(IEnumerable<SharpApngFrame> frames) {
+			var bounds = Rectangle.Empty;
+			foreach (var frame in frames) {
+				var rect = new Rectangle(frame.Position, frame.Bitmap.Size);
+				bounds = bounds.IsEmpty ? rect : Rectangle.Union(bounds, rect);
+			}
+
+			return bounds;
+		}
+
+		private Size CreateFrames() {
 			var maxSize = new Size();
 			foreach (var frame in m_frames) {
 				if (frame.Bitmap.Width > maxSize.Width) maxSize.Width = frame.Bitmap.Width;
@@ -64,12 +169,7 @@ namespace HaSharedLibrary.SharpApng {
 				SharpApngBasicWrapper.CreateFrameManaged(frame.Bitmap, frame.DelayNum, frame.DelayDen, i);
 			}
 
-			SharpApngBasicWrapper.SaveApngManaged(path, m_frames.Count, maxSize.Width, maxSize.Height,
-				firstFrameHidden);
-
-			if (disposeAfter) {
-				Dispose();
-			}
+			return maxSize;
 		}
 	}
 }
\ No newline at end of file
@@ -11,12 +11,140 @@ using System.Runtime.InteropServices;
 using System.Text;
 
 namespace HaSharedLibrary.SharpApng {
+	public enum ApngPreset {
+		Fastest = 0,
+		Balanced = 1,
+		Smallest = 2
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct ApngEncodeResult {
+		public double Milliseconds;
+		public long Size;
+	}
+
+	[Flags]
+	public enum ApngEncodeFlags {
+		None = 0,
+
+		/// <summary>
+		/// Pick each frame's dispose and blend op by trial-compressing every candidate
+		/// </summary>
+		OptimizeOps = 0x1,
+
+		/// <summary>
+		/// Merge byte-identical consecutive frames into one frame with their delays summed
+		/// </summary>
+		CollapseDuplicates = 0x2,
+
+		/// <summary>
+		/// Deflate each frame's image data on all cores; still a single standard zlib stream
+		/// </summary>
+		ParallelDeflate = 0x4,
+
+		/// <summary>
+		/// Always write RGBA/RGB instead of the smallest lossless colour type (palette, grey, grey + alpha, RGB)
+		/// </summary>
+		KeepColorType = 0x8,
+
+		/// <summary>
+		/// Lossy: map every frame to one shared 256 colour palette and write an indexed file
+		/// </summary>
+		Quantize = 0x10,
+
+		/// <summary>
+		/// Ordered dithering when quantizing; smoother gradients, larger files
+		/// </summary>
+		Dither = 0x20,
+
+		/// <summary>
+		/// Write a single visible frame as a plain PNG without acTL and fcTL
+		/// </summary>
+		PlainSingleFrame = 0x40
+	}
+
+	public enum ApngOutput {
+		File = 0,
+		Memory = 1,
+		Callback = 2
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct ApngContext {
+		public int Preset;
+		public int Flags;
+		public double Milliseconds;
+		public long Size;
+		public int Collapsed;
+		public int Output;
+
+		/// <summary>
+		/// ApngWriteDelegate for ApngOutput.Callback, from Marshal.GetFunctionPointerForDelegate
+		/// </summary>
+		public IntPtr Write;
+		public IntPtr User;
+		public IntPtr Data;
+		public int ColorType;
+		public int BitDepth;
+		public int Width;
+		public int Height;
+
+		/// <summary>
+		/// Optional native buffer for per-phase timings, see apngbench; IntPtr.Zero to skip them
+		/// </summary>
+		public IntPtr Profile;
+	}
+
+	public enum ApngDecodeMode {
+		/// <summary>
+		/// Every frame as a full canvas with the dispose and blend ops already applied
+		/// </summary>
+		Composite = 0,
+
+		/// <summary>
+		/// Only each frame's own sub-rectangle, as stored in the file
+		/// </summary>
+		Regions = 1
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct ApngInfo {
+		public int Width;
+		public int Height;
+		public int Frames;
+		public int Plays;
+
+		/// <summary>
+		/// Bytes of decoded pixels; images that would need more than int.MaxValue fail in ReadAPNGInfo
+		/// </summary>
+		public int Size;
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct ApngFrameInfo {
+		public int X, Y, Width, Height;
+		public int DelayNum;
+		public int DelayDen;
+		public byte DisposeOp;
+		public byte BlendOp;
+		public int Offset;
+	}
+
 	public static class SharpApngBasicWrapper {
 		public const int PIXEL_DEPTH = 4;
 
 		static SharpApngBasicWrapper() {
 			CreateFrame = null;
+			CreateFrameAt = null;
 			SaveAPNG = null;
+			SaveAPNGPreset = null;
+			SaveAPNGEx = null;
+			SaveAPNGPlaced = null;
+			FreeAPNGBuffer = null;
+			ReadAPNGInfo = null;
+			ReadAPNG = null;
+			DeflateParallelBound = null;
+			DeflateParallel = null;
 			var apnglib = LoadLibrary(Environment.Is64BitProcess ? "apng64.dll" : "apng32.dll");
 			if (apnglib != IntPtr.Zero) {
 				var createFramePtr = GetProcAddress(apnglib, "CreateFrame");
@@ -26,11 +154,65 @@ namespace HaSharedLibrary.SharpApng {
 							typeof(CreateFrameDelegate));
 				}
 
+				var createFrameAtPtr = GetProcAddress(apnglib, "CreateFrameAt");
+				if (createFrameAtPtr != IntPtr.Zero) {
+					CreateFrameAt = (CreateFrameAtDelegate) Marshal.GetDelegateForFunctionPointer(createFrameAtPtr,
+						typeof(CreateFrameAtDelegate));
+				}
+
 				var saveApngPtr = GetProcAddress(apnglib, "SaveAPNG");
 				if (saveApngPtr != null) {
 					SaveAPNG = (SaveAPNGDelegate) Marshal.GetDelegateForFunctionPointer(saveApngPtr,
 						typeof(SaveAPNGDelegate));
 				}
+
+				var saveApngPresetPtr = GetProcAddress(apnglib, "SaveAPNGPreset");
+				if (saveApngPresetPtr != IntPtr.Zero) {
+					SaveAPNGPreset = (SaveAPNGPresetDelegate) Marshal.GetDelegateForFunctionPointer(saveApngPresetPtr,
+						typeof(SaveAPNGPresetDelegate));
+				}
+
+				var saveApngExPtr = GetProcAddress(apnglib, "SaveAPNGEx");
+				if (saveApngExPtr != IntPtr.Zero) {
+					SaveAPNGEx = (SaveAPNGExDelegate) Marshal.GetDelegateForFunctionPointer(saveApngExPtr,
+						typeof(SaveAPNGExDelegate));
+				}
+
+				var saveApngPlacedPtr = GetProcAddress(apnglib, "SaveAPNGPlaced");
+				if (saveApngPlacedPtr != IntPtr.Zero) {
+					SaveAPNGPlaced = (SaveAPNGPlacedDelegate) Marshal.GetDelegateForFunctionPointer(saveApngPlacedPtr,
+						typeof(SaveAPNGPlacedDelegate));
+				}
+
+				var freeApngBufferPtr = GetProcAddress(apnglib, "FreeAPNGBuffer");
+				if (freeApngBufferPtr != IntPtr.Zero) {
+					FreeAPNGBuffer = (FreeAPNGBufferDelegate) Marshal.GetDelegateForFunctionPointer(freeApngBufferPtr,
+						typeof(FreeAPNGBufferDelegate));
+				}
+
+				var readApngInfoPtr = GetProcAddress(apnglib, "ReadAPNGInfo");
+				if (readApngInfoPtr != IntPtr.Zero) {
+					ReadAPNGInfo = (ReadAPNGInfoDelegate) Marshal.GetDelegateForFunctionPointer(readApngInfoPtr,
+						typeof(ReadAPNGInfoDelegate));
+				}
+
+				var readApngPtr = GetProcAddress(apnglib, "ReadAPNG");
+				if (readApngPtr != IntPtr.Zero) {
+					ReadAPNG = (ReadAPNGDelegate) Marshal.GetDelegateForFunctionPointer(readApngPtr,
+						typeof(ReadAPNGDelegate));
+				}
+
+				var deflateParallelBoundPtr = GetProcAddress(apnglib, "DeflateParallelBound");
+				if (deflateParallelBoundPtr != IntPtr.Zero) {
+					DeflateParallelBound = (DeflateParallelBoundDelegate) Marshal.GetDelegateForFunctionPointer(
+						deflateParallelBoundPtr, typeof(DeflateParallelBoundDelegate));
+				}
+
+				var deflateParallelPtr = GetProcAddress(apnglib, "DeflateParallel");
+				if (deflateParallelPtr != IntPtr.Zero) {
+					DeflateParallel = (DeflateParallelDelegate) Marshal.GetDelegateForFunctionPointer(deflateParallelPtr,
+						typeof(DeflateParallelDelegate));
+				}
 			} else {
 				throw new Exception("apng64.dll or apng32.dll not found.");
 			}
@@ -85,6 +267,15 @@ namespace HaSharedLibrary.SharpApng {
 			ReleaseData(ptr);
 		}
 
+		/// <summary>
+		/// Adds a frame that only covers the bitmap's own size, with its top left corner at position
+		/// </summary>
+		public static void CreateFrameAtManaged(Bitmap source, int num, int den, int i, Point position) {
+			var ptr = MarshalByteArray(TranslateImage(source));
+			CreateFrameAt(ptr, num, den, i, source.Width, source.Height, position.X, position.Y, PIXEL_DEPTH);
+			ReleaseData(ptr);
+		}
+
 		public static void SaveApngManaged(string path, int frameCount, int width, int height, bool firstFrameHidden) {
 			var pathPtr = MarshalString(path);
 			var firstFrame = firstFrameHidden ? (byte) 1 : (byte) 0;
@@ -92,21 +283,211 @@ namespace HaSharedLibrary.SharpApng {
 			ReleaseData(pathPtr);
 		}
 
+		public static ApngEncodeResult SaveApngManaged(string path, int frameCount, int width, int height,
+			bool firstFrameHidden, ApngPreset preset) {
+			var result = new ApngEncodeResult();
+			if (SaveAPNGPreset == null) {
+				SaveApngManaged(path, frameCount, width, height, firstFrameHidden);
+				return result;
+			}
+
+			var pathPtr = MarshalString(path);
+			var firstFrame = firstFrameHidden ? (byte) 1 : (byte) 0;
+			SaveAPNGPreset(pathPtr, frameCount, width, height, PIXEL_DEPTH, firstFrame, (int) preset, ref result);
+			ReleaseData(pathPtr);
+			return result;
+		}
+
+		public static ApngContext SaveApngManaged(string path, int frameCount, int width, int height,
+			bool firstFrameHidden, ApngPreset preset, ApngEncodeFlags flags) {
+			var context = new ApngContext {Preset = (int) preset, Flags = (int) flags};
+			if (SaveAPNGEx == null) {
+				var result = SaveApngManaged(path, frameCount, width, height, firstFrameHidden, preset);
+				context.Milliseconds = result.Milliseconds;
+				context.Size = result.Size;
+				return context;
+			}
+
+			var pathPtr = MarshalString(path);
+			var firstFrame = firstFrameHidden ? (byte) 1 : (byte) 0;
+			SaveAPNGEx(pathPtr, frameCount, width, height, PIXEL_DEPTH, firstFrame, ref context);
+			ReleaseData(pathPtr);
+			return context;
+		}
+
+		/// <summary>
+		/// Encodes frames added with CreateFrameAtManaged on the smallest canvas holding all of them
+		/// </summary>
+		/// <returns>The encode context; Width and Height are the canvas size that was written</returns>
+		public static ApngContext SaveApngPlacedManaged(string path, int frameCount, bool firstFrameHidden,
+			ApngPreset preset, ApngEncodeFlags flags) {
+			var context = new ApngContext {Preset = (int) preset, Flags = (int) flags};
+			var pathPtr = MarshalString(path);
+			var firstFrame = firstFrameHidden ? (byte) 1 : (byte) 0;
+			SaveAPNGPlaced(pathPtr, frameCount, PIXEL_DEPTH, firstFrame, ref context);
+			ReleaseData(pathPtr);
+			return context;
+		}
+
+		/// <summary>
+		/// Encodes the created frames without touching the disk
+		/// </summary>
+		/// <returns>The PNG/APNG file bytes, or null if encoding failed</returns>
+		public static byte[] SaveApngToMemory(int frameCount, int width, int height, bool firstFrameHidden,
+			ApngPreset preset, ApngEncodeFlags flags) {
+			if (SaveAPNGEx == null || FreeAPNGBuffer == null) {
+				return null;
+			}
+
+			var context = new ApngContext {
+				Preset = (int) preset, Flags = (int) flags, Output = (int) ApngOutput.Memory
+			};
+			var firstFrame = firstFrameHidden ? (byte) 1 : (byte) 0;
+			if (SaveAPNGEx(IntPtr.Zero, frameCount, width, height, PIXEL_DEPTH, firstFrame, ref context) == 0) {
+				return null;
+			}
+
+			var result = new byte[context.Size];
+			Marshal.Copy(context.Data, result, 0, result.Length);
+			FreeAPNGBuffer(ref context);
+			return result;
+		}
+
+		/// <summary>
+		/// Decodes a PNG/APNG file or in-memory image into BGRA pixels
+		/// </summary>
+		/// <param name="path">File to read, or null to read from data</param>
+		/// <param name="data">Image bytes, used when path is null</param>
+		/// <returns>The pixels of every frame, indexed by ApngFrameInfo.Offset, or null if decoding failed</returns>
+		public static byte[] ReadApngManaged(string path, byte[] data, ApngDecodeMode mode, out ApngInfo info,
+			out ApngFrameInfo[] frames) {
+			info = new ApngInfo();
+			frames = null;
+			if (ReadAPNGInfo == null || ReadAPNG == null) {
+				return null;
+			}
+
+			var pathPtr = path != null ? MarshalString(path) : IntPtr.Zero;
+			var dataPtr = path == null ? MarshalByteArray(data) : IntPtr.Zero;
+			var length = path == null ? data.Length : 0;
+			byte[] result = null;
+			try {
+				if (ReadAPNGInfo(pathPtr, dataPtr, length, ref info) == 0) {
+					return null;
+				}
+
+				var pixels = Marshal.AllocHGlobal(info.Size);
+				try {
+					var decoded = new ApngFrameInfo[info.Frames];
+					if (ReadAPNG(pathPtr, dataPtr, length, (int) mode, pixels, decoded) != 0) {
+						result = new byte[info.Size];
+						Marshal.Copy(pixels, result, 0, result.Length);
+						frames = decoded;
+					}
+				} finally {
+					ReleaseData(pixels);
+				}
+			} finally {
+				if (pathPtr != IntPtr.Zero) ReleaseData(pathPtr);
+				if (dataPtr != IntPtr.Zero) ReleaseData(dataPtr);
+			}
+
+			return result;
+		}
+
+		/// <summary>
+		/// Compresses data into a standard zlib stream (header, deflate data, Adler-32) using several threads
+		/// </summary>
+		/// <param name="level">zlib level 0-9, or -1 for the default</param>
+		/// <param name="threads">Worker threads, or 0 for one per core</param>
+		/// <returns>The zlib stream, or null if the native library is missing or compression failed</returns>
+		public static byte[] DeflateParallelManaged(byte[] data, int level, int threads = 0) {
+			if (DeflateParallelBound == null || DeflateParallel == null) {
+				return null;
+			}
+
+			var output = new byte[DeflateParallelBound(data.Length)];
+			var length = DeflateParallel(data, data.Length, output, output.Length, level, threads);
+			if (length < 0) {
+				return null;
+			}
+
+			Array.Resize(ref output, length);
+			return output;
+		}
+
 		[DllImport("kernel32.dll", CharSet = CharSet.Auto, SetLastError = true)]
 		public static extern IntPtr LoadLibrary(string lpFileName);
 
 		[DllImport("kernel32.dll", CharSet = CharSet.Ansi, ExactSpelling = true, SetLastError = true)]
 		public static extern IntPtr GetProcAddress(IntPtr hModule, string procName);
 
+		/// <summary>
+		/// Receives the encoded bytes in ApngOutput.Callback mode; return 0 to stop the encode with an error
+		/// </summary>
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate int ApngWriteDelegate(IntPtr user, IntPtr data, int length);
+
 		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
 		public delegate void CreateFrameDelegate(IntPtr pdata, int num, int den, int i, int len);
 
 		public static readonly CreateFrameDelegate CreateFrame;
 
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate void CreateFrameAtDelegate(IntPtr pdata, int num, int den, int i, int width, int height, int x,
+			int y, int bytesPerPixel);
+
+		public static readonly CreateFrameAtDelegate CreateFrameAt;
+
 		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
 		public delegate void SaveAPNGDelegate(IntPtr path, int frameCount, int width, int height, int bytesPerPixel,
 			byte firstFrameHidden);
 
 		public static readonly SaveAPNGDelegate SaveAPNG;
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate int SaveAPNGPresetDelegate(IntPtr path, int frameCount, int width, int height,
+			int bytesPerPixel, byte firstFrameHidden, int preset, ref ApngEncodeResult result);
+
+		public static readonly SaveAPNGPresetDelegate SaveAPNGPreset;
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate int SaveAPNGExDelegate(IntPtr path, int frameCount, int width, int height,
+			int bytesPerPixel, byte firstFrameHidden, ref ApngContext context);
+
+		public static readonly SaveAPNGExDelegate SaveAPNGEx;
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate int SaveAPNGPlacedDelegate(IntPtr path, int frameCount, int bytesPerPixel,
+			byte firstFrameHidden, ref ApngContext context);
+
+		public static readonly SaveAPNGPlacedDelegate SaveAPNGPlaced;
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate void FreeAPNGBufferDelegate(ref ApngContext context);
+
+		public static readonly FreeAPNGBufferDelegate FreeAPNGBuffer;
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate int ReadAPNGInfoDelegate(IntPtr path, IntPtr data, int length, ref ApngInfo info);
+
+		public static readonly ReadAPNGInfoDelegate ReadAPNGInfo;
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate int ReadAPNGDelegate(IntPtr path, IntPtr data, int length, int mode, IntPtr pixels,
+			[Out] ApngFrameInfo[] frames);
+
+		public static readonly ReadAPNGDelegate ReadAPNG;
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate int DeflateParallelBoundDelegate(int length);
+
+		public static readonly DeflateParallelBoundDelegate DeflateParallelBound;
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate int DeflateParallelDelegate(byte[] source, int length, [Out] byte[] destination,
+			int capacity, int level, int threads);
+
+		public static readonly DeflateParallelDelegate DeflateParallel;
 	}
 }
\ No newline at end of file
@@ -19,10 +19,19 @@ namespace HaSharedLibrary.SharpApng {
 			Bitmap = bmp;
 		}
 
+		/// <summary>
+		/// A frame placed with its top left corner at position, for SharpApng.WritePlacedApng
+		/// </summary>
+		public SharpApngFrame(Bitmap bmp, int num, int den, Point position) : this(bmp, num, den) {
+			Position = position;
+		}
+
 		public int DelayNum { get; set; }
 
 		public int DelayDen { get; set; }
 
 		public Bitmap Bitmap { get; set; }
+
+		public Point Position { get; set; }
 	}
 }
\ No newline at end of file
@@ -0,0 +1,201 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+using System;
+using System.Collections.Generic;
+using System.Drawing;
+using System.Runtime.InteropServices;
+
+namespace HaSharedLibrary.SharpApng {
+	public enum AtlasPacking {
+		MaxRects = 0,
+		Skyline = 1
+	}
+
+	[Flags]
+	public enum AtlasFlags {
+		None = 0,
+
+		/// <summary>
+		/// Pack only the part of each sprite that is not fully transparent
+		/// </summary>
+		Trim = 0x1,
+
+		/// <summary>
+		/// Pixel-identical sprites get the same rect instead of a copy each
+		/// </summary>
+		ShareDuplicates = 0x2
+	}
+
+	public enum AtlasFormat {
+		/// <summary>
+		/// Raw pixels, 4 bytes per pixel in Bitmap order
+		/// </summary>
+		Bgra = 0,
+
+		/// <summary>
+		/// A PNG file
+		/// </summary>
+		Png = 1,
+
+		/// <summary>
+		/// DXT5 blocks; page sizes are multiples of 4
+		/// </summary>
+		Dxt5 = 2
+	}
+
+	[StructLayout(LayoutKind.Sequential)]
+	public struct AtlasRect {
+		public ushort Page;
+		public ushort X, Y;
+		public ushort Width, Height;
+
+		/// <summary>
+		/// Where the packed pixels start in the original sprite
+		/// </summary>
+		public ushort TrimX, TrimY;
+
+		/// <summary>
+		/// 1 if the pixels belong to an earlier identical sprite
+		/// </summary>
+		public ushort Shared;
+	}
+
+	public class AtlasPage {
+		public int Width { get; set; }
+		public int Height { get; set; }
+		public AtlasFormat Format { get; set; }
+		public byte[] Data { get; set; }
+	}
+
+	/// <summary>
+	/// Packs many sprites into a few texture pages using the native atlas builder in apng32/64.dll
+	/// </summary>
+	public class SharpAtlas {
+		static SharpAtlas() {
+			BuildAtlas = null;
+			FreeAtlas = null;
+			var apnglib = SharpApngBasicWrapper.LoadLibrary(Environment.Is64BitProcess ? "apng64.dll" : "apng32.dll");
+			if (apnglib != IntPtr.Zero) {
+				var buildAtlasPtr = SharpApngBasicWrapper.GetProcAddress(apnglib, "BuildAtlas");
+				if (buildAtlasPtr != IntPtr.Zero) {
+					BuildAtlas = (BuildAtlasDelegate) Marshal.GetDelegateForFunctionPointer(buildAtlasPtr,
+						typeof(BuildAtlasDelegate));
+				}
+
+				var freeAtlasPtr = SharpApngBasicWrapper.GetProcAddress(apnglib, "FreeAtlas");
+				if (freeAtlasPtr != IntPtr.Zero) {
+					FreeAtlas = (FreeAtlasDelegate) Marshal.GetDelegateForFunctionPointer(freeAtlasPtr,
+						typeof(FreeAtlasDelegate));
+				}
+			}
+		}
+
+		public List<AtlasPage> Pages { get; } = new List<AtlasPage>();
+
+		/// <summary>
+		/// One per input sprite, in input order
+		/// </summary>
+		public AtlasRect[] Rects { get; private set; }
+
+		/// <summary>
+		/// How many sprites reuse an earlier sprite's pixels
+		/// </summary>
+		public int Shared { get; private set; }
+
+		/// <summary>
+		/// Packs the sprites into pages of at most maxWidth x maxHeight with padding transparent pixels between them
+		/// </summary>
+		/// <returns>The atlas, or null if the native library is missing or packing failed</returns>
+		public static SharpAtlas Build(IList<Bitmap> sprites, int maxWidth, int maxHeight, int padding,
+			AtlasPacking packing, AtlasFlags flags, AtlasFormat format) {
+			if (BuildAtlas == null || FreeAtlas == null) {
+				return null;
+			}
+
+			var pinned = new GCHandle[sprites.Count];
+			var native = new NativeSprite[sprites.Count];
+			try {
+				for (var i = 0; i < sprites.Count; i++) {
+					pinned[i] = GCHandle.Alloc(SharpApngBasicWrapper.TranslateImage(sprites[i]), GCHandleType.Pinned);
+					native[i] = new NativeSprite {
+						Pixels = pinned[i].AddrOfPinnedObject(), Width = sprites[i].Width, Height = sprites[i].Height
+					};
+				}
+
+				var atlasPtr = BuildAtlas(native, native.Length, maxWidth, maxHeight, padding, (int) packing,
+					(int) flags, (int) format);
+				if (atlasPtr == IntPtr.Zero) {
+					return null;
+				}
+
+				try {
+					return FromNative(Marshal.PtrToStructure<NativeAtlas>(atlasPtr));
+				} finally {
+					FreeAtlas(atlasPtr);
+				}
+			} finally {
+				foreach (var handle in pinned) {
+					if (handle.IsAllocated) handle.Free();
+				}
+			}
+		}
+
+		private static SharpAtlas FromNative(NativeAtlas atlas) {
+			var result = new SharpAtlas {Rects = new AtlasRect[atlas.Count], Shared = atlas.Shared};
+			var pageSize = Marshal.SizeOf<NativePage>();
+			for (var i = 0; i < atlas.Pages; i++) {
+				var page = Marshal.PtrToStructure<NativePage>(atlas.Page + i * pageSize);
+				var data = new byte[page.Size];
+				Marshal.Copy(page.Data, data, 0, data.Length);
+				result.Pages.Add(new AtlasPage {
+					Width = page.Width, Height = page.Height, Format = (AtlasFormat) page.Format, Data = data
+				});
+			}
+
+			var rectSize = Marshal.SizeOf<AtlasRect>();
+			for (var i = 0; i < atlas.Count; i++) {
+				result.Rects[i] = Marshal.PtrToStructure<AtlasRect>(atlas.Rect + i * rectSize);
+			}
+
+			return result;
+		}
+
+		[StructLayout(LayoutKind.Sequential)]
+		private struct NativeSprite {
+			public IntPtr Pixels;
+			public int Width;
+			public int Height;
+		}
+
+		[StructLayout(LayoutKind.Sequential)]
+		private struct NativePage {
+			public int Width;
+			public int Height;
+			public int Format;
+			public int Size;
+			public IntPtr Data;
+		}
+
+		[StructLayout(LayoutKind.Sequential)]
+		private struct NativeAtlas {
+			public int Pages;
+			public IntPtr Page;
+			public int Count;
+			public IntPtr Rect;
+			public int Shared;
+		}
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		private delegate IntPtr BuildAtlasDelegate([In] NativeSprite[] sprites, int count, int maxWidth,
+			int maxHeight, int padding, int method, int flags, int format);
+
+		private static readonly BuildAtlasDelegate BuildAtlas;
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		private delegate void FreeAtlasDelegate(IntPtr atlas);
+
+		private static readonly FreeAtlasDelegate FreeAtlas;
+	}
+}
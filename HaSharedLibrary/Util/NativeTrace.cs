@@ -0,0 +1,148 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Runtime.InteropServices;
+using System.Text;
+using HaSharedLibrary.SharpApng;
+
+namespace HaSharedLibrary.Util {
+	/// <summary>
+	/// Records where squish.dll and apng32/64.dll spend their time, as begin/end events with thread ids,
+	/// and writes them as Chrome trace event JSON (chrome://tracing or ui.perfetto.dev).
+	/// Tracing costs one flag check per trace point while it is off.
+	/// </summary>
+	public static class NativeTrace {
+		private static readonly List<Module> Modules = new List<Module>();
+
+		static NativeTrace() {
+			Module.Load("squish", "squish.dll", Modules);
+			Module.Load("apng", Environment.Is64BitProcess ? "apng64.dll" : "apng32.dll", Modules);
+		}
+
+		/// <summary>
+		/// True if at least one native library with tracing support is loaded
+		/// </summary>
+		public static bool Available => Modules.Count > 0;
+
+		/// <summary>
+		/// Starts recording into a ring buffer of capacity events per library; the oldest are overwritten when it
+		/// is full. Start and stop while no image is being compressed or saved.
+		/// </summary>
+		public static bool Start(int capacity = 1 << 20) {
+			var ok = Modules.Count > 0;
+			foreach (var module in Modules) {
+				ok &= module.Start(capacity) != 0;
+			}
+
+			return ok;
+		}
+
+		public static void Stop() {
+			foreach (var module in Modules) {
+				module.Stop();
+			}
+		}
+
+		/// <summary>
+		/// Events lost because a ring buffer was full
+		/// </summary>
+		public static int Dropped => Modules.Sum(module => module.Dropped());
+
+		/// <summary>
+		/// Writes the events recorded since Start, from every library, to one trace file
+		/// </summary>
+		public static void Write(string path) {
+			var events = new List<(string Category, NativeEvent Event)>();
+			foreach (var module in Modules) {
+				var buffer = new NativeEvent[module.Read(null, 0)];
+				var count = module.Read(buffer, buffer.Length);
+				for (var i = 0; i < count; i++) {
+					events.Add((module.Name, buffer[i]));
+				}
+			}
+
+			// OrderBy is stable, so each library's events keep their order on every thread
+			events = events.OrderBy(e => e.Event.Ns).ToList();
+			var origin = events.Count > 0 ? events[0].Event.Ns : 0;
+			var pid = Process.GetCurrentProcess().Id;
+
+			var json = new StringBuilder();
+			json.Append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+			for (var i = 0; i < events.Count; i++) {
+				var (category, e) = events[i];
+				json.AppendFormat(CultureInfo.InvariantCulture,
+					"{{\"name\":\"{0}\",\"cat\":\"{1}\",\"ph\":\"{2}\",\"ts\":{3:0.000},\"pid\":{4},\"tid\":{5}}}{6}\n",
+					Marshal.PtrToStringAnsi(e.Name), category, (char) e.Phase, (e.Ns - origin) / 1000.0, pid, e.Thread,
+					i + 1 < events.Count ? "," : "");
+			}
+
+			json.Append("]}\n");
+			File.WriteAllText(path, json.ToString());
+		}
+
+		/// <summary>
+		/// squish::TraceEvent
+		/// </summary>
+		[StructLayout(LayoutKind.Sequential)]
+		private struct NativeEvent {
+			public long Ns;
+			public IntPtr Name;
+			public uint Thread;
+			public int Phase;
+		}
+
+		private class Module {
+			public string Name;
+			public TraceStartDelegate Start;
+			public TraceStopDelegate Stop;
+			public TraceReadDelegate Read;
+			public TraceDroppedDelegate Dropped;
+
+			/// <summary>
+			/// Adds the library to modules if it exports the trace functions
+			/// </summary>
+			public static void Load(string name, string dll, List<Module> modules) {
+				var lib = SharpApngBasicWrapper.LoadLibrary(dll);
+				if (lib == IntPtr.Zero) {
+					return;
+				}
+
+				var startPtr = SharpApngBasicWrapper.GetProcAddress(lib, "_DLLEXPORT_TraceStart");
+				var stopPtr = SharpApngBasicWrapper.GetProcAddress(lib, "_DLLEXPORT_TraceStop");
+				var readPtr = SharpApngBasicWrapper.GetProcAddress(lib, "_DLLEXPORT_TraceRead");
+				var droppedPtr = SharpApngBasicWrapper.GetProcAddress(lib, "_DLLEXPORT_TraceDropped");
+				if (startPtr == IntPtr.Zero || stopPtr == IntPtr.Zero || readPtr == IntPtr.Zero ||
+				    droppedPtr == IntPtr.Zero) {
+					return;
+				}
+
+				modules.Add(new Module {
+					Name = name,
+					Start = Marshal.GetDelegateForFunctionPointer<TraceStartDelegate>(startPtr),
+					Stop = Marshal.GetDelegateForFunctionPointer<TraceStopDelegate>(stopPtr),
+					Read = Marshal.GetDelegateForFunctionPointer<TraceReadDelegate>(readPtr),
+					Dropped = Marshal.GetDelegateForFunctionPointer<TraceDroppedDelegate>(droppedPtr)
+				});
+			}
+		}
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		private delegate int TraceStartDelegate(int capacity);
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		private delegate void TraceStopDelegate();
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		private delegate int TraceReadDelegate([Out] NativeEvent[] events, int max);
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		private delegate int TraceDroppedDelegate();
+	}
+}
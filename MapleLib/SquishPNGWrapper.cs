@@ -96,6 +96,22 @@ namespace MapleLib {
 								typeof(_DLLEXPORT_CompressImage));
 					}
 
+					var CompressMaskedWithStatisticsPtr =
+						GetProcAddress(errorCode, "_DLLEXPORT_CompressMaskedWithStatistics");
+					if (CompressMaskedWithStatisticsPtr != IntPtr.Zero) {
+						CompressMaskedWithStatistics =
+							(_DLLEXPORT_CompressMaskedWithStatistics) Marshal.GetDelegateForFunctionPointer(
+								CompressMaskedWithStatisticsPtr, typeof(_DLLEXPORT_CompressMaskedWithStatistics));
+					}
+
+					var CompressImageWithStatisticsPtr =
+						GetProcAddress(errorCode, "_DLLEXPORT_CompressImageWithStatistics");
+					if (CompressImageWithStatisticsPtr != IntPtr.Zero) {
+						CompressImageWithStatistics =
+							(_DLLEXPORT_CompressImageWithStatistics) Marshal.GetDelegateForFunctionPointer(
+								CompressImageWithStatisticsPtr, typeof(_DLLEXPORT_CompressImageWithStatistics));
+					}
+
 					var DecompressImagePtr = GetProcAddress(errorCode, "_DLLEXPORT_DecompressImage");
 					if (DecompressImagePtr != null) {
 						DecompressImage =
@@ -131,6 +147,13 @@ namespace MapleLib {
 		public static _DLLEXPORT_CompressImage CompressImage;
 		public static _DLLEXPORT_DecompressImage DecompressImage;
 
+		/// <summary>
+		/// Null when squish.dll predates the statistics exports
+		/// </summary>
+		public static _DLLEXPORT_CompressMaskedWithStatistics CompressMaskedWithStatistics;
+
+		public static _DLLEXPORT_CompressImageWithStatistics CompressImageWithStatistics;
+
 
 		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
 		public delegate int _DLLEXPORT_FixFlags(int flags);
@@ -150,11 +173,59 @@ namespace MapleLib {
 		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
 		public delegate void _DLLEXPORT_CompressImage(byte[] rgba_src, int width, int height, byte[] blocks, int flags);
 
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate void _DLLEXPORT_CompressMaskedWithStatistics(byte[] rgba, int mask, byte[] block, int flags,
+			ref SquishStatistics statistics);
+
+		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+		public delegate void _DLLEXPORT_CompressImageWithStatistics(byte[] rgba_src, int width, int height,
+			byte[] blocks, int flags, ref SquishStatistics statistics);
+
 		[UnmanagedFunctionPointer(CallingConvention.Cdecl)]
 		public delegate void _DLLEXPORT_DecompressImage(byte[] rgba, int width, int height, byte[] blocks, int flags);
 
 		#endregion
 
+		/// <summary>
+		/// Mirrors squish::Statistics. The counters add up over calls, so start from a new instance
+		/// </summary>
+		[StructLayout(LayoutKind.Sequential)]
+		public struct SquishStatistics {
+			public int Blocks;
+			public int SingleColourFit;
+			public int RangeFit;
+			public int ClusterFit;
+			public int IntegerFit;
+
+			/// <summary>
+			/// Cluster fits by the number of orderings searched, 1 to 8
+			/// </summary>
+			[MarshalAs(UnmanagedType.ByValArray, SizeConst = 9)]
+			public int[] ClusterIterations;
+
+			/// <summary>
+			/// Iterations cut short because the ordering had already been tried
+			/// </summary>
+			public int OrderingExits;
+
+			/// <summary>
+			/// Blocks by the number of distinct colours, 0 to 16
+			/// </summary>
+			[MarshalAs(UnmanagedType.ByValArray, SizeConst = 17)]
+			public int[] Colours;
+
+			/// <summary>
+			/// Blocks by RMS colour error: [0,1), [1,2), [2,4) ... [128,255]
+			/// </summary>
+			[MarshalAs(UnmanagedType.ByValArray, SizeConst = 9)]
+			public int[] Error;
+
+			public double SingleColourSeconds;
+			public double RangeFitSeconds;
+			public double ClusterFitSeconds;
+			public double IntegerFitSeconds;
+		}
+
 		#region Kernel32DLL Import
 
 		[DllImport("kernel32.dll", CharSet = CharSet.Auto, SetLastError = true)]
@@ -192,7 +263,10 @@ namespace MapleLib {
 			kColourMetricUniform = 1 << 6,
 
 			//! Weight the colour by alpha during cluster fit (disabled by default).
-			kWeightColourByAlpha = 1 << 7
+			kWeightColourByAlpha = 1 << 7,
+
+			//! Use a fast colour compressor with no floating point, which writes the same blocks on every build and machine.
+			kColourIntegerFit = 1 << 9
 		}
 	}
 }
\ No newline at end of file
@@ -22,34 +22,193 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 #include <windows.h>
 #include "libapng/png.h"
+#include "libapng/zlib/zlib.h"
+#include "pdeflate.h"
+#include "trace.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#ifndef APNG_USE_SSE2
+#define APNG_USE_SSE2 1
+#endif
+#endif
+
+#if APNG_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 extern "C" {
 using _FRAME = struct {
 	unsigned char* p;
 	int num;
 	int den;
+	int w, h; // CreateFrameAt: size of p and its place on the canvas, w = 0 for a full canvas
+	int x, y;
 };
 
 _FRAME Frame[100000];
 
-unsigned char dispose(int a, int b, unsigned char* pPrev, int n, int xres, int yres, int bpp, int w0, int h0, int x0, int y0, int* w1, int* h1, int* x1, int* y1) {
+// Encoder presets accepted by SaveAPNGPreset
+#define APNG_PRESET_FASTEST 0
+#define APNG_PRESET_BALANCED 1
+#define APNG_PRESET_SMALLEST 2
+
+using _PRESET = struct {
+	int level;
+	int mem_level;
+	int strategy;
+	int filters;
+	int search; // pick each frame's filters by deflated size, see searchFilters()
+};
+
+// fastest: run-length deflate and only the two cheapest row filters
+// balanced: libpng defaults, adaptive choice between all five filters
+// smallest: maximum zlib effort, and for each frame whichever of the five filters
+//           or the adaptive choice deflates smallest
+static const _PRESET Preset[] = {
+	{1, 8, Z_RLE, PNG_FILTER_NONE | PNG_FILTER_UP, 0},
+	{Z_DEFAULT_COMPRESSION, 8, Z_FILTERED, PNG_ALL_FILTERS, 0},
+	{9, 9, Z_FILTERED, PNG_ALL_FILTERS, 1}
+};
+
+using _ENCODE_RESULT = struct {
+	double ms;
+	long long size;
+};
+
+// Flags for _APNG_CONTEXT::flags
+#define APNG_OPTIMIZE_OPS 0x1
+#define APNG_COLLAPSE_DUPLICATES 0x2
+#define APNG_PARALLEL_DEFLATE 0x4
+#define APNG_KEEP_COLOR_TYPE 0x8 // skip the lossless colour type reduction
+#define APNG_QUANTIZE 0x10 // lossy: map everything to one 256 colour palette
+#define APNG_DITHER 0x20 // ordered dithering for APNG_QUANTIZE
+#define APNG_PLAIN_SINGLE_FRAME 0x40 // write a lone visible frame as a plain PNG, without acTL and fcTL
+
+// Where SaveAPNGEx sends the encoded bytes
+#define APNG_OUTPUT_FILE 0
+#define APNG_OUTPUT_MEMORY 1
+#define APNG_OUTPUT_CALLBACK 2
+
+// APNG_OUTPUT_CALLBACK sink; returns non-zero once the bytes are written, 0 to fail the encode
+using _APNG_WRITE = int (*)(void* user, unsigned char* data, int length);
+
+// Milliseconds spent in each phase of one SaveAPNGEx call; whatever the total
+// (_APNG_CONTEXT::ms) has on top of their sum went to setup and libpng bookkeeping
+using _APNG_PROFILE = struct {
+	double color; // colour type analysis, quantisation and row conversion
+	double diff; // frame diffing: dispose and blend op choice, sub-rectangle search, trial deflates; mapping frames to an APNG_QUANTIZE palette as they are placed
+	double filter; // libpng row filtering, and the smallest preset's filter search
+	double deflate;
+	double crc;
+	double write; // file, memory or callback output
+};
+
+using _APNG_CONTEXT = struct {
+	int preset;
+	int flags;
+	double ms;
+	long long size;
+	int collapsed;
+	int output;
+	_APNG_WRITE write;
+	void* user;
+	unsigned char* data; // APNG_OUTPUT_MEMORY result, released by FreeAPNGBuffer
+	int color_type; // PNG colour type and bit depth that were written
+	int bit_depth;
+	int width; // canvas size that was written
+	int height;
+	_APNG_PROFILE* profile; // filled in when not NULL
+};
+
+using _SINK = struct {
+	FILE* f;
+	_APNG_WRITE write;
+	void* user;
+	unsigned char* p;
+	size_t len;
+	size_t cap;
+	_APNG_PROFILE* profile;
+	long long origin; // clockNs() when WriteAPNG started
+};
+
+// A frame as written to the file; duplicates of it have been folded into its delay.
+// x, y, w, h is the part of the canvas the frame's pixels cover.
+using _SEQUENCE = struct {
+	int frame;
+	int num;
+	int den;
+	int x, y, w, h;
+};
+
+// The smallest lossless format for the frames being written, picked by analyze()
+using _REDUCTION = struct {
+	int color_type;
+	int bit_depth;
+	int channels; // bytes per pixel handed to libpng, before packing
+	int scale; // gray: 255 / (2^bit_depth - 1)
+	int num_palette;
+	int num_trans;
+	png_color palette[256];
+	png_byte trans[256];
+	unsigned int color[256]; // BGRA of each palette entry, in order of appearance
+	unsigned int key[512]; // open addressing colour -> slot in color[]
+	short slot[512];
+};
+
+// Palette built by buildPalette() when the frames have too many colours
+using _QUANT = struct {
+	int count; // entries, padded to a multiple of 4 with unreachable ones
+	int dither; // ordered dithering before the nearest entry is looked up
+	short rg[512]; // R,G and B,A of each entry, interleaved for _mm_madd_epi16
+	short ba[512];
+	unsigned int color[256]; // BGRA of each entry
+	unsigned char cache[32768]; // nearest entry for each opaque 5:5:5 colour cell
+	unsigned char known[4096]; // bit per cache entry
+};
+
+// A range of colour samples split by the median cut
+using _BOX = struct {
+	int begin, end;
+	int shift; // widest channel, as a bit offset into BGRA
+	int range;
+};
+
+// Part of the canvas; outside the area passed to dispose() and optimize() every
+// canvas they compare is known to be transparent black
+using _RECT = struct {
+	int x, y, w, h;
+};
+
+// A dispose/blend pairing tried by optimize(), with the sub-image it needs
+using _CANDIDATE = struct {
+	unsigned char dispose_op;
+	unsigned char blend_op;
+	const unsigned char* pCanvas;
+	int x, y, w, h;
+	int valid;
+	unsigned char* p;
+	unsigned long size;
+};
+
+unsigned char dispose(int a, unsigned char* pImg, unsigned char* pNext, unsigned char* pPrev, const _RECT* area, int xres, int yres, int bpp, int w0, int h0, int x0, int y0,
+                      int* w1, int* h1, int* x1, int* y1) {
 	int i, j, k, diff, area1, area2, area3;
 	int x_min, x_max, y_min, y_max;
 	unsigned char op;
 
-	unsigned char* pImg = Frame[a].p;
-	unsigned char* pNext = Frame[b].p;
-
 	// NONE
 	x_min = xres - 1;
 	x_max = 0;
 	y_min = yres - 1;
 	y_max = 0;
 
-	for (j = 0; j < yres; j++)
-		for (i = 0; i < xres; i++) {
+	for (j = area->y; j < area->y + area->h; j++)
+		for (i = area->x; i < area->x + area->w; i++) {
 			diff = 0;
 			for (k = 0; k < bpp; k++)
 				if (*(pImg + (j * xres + i) * bpp + k) != *(pNext + (j * xres + i) * bpp + k))
@@ -87,8 +246,8 @@ unsigned char dispose(int a, int b, unsigned char* pPrev, int n, int xres, int y
 	y_min = yres - 1;
 	y_max = 0;
 
-	for (j = 0; j < yres; j++)
-		for (i = 0; i < xres; i++) {
+	for (j = area->y; j < area->y + area->h; j++)
+		for (i = area->x; i < area->x + area->w; i++) {
 			diff = 0;
 
 			for (k = 0; k < bpp; k++)
@@ -128,8 +287,8 @@ unsigned char dispose(int a, int b, unsigned char* pPrev, int n, int xres, int y
 		y_min = yres - 1;
 		y_max = 0;
 
-		for (j = 0; j < yres; j++)
-			for (i = 0; i < xres; i++) {
+		for (j = area->y; j < area->y + area->h; j++)
+			for (i = area->x; i < area->x + area->w; i++) {
 				diff = 0;
 
 				if ((i >= x0) && (i < x0 + w0) && (j >= y0) && (j < y0 + h0)) {
@@ -172,14 +331,1086 @@ unsigned char dispose(int a, int b, unsigned char* pPrev, int n, int xres, int y
 	return op;
 }
 
+static void reduceRows(_REDUCTION* r, png_bytepp rows, int w, int h, int bpp, unsigned char* out);
+
+// Deflated size of a w x h sub-image in the format it will be written in: each row
+// goes through reduceRows() first when red is set. Every colour the frames use is
+// already in red's palette, so trials running in parallel only read it. Bit depths
+// below 8 are deflated a byte per pixel, as they are before libpng packs them.
+static unsigned long deflateSize(const unsigned char* p, int w, int h, int bpp, _REDUCTION* red, const _PRESET* preset) {
+	squish::TraceScope trace("trial deflate");
+	z_stream z;
+	unsigned char out[16384];
+	unsigned char* row = NULL;
+	int j, flush, ret = Z_OK;
+
+	if ((red != NULL) && ((row = (unsigned char*)malloc(w * red->channels)) == NULL))
+		return 0xffffffff;
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, preset->level, Z_DEFLATED, 15, preset->mem_level, preset->strategy) != Z_OK) {
+		free(row);
+		return 0xffffffff;
+	}
+
+	for (j = 0; (j < h) && (ret == Z_OK); j++) {
+		auto in = (png_bytep)p + j * w * bpp;
+		if (red != NULL)
+			reduceRows(red, &in, w, 1, bpp, row);
+
+		z.next_in = in;
+		z.avail_in = w * (red != NULL ? red->channels : bpp);
+		flush = j == h - 1 ? Z_FINISH : Z_NO_FLUSH;
+		do {
+			z.next_out = out;
+			z.avail_out = sizeof(out);
+			ret = deflate(&z, flush);
+		}
+		while ((ret == Z_OK) && ((flush == Z_FINISH) || (z.avail_in > 0)));
+	}
+
+	deflateEnd(&z);
+	free(row);
+	return ret == Z_STREAM_END ? z.total_out : 0xffffffff;
+}
+
+// Filters one row, as png_write_filter_row() does; out[0] takes the filter type.
+static void filterRow(int type, const unsigned char* row, const unsigned char* prev, unsigned char* out, int rowbytes, int pixel) {
+	int i, a, b, c, p, pa, pb, pc;
+
+	out[0] = (unsigned char)type;
+	for (i = 0; i < rowbytes; i++) {
+		a = i >= pixel ? row[i - pixel] : 0;
+		b = prev[i];
+		c = i >= pixel ? prev[i - pixel] : 0;
+		switch (type) {
+			case PNG_FILTER_VALUE_SUB:
+				p = a;
+				break;
+			case PNG_FILTER_VALUE_UP:
+				p = b;
+				break;
+			case PNG_FILTER_VALUE_AVG:
+				p = (a + b) >> 1;
+				break;
+			case PNG_FILTER_VALUE_PAETH:
+				pa = abs(b - c);
+				pb = abs(a - c);
+				pc = abs(a + b - 2 * c);
+				p = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+				break;
+			default:
+				p = 0;
+				break;
+		}
+		out[i + 1] = (unsigned char)(row[i] - p);
+	}
+}
+
+// Deflated size of the rows in packed, which follow a row of zeros, filtered with
+// filter k of searchFilters(): 0 to 4 for that filter on every row, 5 for the
+// adaptive choice png_write_find_filter() makes for PNG_ALL_FILTERS (the smallest
+// sum of absolute values per row).
+static void filterTrial(const unsigned char* packed, int h, int rowbytes, int pixel, int k, const _PRESET* preset, unsigned long* size) {
+	squish::TraceScope trace("filter trial");
+	unsigned char out[16384];
+	int i, j, t, ret = Z_OK;
+	z_stream z;
+
+	*size = 0xffffffff;
+	auto filtered = (unsigned char*)malloc((k < 5 ? 1 : 6) * (rowbytes + 1));
+	if (filtered == NULL)
+		return;
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, preset->level, Z_DEFLATED, 15, preset->mem_level, preset->strategy) != Z_OK) {
+		free(filtered);
+		return;
+	}
+
+	for (j = 0; (j < h) && (ret == Z_OK); j++) {
+		const unsigned char* prev = packed + j * rowbytes;
+		const unsigned char* row = prev + rowbytes;
+		unsigned char* pick = filtered;
+
+		if (k < 5)
+			filterRow(k, row, prev, filtered, rowbytes, pixel);
+		else {
+			unsigned long sum, min_sum = 0xffffffff;
+			for (t = 0; t < 5; t++) {
+				unsigned char* f = filtered + (t + 1) * (rowbytes + 1);
+				filterRow(t, row, prev, f, rowbytes, pixel);
+				for (i = 1, sum = 0; i <= rowbytes; i++)
+					sum += f[i] < 128 ? f[i] : 256 - f[i];
+				if (sum < min_sum) {
+					min_sum = sum;
+					pick = f;
+				}
+			}
+		}
+
+		z.next_in = pick;
+		z.avail_in = rowbytes + 1;
+		do {
+			z.next_out = out;
+			z.avail_out = sizeof(out);
+			ret = deflate(&z, j == h - 1 ? Z_FINISH : Z_NO_FLUSH);
+		}
+		while ((ret == Z_OK) && ((j == h - 1) || (z.avail_in > 0)));
+	}
+
+	if (ret == Z_STREAM_END)
+		*size = z.total_out;
+	deflateEnd(&z);
+	free(filtered);
+}
+
+// Filter set for one frame of a preset with search set: the rows, packed as libpng
+// packs bit depths below 8, go through filterTrial() with each of the five filters
+// and the adaptive choice in parallel, and the set that deflates smallest is returned
+// for png_set_filter().
+static int searchFilters(png_bytepp rows, int w, int h, int channels, int bit_depth, const _PRESET* preset) {
+	squish::TraceScope trace("filter search");
+	static const int set[6] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH, PNG_ALL_FILTERS};
+	int rowbytes = (w * channels * bit_depth + 7) / 8;
+	int pixel = bit_depth < 8 ? 1 : channels;
+	unsigned long size[6];
+	std::thread worker[5];
+	int i, j, k, best;
+
+	auto packed = (unsigned char*)malloc(h * rowbytes + rowbytes);
+	if (packed == NULL)
+		return PNG_ALL_FILTERS;
+
+	memset(packed, 0, rowbytes);
+	for (j = 0; j < h; j++) {
+		unsigned char* dst = packed + (j + 1) * rowbytes;
+		if (bit_depth == 8)
+			memcpy(dst, rows[j], rowbytes);
+		else {
+			memset(dst, 0, rowbytes);
+			for (i = 0; i < w; i++)
+				dst[i * bit_depth / 8] |= (unsigned char)(rows[j][i] << (8 - bit_depth - i * bit_depth % 8));
+		}
+	}
+
+	for (k = 1; k < 6; k++)
+		worker[k - 1] = std::thread(filterTrial, packed, h, rowbytes, pixel, k, preset, &size[k]);
+	filterTrial(packed, h, rowbytes, pixel, 0, preset, &size[0]);
+	for (k = 1; k < 6; k++)
+		worker[k - 1].join();
+
+	best = 5;
+	for (k = 0; k < 5; k++)
+		if (size[k] < size[best])
+			best = k;
+
+	free(packed);
+	return set[best];
+}
+
+static void trial(_CANDIDATE* c, unsigned char* pNext, const _RECT* area, int xres, int yres, int bpp, _REDUCTION* red, const _PRESET* preset) {
+	int i, j, k, diff;
+	int x_min, x_max, y_min, y_max;
+	const unsigned char* pCanvas = c->pCanvas;
+
+	x_min = xres - 1;
+	x_max = 0;
+	y_min = yres - 1;
+	y_max = 0;
+
+	for (j = area->y; j < area->y + area->h; j++)
+		for (i = area->x; i < area->x + area->w; i++) {
+			diff = 0;
+			for (k = 0; k < bpp; k++)
+				if (*(pCanvas + (j * xres + i) * bpp + k) != *(pNext + (j * xres + i) * bpp + k))
+					diff = 1;
+
+			if (diff == 1) {
+				if (i < x_min) x_min = i;
+				if (i > x_max) x_max = i;
+				if (j < y_min) y_min = j;
+				if (j > y_max) y_max = j;
+			}
+		}
+
+	if ((x_max < x_min) || (y_max < y_min)) {
+		x_min = x_max = 0;
+		y_min = y_max = 0;
+	}
+
+	c->x = x_min;
+	c->y = y_min;
+	c->w = x_max - x_min + 1;
+	c->h = y_max - y_min + 1;
+	c->valid = 1;
+
+	for (j = 0; j < c->h; j++) {
+		unsigned char* src = pNext + ((j + c->y) * xres + c->x) * bpp;
+		const unsigned char* dst = pCanvas + ((j + c->y) * xres + c->x) * bpp;
+		unsigned char* out = c->p + j * c->w * bpp;
+
+		if (c->blend_op == PNG_BLEND_OP_SOURCE) {
+			memcpy(out, src, c->w * bpp);
+			continue;
+		}
+
+		// OVER leaves the canvas alone under transparent pixels, so unchanged pixels
+		// become zero. A changed pixel only survives OVER exactly when it is opaque
+		// or lands on a fully transparent canvas pixel.
+		for (i = 0; i < c->w * bpp; i += bpp) {
+			if (memcmp(src + i, dst + i, bpp) == 0)
+				memset(out + i, 0, bpp);
+			else if ((src[i + 3] == 255) || ((src[i + 3] != 0) && (dst[i + 3] == 0)))
+				memcpy(out + i, src + i, bpp);
+			else {
+				c->valid = 0;
+				return;
+			}
+		}
+	}
+
+	c->size = deflateSize(c->p, c->w, c->h, bpp, red, preset);
+}
+
+// Builds every dispose op x blend op candidate for the next frame, deflates them in
+// parallel in the format red will write them in and keeps the one that compresses
+// smallest. The winning sub-image is copied into pSub, and its blend op returned
+// through blend_op.
+unsigned char optimize(int a, unsigned char* pImg, unsigned char* pNext, unsigned char* pPrev, unsigned char* pBg, _CANDIDATE* c, const _RECT* area, int xres, int yres, int bpp, int alpha,
+                       int w0, int h0, int x0, int y0, _REDUCTION* red, const _PRESET* preset, int* w1, int* h1, int* x1, int* y1, unsigned char* blend_op, unsigned char* pSub) {
+	int i, j, count, best;
+	std::thread worker[5];
+
+	count = 0;
+	c[count].dispose_op = PNG_DISPOSE_OP_NONE;
+	c[count++].pCanvas = pImg;
+
+	if (a != 0) {
+		c[count].dispose_op = PNG_DISPOSE_OP_PREVIOUS;
+		c[count++].pCanvas = pPrev;
+
+		if (bpp == 4) {
+			memcpy(pBg, pImg, xres * yres * bpp);
+			for (j = y0; j < y0 + h0; j++)
+				memset(pBg + (j * xres + x0) * bpp, 0, w0 * bpp);
+
+			c[count].dispose_op = PNG_DISPOSE_OP_BACKGROUND;
+			c[count++].pCanvas = pBg;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		c[i].blend_op = PNG_BLEND_OP_SOURCE;
+
+	// OVER leaves unchanged pixels transparent, which needs an alpha channel in the file
+	if (alpha) {
+		for (i = 0; i < count; i++) {
+			c[count + i].dispose_op = c[i].dispose_op;
+			c[count + i].pCanvas = c[i].pCanvas;
+			c[count + i].blend_op = PNG_BLEND_OP_OVER;
+		}
+		count *= 2;
+	}
+
+	for (i = 1; i < count; i++)
+		worker[i - 1] = std::thread(trial, &c[i], pNext, area, xres, yres, bpp, red, preset);
+	trial(&c[0], pNext, area, xres, yres, bpp, red, preset);
+	for (i = 1; i < count; i++)
+		worker[i - 1].join();
+
+	best = 0;
+	for (i = 1; i < count; i++)
+		if (c[i].valid && (c[i].size < c[best].size))
+			best = i;
+
+	*w1 = c[best].w;
+	*h1 = c[best].h;
+	*x1 = c[best].x;
+	*y1 = c[best].y;
+	*blend_op = c[best].blend_op;
+	memcpy(pSub, c[best].p, c[best].w * c[best].h * bpp);
+	return c[best].dispose_op;
+}
+
+static unsigned long long hashFrame(const unsigned char* p, int len) {
+	unsigned long long h = 0x9e3779b97f4a7c15ULL ^ len;
+	unsigned long long v;
+	int i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&v, p + i, 8);
+		h = (h ^ v) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	for (; i < len; i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+static unsigned long long gcd(unsigned long long a, unsigned long long b) {
+	while (b != 0) {
+		unsigned long long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// Adds the delay num2/den2 to num1/den1 if the exact sum still fits in a fcTL
+static int addDelay(int* num1, int* den1, int num2, int den2) {
+	unsigned long long num, den, g;
+
+	// a zero denominator means 1/100 second
+	if (*den1 == 0) *den1 = 100;
+	if (den2 == 0) den2 = 100;
+
+	num = (unsigned long long)*num1 * den2 + (unsigned long long)num2 * *den1;
+	den = (unsigned long long)*den1 * den2;
+	g = gcd(num, den);
+	if (g > 1) {
+		num /= g;
+		den /= g;
+	}
+
+	if ((num > 0xffff) || (den > 0xffff))
+		return 0;
+
+	*num1 = (int)num;
+	*den1 = (int)den;
+	return 1;
+}
+
+// Fills seq with the frames to write and returns how many there are, or -1 if a
+// placed frame does not fit on the canvas. When merging, a frame that is
+// byte-identical to the one before it (and in the same place) is dropped and its
+// delay added to that frame instead. A hidden first frame is never merged.
+static int collapse(int n, int xres, int yres, int bpp, unsigned char first, int merge, _SEQUENCE* seq) {
+	int a, m, len;
+	unsigned long long h, last = 0;
+	_SEQUENCE* s;
+
+	m = 0;
+	for (a = 0; a < n; a++) {
+		s = &seq[m];
+		s->frame = a;
+		s->num = Frame[a].num;
+		s->den = Frame[a].den;
+		s->x = Frame[a].w ? Frame[a].x : 0;
+		s->y = Frame[a].w ? Frame[a].y : 0;
+		s->w = Frame[a].w ? Frame[a].w : xres;
+		s->h = Frame[a].w ? Frame[a].h : yres;
+		if ((s->x < 0) || (s->y < 0) || (s->w <= 0) || (s->h <= 0) || (s->x + s->w > xres) || (s->y + s->h > yres))
+			return -1;
+
+		len = s->w * s->h * bpp;
+		h = merge ? hashFrame(Frame[a].p, len) : 0;
+
+		if (merge && (m > 0) && ((first == 0) || (m > 1)) && (h == last) &&
+			(s->x == seq[m - 1].x) && (s->y == seq[m - 1].y) && (s->w == seq[m - 1].w) && (s->h == seq[m - 1].h) &&
+			(memcmp(Frame[seq[m - 1].frame].p, Frame[a].p, len) == 0) &&
+			addDelay(&seq[m - 1].num, &seq[m - 1].den, Frame[a].num, Frame[a].den))
+			continue;
+
+		m++;
+		last = h;
+	}
+	return m;
+}
+
+// Grows r to take in the rectangle covered by s
+static void unite(_RECT* r, const _SEQUENCE* s) {
+	int x_max, y_max;
+
+	if (r->w == 0) {
+		r->x = s->x;
+		r->y = s->y;
+		r->w = s->w;
+		r->h = s->h;
+		return;
+	}
+
+	x_max = r->x + r->w > s->x + s->w ? r->x + r->w : s->x + s->w;
+	y_max = r->y + r->h > s->y + s->h ? r->y + r->h : s->y + s->h;
+	r->x = r->x < s->x ? r->x : s->x;
+	r->y = r->y < s->y ? r->y : s->y;
+	r->w = x_max - r->x;
+	r->h = y_max - r->y;
+}
+
+static void quantizeFrame(_QUANT* q, const _SEQUENCE* s, const unsigned char* src, unsigned char* dst, int stride, int bpp);
+
+// Draws a placed frame onto a cleared canvas, mapped to q when quantising; a frame
+// covering the whole canvas is otherwise used as it is
+static unsigned char* placeFrame(const _SEQUENCE* s, unsigned char* pCanvas, int xres, int yres, int bpp, _QUANT* q) {
+	int j;
+	int full = (s->w == xres) && (s->h == yres);
+
+	if (full && (q == NULL))
+		return Frame[s->frame].p;
+
+	if (!full)
+		memset(pCanvas, 0, xres * yres * bpp);
+	if (q != NULL) {
+		quantizeFrame(q, s, Frame[s->frame].p, pCanvas + (s->y * xres + s->x) * bpp, xres, bpp);
+		return pCanvas;
+	}
+	for (j = 0; j < s->h; j++)
+		memcpy(pCanvas + ((s->y + j) * xres + s->x) * bpp, Frame[s->frame].p + j * s->w * bpp, s->w * bpp);
+	return pCanvas;
+}
+
+// The pixels of a frame as they get written: mapped to q into scratch when
+// quantising
+static const unsigned char* framePixels(const _SEQUENCE* s, int bpp, _QUANT* q, unsigned char* scratch) {
+	if (q == NULL)
+		return Frame[s->frame].p;
+	quantizeFrame(q, s, Frame[s->frame].p, scratch, s->w, bpp);
+	return scratch;
+}
+
+static unsigned int pixelKey(const unsigned char* p, int bpp) {
+	if (bpp == 4)
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+	if (bpp == 3)
+		return p[0] | (p[1] << 8) | (p[2] << 16) | 0xff000000;
+	return p[0] | (p[0] << 8) | (p[0] << 16) | 0xff000000;
+}
+
+// Returns the palette slot of a colour, adding it if there is room, or -1 once
+// more than 256 colours have been seen
+static int paletteSlot(_REDUCTION* r, unsigned int v) {
+	unsigned int h = (v * 0x9e3779b1) >> 23;
+
+	while (r->slot[h] >= 0) {
+		if (r->key[h] == v)
+			return r->slot[h];
+		h = (h + 1) & 511;
+	}
+
+	if (r->num_palette == 256)
+		return -1;
+	r->key[h] = v;
+	r->slot[h] = (short)r->num_palette;
+	r->color[r->num_palette] = v;
+	return r->num_palette++;
+}
+
+// Moves colour v to the first palette slot, adding it if there is room; returns 0
+// if there is not
+static int frontSlot(_REDUCTION* r, unsigned int v) {
+	int i, k = paletteSlot(r, v);
+
+	if (k < 0)
+		return 0;
+	for (i = k; i > 0; i--)
+		r->color[i] = r->color[i - 1];
+	r->color[0] = v;
+	for (i = 0; i < 512; i++)
+		if (r->slot[i] == k)
+			r->slot[i] = 0;
+		else if ((r->slot[i] >= 0) && (r->slot[i] < k))
+			r->slot[i]++;
+	return 1;
+}
+
+// Clears *opaque and *gray when a pixel disproves them
+static void scanPixels(const unsigned char* p, int count, int bpp, int* opaque, int* gray) {
+	int i = 0;
+
+	if (bpp == 1)
+		return;
+
+	if (bpp == 4) {
+#if APNG_USE_SSE2
+		__m128i alpha = _mm_set1_epi32(0xff000000);
+		__m128i color = _mm_set1_epi32(0x0000ffff);
+		__m128i all = _mm_set1_epi32(-1);
+		__m128i diff = _mm_setzero_si128();
+
+		// AND of every pixel keeps alpha at 255 only if all are opaque; B^G and G^R
+		// stay zero only if all are grey
+		for (; i + 4 <= count; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(p + i * 4));
+			all = _mm_and_si128(all, v);
+			diff = _mm_or_si128(diff, _mm_xor_si128(v, _mm_srli_epi32(v, 8)));
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(all, alpha), alpha)) != 0xffff)
+			*opaque = 0;
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(diff, color), _mm_setzero_si128())) != 0xffff)
+			*gray = 0;
+#endif
+		for (; i < count; i++) {
+			if (p[i * 4 + 3] != 255)
+				*opaque = 0;
+			if ((p[i * 4] != p[i * 4 + 1]) || (p[i * 4 + 1] != p[i * 4 + 2]))
+				*gray = 0;
+		}
+		return;
+	}
+
+	for (; (i < count) && *gray; i++)
+		if ((p[i * 3] != p[i * 3 + 1]) || (p[i * 3 + 1] != p[i * 3 + 2]))
+			*gray = 0;
+}
+
+// Adds every colour in p to the palette, skipping runs of the last colour seen.
+// Returns 0 as soon as the palette overflows.
+static int scanPalette(_REDUCTION* r, const unsigned char* p, int count, int bpp, unsigned int* last) {
+	int i = 0, k;
+	unsigned int v;
+
+#if APNG_USE_SSE2
+	if (bpp == 4) {
+		for (; i + 4 <= count; i += 4) {
+			__m128i run = _mm_set1_epi32((int)*last);
+			__m128i v4 = _mm_loadu_si128((const __m128i*)(p + i * 4));
+
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(v4, run)) == 0xffff)
+				continue;
+
+			for (k = i; k < i + 4; k++) {
+				v = pixelKey(p + k * 4, 4);
+				if (v != *last) {
+					if (paletteSlot(r, v) < 0)
+						return 0;
+					*last = v;
+				}
+			}
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		v = pixelKey(p + i * bpp, bpp);
+		if (v != *last) {
+			if (paletteSlot(r, v) < 0)
+				return 0;
+			*last = v;
+		}
+	}
+	return 1;
+}
+
+// Picks the smallest lossless colour type and bit depth for the frames in seq:
+// palette (with tRNS), grey at 1 to 8 bits, grey + alpha, or RGB. zero means the
+// encoder may also write transparent black for pixels an OVER frame leaves alone.
+// With q the frames are looked at as mapped to that palette, one at a time in
+// scratch. Returns 0 when nothing beats the input format.
+static int analyze(_REDUCTION* r, const _SEQUENCE* seq, int m, int pixels, int bpp, int zero, _QUANT* q, unsigned char* scratch) {
+	int opaque = 1, gray = 1, fits = 1, covered = 1;
+	int a, i, n, count, best, gray_depth, pal_depth;
+	int order[256];
+	unsigned int last;
+	const int chunk = 16384;
+
+	memset(r->slot, 0xff, sizeof(r->slot));
+	r->num_palette = 0;
+	r->num_trans = 0;
+
+	// canvas left uncovered by a placed frame is transparent black
+	for (a = 0; a < m; a++)
+		if (seq[a].w * seq[a].h < pixels)
+			covered = 0;
+	if (bpp == 4)
+		opaque = covered;
+
+	// colours are added in order of appearance; one pass, so a quantised frame
+	// is only mapped once
+	for (a = 0; (a < m) && (opaque || gray || fits); a++) {
+		const unsigned char* p = framePixels(&seq[a], bpp, q, scratch);
+
+		count = seq[a].w * seq[a].h;
+		for (i = 0; (i < count) && (opaque || gray); i += chunk)
+			scanPixels(p + i * bpp, count - i < chunk ? count - i : chunk, bpp, &opaque, &gray);
+		if (a == 0) {
+			last = pixelKey(p, bpp);
+			paletteSlot(r, last);
+		}
+		if (fits)
+			fits = scanPalette(r, p, count, bpp, &last);
+	}
+
+	// the background entry comes first, as if it had been seen before any frame
+	if (fits && ((zero && !opaque) || !covered))
+		fits = frontSlot(r, bpp == 4 ? 0 : 0xff000000);
+
+	// bits per pixel of each candidate, the input format being the one to beat
+	best = bpp * 8;
+	r->color_type = -1;
+
+	if (gray && opaque) {
+		for (gray_depth = 1; gray_depth < 8; gray_depth *= 2) {
+			int scale = 255 / ((1 << gray_depth) - 1);
+			for (i = 0; i < r->num_palette; i++)
+				if ((r->color[i] & 0xff) % scale)
+					break;
+			if (i == r->num_palette)
+				break;
+		}
+		if (gray_depth < best) {
+			best = gray_depth;
+			r->color_type = PNG_COLOR_TYPE_GRAY;
+			r->bit_depth = gray_depth;
+			r->channels = 1;
+			r->scale = 255 / ((1 << gray_depth) - 1);
+		}
+	}
+
+	if (fits) {
+		n = r->num_palette;
+		pal_depth = n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+		if (pal_depth < best) {
+			best = pal_depth;
+			r->color_type = PNG_COLOR_TYPE_PALETTE;
+			r->bit_depth = pal_depth;
+			r->channels = 1;
+		}
+	}
+
+	if (gray && !opaque && (16 < best)) {
+		best = 16;
+		r->color_type = PNG_COLOR_TYPE_GRAY_ALPHA;
+		r->bit_depth = 8;
+		r->channels = 2;
+	}
+
+	if (opaque && (24 < best)) {
+		best = 24;
+		r->color_type = PNG_COLOR_TYPE_RGB;
+		r->bit_depth = 8;
+		r->channels = 3;
+	}
+
+	if (r->color_type != PNG_COLOR_TYPE_PALETTE)
+		return r->color_type >= 0;
+
+	// translucent entries first, so tRNS only needs to cover those
+	n = 0;
+	for (i = 0; i < r->num_palette; i++)
+		if ((r->color[i] >> 24) != 255)
+			order[i] = n++;
+	r->num_trans = n;
+	for (i = 0; i < r->num_palette; i++)
+		if ((r->color[i] >> 24) == 255)
+			order[i] = n++;
+
+	for (i = 0; i < r->num_palette; i++) {
+		unsigned int v = r->color[i];
+		r->palette[order[i]].red = (png_byte)(v >> 16);
+		r->palette[order[i]].green = (png_byte)(v >> 8);
+		r->palette[order[i]].blue = (png_byte)v;
+		r->trans[order[i]] = (png_byte)(v >> 24);
+	}
+	for (i = 0; i < 512; i++)
+		if (r->slot[i] >= 0)
+			r->slot[i] = (short)order[r->slot[i]];
+	return 1;
+}
+
+// Converts the BGR(A) rows of a frame into out in the reduced format and points
+// rows at the result. Bit depths below 8 are packed by libpng.
+static void reduceRows(_REDUCTION* r, png_bytepp rows, int w, int h, int bpp, unsigned char* out) {
+	int i, j, index = 0;
+	unsigned int v, last;
+
+	for (j = 0; j < h; j++) {
+		const unsigned char* src = rows[j];
+		unsigned char* dst = out + j * w * r->channels;
+
+		switch (r->color_type) {
+			case PNG_COLOR_TYPE_PALETTE:
+				last = ~pixelKey(src, bpp);
+				for (i = 0; i < w; i++) {
+					v = pixelKey(src + i * bpp, bpp);
+					if (v != last) {
+						index = paletteSlot(r, v);
+						last = v;
+					}
+					dst[i] = (unsigned char)index;
+				}
+				break;
+
+			case PNG_COLOR_TYPE_GRAY:
+				for (i = 0; i < w; i++)
+					dst[i] = (unsigned char)(src[i * bpp] / r->scale);
+				break;
+
+			case PNG_COLOR_TYPE_GRAY_ALPHA:
+				for (i = 0; i < w; i++) {
+					dst[i * 2] = src[i * 4];
+					dst[i * 2 + 1] = src[i * 4 + 3];
+				}
+				break;
+
+			default:
+				for (i = 0; i < w; i++) {
+					dst[i * 3] = src[i * bpp + 2];
+					dst[i * 3 + 1] = src[i * bpp + 1];
+					dst[i * 3 + 2] = src[i * bpp];
+				}
+				break;
+		}
+		rows[j] = dst;
+	}
+}
+
+// Samples kept for building the quantised palette
+#define QUANT_SAMPLES (1 << 18)
+
+static const int Bayer[4][4] = {
+	{0, 8, 2, 10},
+	{12, 4, 14, 6},
+	{3, 11, 1, 9},
+	{15, 7, 13, 5}
+};
+
+static void measureBox(const unsigned int* s, _BOX* b) {
+	int lo[4] = {255, 255, 255, 255}, hi[4] = {0, 0, 0, 0};
+	int i, k, v;
+
+	for (i = b->begin; i < b->end; i++)
+		for (k = 0; k < 4; k++) {
+			v = (s[i] >> (k * 8)) & 0xff;
+			if (v < lo[k]) lo[k] = v;
+			if (v > hi[k]) hi[k] = v;
+		}
+
+	b->range = -1;
+	for (k = 0; k < 4; k++)
+		if (hi[k] - lo[k] > b->range) {
+			b->range = hi[k] - lo[k];
+			b->shift = k * 8;
+		}
+}
+
+// Median cut: keeps halving the box with the most samples times colour spread
+// until there are want boxes, then uses the mean of each as a palette entry
+static int medianCut(unsigned int* s, int n, int want, unsigned int* color) {
+	_BOX box[256];
+	int count = 1, i, k, best;
+	long long score, best_score;
+
+	box[0].begin = 0;
+	box[0].end = n;
+	measureBox(s, &box[0]);
+
+	while (count < want) {
+		best = -1;
+		best_score = 0;
+		for (i = 0; i < count; i++) {
+			score = (long long)box[i].range * (box[i].end - box[i].begin);
+			if (score > best_score) {
+				best_score = score;
+				best = i;
+			}
+		}
+		if (best < 0)
+			break;
+
+		_BOX* b = &box[best];
+		int shift = b->shift;
+		int mid = b->begin + (b->end - b->begin) / 2;
+		std::nth_element(s + b->begin, s + mid, s + b->end,
+		                 [shift](unsigned int x, unsigned int y) { return ((x >> shift) & 0xff) < ((y >> shift) & 0xff); });
+
+		box[count].begin = mid;
+		box[count].end = b->end;
+		b->end = mid;
+		measureBox(s, b);
+		measureBox(s, &box[count++]);
+	}
+
+	for (i = 0; i < count; i++) {
+		unsigned long long sum[4] = {0, 0, 0, 0};
+		unsigned long long len = box[i].end - box[i].begin;
+
+		for (k = box[i].begin; k < box[i].end; k++) {
+			sum[0] += s[k] & 0xff;
+			sum[1] += (s[k] >> 8) & 0xff;
+			sum[2] += (s[k] >> 16) & 0xff;
+			sum[3] += s[k] >> 24;
+		}
+		color[i] = 0;
+		for (k = 0; k < 4; k++)
+			color[i] |= (unsigned int)((sum[k] + len / 2) / len) << (k * 8);
+	}
+	return count;
+}
+
+// Index of the palette entry closest to r,g,b,a; ties go to the lower index
+static int nearestColor(const _QUANT* q, int r, int g, int b, int a) {
+	int i, best = 0, best_dist = 0x7fffffff;
+
+#if APNG_USE_SSE2
+	int dist[4], index[4];
+	__m128i prg = _mm_set1_epi32((g << 16) | r);
+	__m128i pba = _mm_set1_epi32((a << 16) | b);
+	__m128i min = _mm_set1_epi32(0x7fffffff);
+	__m128i min_index = _mm_setzero_si128();
+	__m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+	__m128i four = _mm_set1_epi32(4);
+
+	// four entries at a time: (dr*dr + dg*dg) + (db*db + da*da) in each 32-bit lane
+	for (i = 0; i < q->count; i += 4) {
+		__m128i d1 = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(q->rg + i * 2)), prg);
+		__m128i d2 = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(q->ba + i * 2)), pba);
+		__m128i d = _mm_add_epi32(_mm_madd_epi16(d1, d1), _mm_madd_epi16(d2, d2));
+		__m128i lt = _mm_cmplt_epi32(d, min);
+
+		min = _mm_or_si128(_mm_and_si128(lt, d), _mm_andnot_si128(lt, min));
+		min_index = _mm_or_si128(_mm_and_si128(lt, idx), _mm_andnot_si128(lt, min_index));
+		idx = _mm_add_epi32(idx, four);
+	}
+	_mm_storeu_si128((__m128i*)dist, min);
+	_mm_storeu_si128((__m128i*)index, min_index);
+
+	for (i = 0; i < 4; i++)
+		if ((dist[i] < best_dist) || ((dist[i] == best_dist) && (index[i] < best))) {
+			best_dist = dist[i];
+			best = index[i];
+		}
+#else
+	for (i = 0; i < q->count; i++) {
+		int dr = q->rg[i * 2] - r, dg = q->rg[i * 2 + 1] - g;
+		int db = q->ba[i * 2] - b, da = q->ba[i * 2 + 1] - a;
+		int d = dr * dr + dg * dg + db * db + da * da;
+
+		if (d < best_dist) {
+			best_dist = d;
+			best = i;
+		}
+	}
+#endif
+	return best;
+}
+
+// Maps the frame in src to the palette, into rows of stride pixels at dst
+static void quantizeFrame(_QUANT* q, const _SEQUENCE* s, const unsigned char* src, unsigned char* dst, int stride, int bpp) {
+	int i, j, k, d, r, g, b, a, key, index = 0;
+	unsigned int v, last = 0;
+
+	for (j = 0; j < s->h; j++)
+		for (i = 0; i < s->w; i++) {
+			const unsigned char* p = src + (j * s->w + i) * bpp;
+			unsigned char* out = dst + (j * stride + i) * bpp;
+
+			// without dithering a run of one colour maps to one entry
+			v = pixelKey(p, bpp);
+			if (!q->dither && (v == last) && (i + j > 0)) {
+				for (k = 0; k < bpp; k++)
+					out[k] = (unsigned char)(q->color[index] >> (k * 8));
+				continue;
+			}
+			last = v;
+
+			a = bpp == 4 ? p[3] : 255;
+			if (a == 0) {
+				index = 0;
+				memset(out, 0, bpp);
+				continue;
+			}
+
+			// the offset depends on canvas position only, so pixels that do not
+			// change between frames are mapped the same way in every frame
+			d = q->dither ? Bayer[(s->y + j) & 3][(s->x + i) & 3] - 8 : 0;
+			b = p[0] + d;
+			g = p[1] + d;
+			r = p[2] + d;
+			b = b < 0 ? 0 : b > 255 ? 255 : b;
+			g = g < 0 ? 0 : g > 255 ? 255 : g;
+			r = r < 0 ? 0 : r > 255 ? 255 : r;
+
+			if (a == 255) {
+				key = ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+				if (!(q->known[key >> 3] & (1 << (key & 7)))) {
+					q->cache[key] = (unsigned char)nearestColor(q, (r & 0xf8) | 4, (g & 0xf8) | 4, (b & 0xf8) | 4, 255);
+					q->known[key >> 3] |= 1 << (key & 7);
+				}
+				index = q->cache[key];
+			}
+			else
+				index = nearestColor(q, r, g, b, a);
+
+			for (k = 0; k < bpp; k++)
+				out[k] = (unsigned char)(q->color[index] >> (k * 8));
+		}
+}
+
+// Builds one palette of at most 256 colours shared by the whole animation. One
+// entry is kept for the canvas background (transparent black) when any of it
+// shows. The frames themselves are left alone: framePixels() and placeFrame() map
+// each one to the palette when it is needed. Returns NULL if there is nothing to
+// quantise or no memory.
+static _QUANT* buildPalette(const _SEQUENCE* seq, int m, int xres, int yres, int bpp, int dither) {
+	int a, i, n, count, opaque = 1, gray = 1;
+	long long total = 0, step, pos;
+	unsigned int* s;
+	_QUANT* q;
+
+	for (a = 0; a < m; a++) {
+		total += seq[a].w * seq[a].h;
+		if (seq[a].w * seq[a].h < xres * yres)
+			opaque = 0;
+	}
+	if ((bpp < 3) || (total == 0))
+		return NULL;
+
+	for (a = 0; (a < m) && opaque; a++)
+		scanPixels(Frame[seq[a].frame].p, seq[a].w * seq[a].h, bpp, &opaque, &gray);
+
+	// an even spread of samples over every frame; fully transparent pixels are
+	// left out since they always map to the reserved entry
+	step = total / QUANT_SAMPLES + 1;
+	s = (unsigned int*)malloc((size_t)((total + step - 1) / step) * sizeof(unsigned int));
+	q = (_QUANT*)malloc(sizeof(_QUANT));
+	if ((s == NULL) || (q == NULL)) {
+		free(s);
+		free(q);
+		return NULL;
+	}
+
+	n = 0;
+	pos = 0;
+	for (a = 0; a < m; a++) {
+		for (; pos < seq[a].w * seq[a].h; pos += step) {
+			unsigned int v = pixelKey(Frame[seq[a].frame].p + pos * bpp, bpp);
+			if (v >> 24)
+				s[n++] = v;
+		}
+		pos -= seq[a].w * seq[a].h;
+	}
+
+	count = 0;
+	if (!opaque)
+		q->color[count++] = bpp == 4 ? 0 : 0xff000000;
+	if (n > 0)
+		count += medianCut(s, n, 256 - count, q->color + count);
+	free(s);
+
+	for (i = 0; i < 256; i++) {
+		unsigned int v = q->color[i];
+		int far = i >= count;
+
+		q->rg[i * 2] = far ? 0x3fff : (short)((v >> 16) & 0xff);
+		q->rg[i * 2 + 1] = far ? 0x3fff : (short)((v >> 8) & 0xff);
+		q->ba[i * 2] = far ? 0x3fff : (short)(v & 0xff);
+		q->ba[i * 2 + 1] = far ? 0x3fff : (short)(v >> 24);
+	}
+	q->count = (count + 3) & ~3;
+	q->dither = dither;
+	memset(q->known, 0, sizeof(q->known));
+	return q;
+}
+
 __declspec(dllexport) void CreateFrame(unsigned char* pdata, int num, int den, int i, int len) {
 	LPDWORD resu = 0;
 	Frame[i].num = num;
 	Frame[i].den = den;
 	Frame[i].p = (unsigned char*)malloc(len);
+	Frame[i].w = Frame[i].h = 0;
+	Frame[i].x = Frame[i].y = 0;
 	memcpy(Frame[i].p, pdata, len);
 }
 
+// A frame that only covers w x h pixels with its top left corner at x, y. The
+// position may be negative; SaveAPNGPlaced moves the canvas to fit every frame.
+__declspec(dllexport) void CreateFrameAt(unsigned char* pdata, int num, int den, int i, int w, int h, int x, int y, int bpp) {
+	Frame[i].num = num;
+	Frame[i].den = den;
+	Frame[i].p = (unsigned char*)malloc(w * h * bpp);
+	Frame[i].w = w;
+	Frame[i].h = h;
+	Frame[i].x = x;
+	Frame[i].y = y;
+	memcpy(Frame[i].p, pdata, w * h * bpp);
+}
+
+static long long clockNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Stopwatch for _APNG_PROFILE: the start of a span is subtracted from the total and its end added
+static void profileMark(double* total, long long origin, int start) {
+	double t = (double)(clockNs() - origin) / 1e6;
+	*total += start ? -t : t;
+}
+
+// Marks the start or end of a phase in the profile, when there is one, and in the trace
+static void phaseMark(double* total, const char* name, long long origin, int start) {
+	if (total != NULL)
+		profileMark(total, origin, start);
+	if (squish::TraceEnabled())
+		squish::TraceEmit(name, start ? 'B' : 'E');
+}
+
+// png_set_phase_fn callback
+static void profilePhase(png_structp png_ptr, int phase, int start) {
+	auto sink = (_SINK*)png_get_phase_ptr(png_ptr);
+	_APNG_PROFILE* prof = sink->profile;
+
+	if (phase == PNG_PHASE_FILTER)
+		phaseMark(prof ? &prof->filter : NULL, "filter", sink->origin, start);
+	else if (phase == PNG_PHASE_DEFLATE)
+		phaseMark(prof ? &prof->deflate : NULL, "deflate", sink->origin, start);
+	else
+		phaseMark(prof ? &prof->crc : NULL, "crc", sink->origin, start);
+}
+
+static void sinkWrite(png_structp png_ptr, png_bytep data, png_size_t length) {
+	auto sink = (_SINK*)png_get_io_ptr(png_ptr);
+	const char* error = NULL;
+
+	phaseMark(sink->profile ? &sink->profile->write : NULL, "write", sink->origin, 1);
+	if (sink->f != NULL) {
+		if (fwrite(data, 1, length, sink->f) != length)
+			error = "Write Error";
+	}
+	else if (sink->write != NULL) {
+		if (!sink->write(sink->user, data, (int)length))
+			error = "Write Error";
+	}
+	else {
+		if (sink->len + length > sink->cap) {
+			size_t cap = sink->cap ? sink->cap : 65536;
+			while (cap < sink->len + length)
+				cap *= 2;
+
+			auto p = (unsigned char*)realloc(sink->p, cap);
+			if (p == NULL)
+				error = "Out of memory";
+			else {
+				sink->p = p;
+				sink->cap = cap;
+			}
+		}
+		if (error == NULL)
+			memcpy(sink->p + sink->len, data, length);
+	}
+	sink->len += length;
+	// end the phase before png_error(), which does not return
+	phaseMark(sink->profile ? &sink->profile->write : NULL, "write", sink->origin, 0);
+	if (error != NULL)
+		png_error(png_ptr, error);
+}
+
+static void sinkFlush(png_structp png_ptr) {
+	auto sink = (_SINK*)png_get_io_ptr(png_ptr);
+
+	if (sink->f != NULL)
+		fflush(sink->f);
+}
+
+// png_set_compression_fn callback: deflates a whole image or frame on all cores
+static png_bytep compressIDAT(png_structp png_ptr, png_const_bytep data, png_size_t length, png_size_tp out_length) {
+	auto preset = (const _PRESET*)png_get_compression_ptr(png_ptr);
+	size_t cap = ParallelDeflateBound(length);
+	auto out = (png_bytep)png_malloc(png_ptr, cap);
+
+	if (ParallelDeflate(data, length, preset->level, preset->mem_level, preset->strategy, 0, out, cap, out_length) != Z_OK) {
+		png_free(png_ptr, out);
+		return NULL;
+	}
+	return out;
+}
+
 #ifdef DEBUG
 void logMessage(FILE* logFile, char* text)
 {
@@ -188,12 +1419,32 @@ void logMessage(FILE* logFile, char* text)
 #endif
 
 
-__declspec(dllexport) void SaveAPNG(char* szImage, int n, int xres, int yres, int bpp, unsigned char first) {
-	FILE* f;
-	int a, i, j, k;
+static int WriteAPNG(char* szImage, int n, int xres, int yres, int bpp, unsigned char first, _APNG_CONTEXT* ctx) {
+	squish::TraceScope trace("WriteAPNG");
+	_SINK sink;
+	int a, i, j, k, m;
+	int animated;
+	int flags = ctx->flags;
+	const _PRESET* preset = &Preset[ctx->preset];
+	int ok = 0;
 	int x0, y0, w0, h0;
 	int x1, y1, w1, h1;
+	int sub = 0, next_sub = 0;
 	unsigned char dispose_op = PNG_DISPOSE_OP_NONE;
+	unsigned char blend_op = PNG_BLEND_OP_SOURCE, next_blend_op = PNG_BLEND_OP_SOURCE;
+	unsigned char *pSub = NULL, *pNextSub = NULL, *pBg = NULL, *pTmp;
+	unsigned char* pRed = NULL;
+	_QUANT* quant = NULL;
+	unsigned char *pCanvas[2] = {NULL, NULL}, *pImg, *pNext = NULL;
+	_RECT area, disp = {0, 0, 0, 0};
+	_REDUCTION* red = NULL;
+	int reduced;
+	int alpha = bpp == 4;
+	int filters = PNG_ALL_FILTERS;
+	volatile int framing = 0; // inside the "frame" trace span, which a png_error() longjmp leaves open
+	_CANDIDATE c[6];
+	_APNG_PROFILE* prof = ctx->profile;
+	long long origin = clockNs();
 	png_structp png_ptr;
 	png_infop info_ptr;
 #ifdef DEBUG
@@ -208,10 +1459,108 @@ __declspec(dllexport) void SaveAPNG(char* szImage, int n, int xres, int yres, in
 #ifdef DEBUG
     logMessage(logFile,"memory error\r\n");
 #endif
-		return;
+		return 0;
+	}
+
+	auto seq = (_SEQUENCE*)malloc(n * sizeof(_SEQUENCE));
+	if (seq == NULL) {
+		free(pDisp);
+		return 0;
+	}
+
+	m = collapse(n, xres, yres, bpp, first, flags & APNG_COLLAPSE_DUPLICATES, seq);
+	if (m < 0) {
+		free(pDisp);
+		free(seq);
+		return 0;
+	}
+	ctx->collapsed = n - m;
+	ctx->width = xres;
+	ctx->height = yres;
+
+	// placed frames are drawn onto a canvas only while they are being written
+	for (a = 0; a < m; a++)
+		if ((seq[a].w != xres) || (seq[a].h != yres)) {
+			pCanvas[0] = (unsigned char*)malloc(xres * yres * bpp);
+			pCanvas[1] = (unsigned char*)malloc(xres * yres * bpp);
+			if ((pCanvas[0] == NULL) || (pCanvas[1] == NULL)) {
+				free(pCanvas[0]);
+				free(pCanvas[1]);
+				free(pDisp);
+				free(seq);
+				return 0;
+			}
+			break;
+		}
+
+	// a single visible frame is written as a plain PNG only when asked for
+	animated = !(flags & APNG_PLAIN_SINGLE_FRAME) || (m > 1) || first;
+
+	memset(c, 0, sizeof(c));
+	if (flags & APNG_OPTIMIZE_OPS) {
+		pSub = (unsigned char*)malloc(xres * yres * bpp);
+		pNextSub = (unsigned char*)malloc(xres * yres * bpp);
+		pBg = (unsigned char*)malloc(xres * yres * bpp);
+		for (k = 0; k < 6; k++)
+			c[k].p = (unsigned char*)malloc(xres * yres * bpp);
+
+		if ((pSub == NULL) || (pNextSub == NULL) || (pBg == NULL) || (c[0].p == NULL) || (c[1].p == NULL) ||
+			(c[2].p == NULL) || (c[3].p == NULL) || (c[4].p == NULL) || (c[5].p == NULL))
+			flags &= ~APNG_OPTIMIZE_OPS;
+	}
+
+	// quantised frames are always written with the palette they were mapped to
+	if (flags & APNG_QUANTIZE)
+		flags &= ~APNG_KEEP_COLOR_TYPE;
+
+	if (prof != NULL)
+		memset(prof, 0, sizeof(_APNG_PROFILE));
+
+	if (!(flags & APNG_KEEP_COLOR_TYPE)) {
+		phaseMark(prof ? &prof->color : NULL, "colour", origin, 1);
+		red = (_REDUCTION*)malloc(sizeof(_REDUCTION));
+		reduced = (red != NULL) && analyze(red, seq, m, xres * yres, bpp, (flags & APNG_OPTIMIZE_OPS) && (bpp == 4), NULL, NULL);
+
+		// too many colours for a palette losslessly: quantise, then the second
+		// analysis finds the palette the mapped frames use. Frames are mapped into
+		// the canvases as they are needed rather than copied up front.
+		if ((red != NULL) && (flags & APNG_QUANTIZE) && (!reduced || (red->channels > 1))) {
+			if (pCanvas[0] == NULL) {
+				pCanvas[0] = (unsigned char*)malloc(xres * yres * bpp);
+				pCanvas[1] = (unsigned char*)malloc(xres * yres * bpp);
+			}
+			if ((pCanvas[0] != NULL) && (pCanvas[1] != NULL))
+				quant = buildPalette(seq, m, xres, yres, bpp, flags & APNG_DITHER);
+			if (quant != NULL)
+				reduced = analyze(red, seq, m, xres * yres, bpp, (flags & APNG_OPTIMIZE_OPS) && (bpp == 4), quant, pCanvas[0]);
+		}
+
+		if (reduced)
+			pRed = (unsigned char*)malloc(xres * yres * red->channels);
+		if (pRed == NULL) {
+			free(red);
+			red = NULL;
+		}
+		else
+			alpha = (red->color_type & PNG_COLOR_MASK_ALPHA) || red->num_trans;
+		phaseMark(prof ? &prof->color : NULL, "colour", origin, 0);
 	}
+	ctx->color_type = red ? red->color_type : (bpp == 4) ? PNG_COLOR_TYPE_RGB_ALPHA : (bpp == 3) ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY;
+	ctx->bit_depth = red ? red->bit_depth : 8;
+
+	memset(&sink, 0, sizeof(sink));
+	sink.write = ctx->write;
+	sink.user = ctx->user;
+	sink.profile = prof;
+	sink.origin = origin;
+	phaseMark(prof ? &prof->write : NULL, "write", origin, 1);
+	if (ctx->output == APNG_OUTPUT_FILE)
+		sink.f = fopen(szImage, "wb");
+	else if (ctx->output == APNG_OUTPUT_MEMORY)
+		sink.write = NULL;
+	phaseMark(prof ? &prof->write : NULL, "write", origin, 0);
 
-	if ((f = fopen(szImage, "wb")) != 0) {
+	if ((sink.f != NULL) || (ctx->output == APNG_OUTPUT_MEMORY) || ((ctx->output == APNG_OUTPUT_CALLBACK) && (sink.write != NULL))) {
 		png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 
 		if (png_ptr != NULL) {
@@ -219,15 +1568,32 @@ __declspec(dllexport) void SaveAPNG(char* szImage, int n, int xres, int yres, in
 
 			if (info_ptr != NULL) {
 				if (!setjmp(png_jmpbuf(png_ptr))) {
-					png_init_io(png_ptr, f);
+					png_set_write_fn(png_ptr, &sink, sinkWrite, sinkFlush);
+
+					png_set_compression_level(png_ptr, preset->level);
+					png_set_compression_mem_level(png_ptr, preset->mem_level);
+					png_set_compression_strategy(png_ptr, preset->strategy);
+					png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, preset->filters);
+					if (flags & APNG_PARALLEL_DEFLATE)
+						png_set_compression_fn(png_ptr, (png_voidp)preset, compressIDAT);
+					if ((prof != NULL) || squish::TraceEnabled())
+						png_set_phase_fn(png_ptr, &sink, profilePhase);
 
-					png_set_IHDR(png_ptr, info_ptr, xres, yres, 8,
-					             (bpp == 4) ? PNG_COLOR_TYPE_RGB_ALPHA : (bpp == 3) ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY,
+					png_set_IHDR(png_ptr, info_ptr, xres, yres, ctx->bit_depth, ctx->color_type,
 					             PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+					if ((red != NULL) && (red->color_type == PNG_COLOR_TYPE_PALETTE)) {
+						png_set_PLTE(png_ptr, info_ptr, red->palette, red->num_palette);
+						if (red->num_trans)
+							png_set_tRNS(png_ptr, info_ptr, red->trans, red->num_trans, NULL);
+					}
 
-					png_set_acTL(png_ptr, info_ptr, n, 0);
-					png_set_first_frame_is_hidden(png_ptr, info_ptr, first);
+					if (animated) {
+						png_set_acTL(png_ptr, info_ptr, m, 0);
+						png_set_first_frame_is_hidden(png_ptr, info_ptr, first);
+					}
 					png_write_info(png_ptr, info_ptr);
+					if (ctx->bit_depth < 8)
+						png_set_packing(png_ptr);
 
 					auto row_pointers = (png_bytepp)png_malloc(png_ptr, sizeof(png_bytep) * yres);
 
@@ -239,25 +1605,71 @@ __declspec(dllexport) void SaveAPNG(char* szImage, int n, int xres, int yres, in
 					for (k = 0; k < xres * yres * bpp; k++)
 						*(pDisp + k) = 0;
 
-					for (a = 0; a < n; a++) {
-						png_set_bgr(png_ptr);
+					pImg = placeFrame(&seq[0], pCanvas[0], xres, yres, bpp, quant);
+					for (a = 0; a < m; a++) {
+						// not a TraceScope: png_error() longjmps out of this loop
+						squish::TraceBegin("frame");
+						framing = 1;
+						if (red == NULL)
+							png_set_bgr(png_ptr);
 
-						if (a < n - 1)
-							dispose_op = dispose(a, a + 1, pDisp, n, xres, yres, bpp, w0, h0, x0, y0, &w1, &h1, &x1, &y1);
+						next_sub = 0;
+						if (a < m - 1) {
+							phaseMark(prof ? &prof->diff : NULL, "diff", origin, 1);
+							pNext = placeFrame(&seq[a + 1], pCanvas[(a + 1) & 1], xres, yres, bpp, quant);
+							area = disp;
+							unite(&area, &seq[a]);
+							unite(&area, &seq[a + 1]);
+							if ((flags & APNG_OPTIMIZE_OPS) && ((first == 0) || (a != 0))) {
+								dispose_op = optimize(seq[a].frame, pImg, pNext, pDisp, pBg, c, &area, xres, yres, bpp, alpha, w0, h0, x0, y0,
+								                      red, preset, &w1, &h1, &x1, &y1, &next_blend_op, pNextSub);
+								next_sub = 1;
+							}
+							else
+								dispose_op = dispose(seq[a].frame, pImg, pNext, pDisp, &area, xres, yres, bpp, w0, h0, x0, y0, &w1, &h1, &x1, &y1);
+							phaseMark(prof ? &prof->diff : NULL, "diff", origin, 0);
+						}
 						else
 							dispose_op = PNG_DISPOSE_OP_NONE;
 
 						for (k = 0; k < h0; k++)
-							row_pointers[k] = Frame[a].p + ((k + y0) * xres + x0) * bpp;
+							row_pointers[k] = sub ? pSub + k * w0 * bpp : pImg + ((k + y0) * xres + x0) * bpp;
+						if (red != NULL) {
+							phaseMark(prof ? &prof->color : NULL, "colour", origin, 1);
+							reduceRows(red, row_pointers, w0, h0, bpp, pRed);
+							phaseMark(prof ? &prof->color : NULL, "colour", origin, 0);
+						}
+						if (preset->search) {
+							phaseMark(prof ? &prof->filter : NULL, "filter", origin, 1);
+							filters = searchFilters(row_pointers, w0, h0, red != NULL ? red->channels : bpp, ctx->bit_depth, preset);
+							phaseMark(prof ? &prof->filter : NULL, "filter", origin, 0);
+						}
+
+						if (!animated) {
+							if (preset->search)
+								png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filters);
+							png_write_image(png_ptr, row_pointers);
+							pImg = pNext;
+							framing = 0;
+							squish::TraceEnd("frame");
+							continue;
+						}
 
 						png_write_frame_head(png_ptr, info_ptr, row_pointers, w0, h0, x0, y0,
-						                     Frame[a].num, Frame[a].den, dispose_op, PNG_BLEND_OP_SOURCE);
+						                     seq[a].num, seq[a].den, dispose_op, blend_op);
+						// after png_write_frame_head(), which drops the last frame's row buffers
+						if (preset->search)
+							png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filters);
 						png_write_image(png_ptr, row_pointers);
 						png_write_frame_tail(png_ptr, info_ptr);
 
 						if ((first == 0) || (a != 0)) {
 							if (dispose_op != PNG_DISPOSE_OP_PREVIOUS) {
-								memcpy(pDisp, Frame[a].p, xres * yres * bpp);
+								memcpy(pDisp, pImg, xres * yres * bpp);
+								disp.x = seq[a].x;
+								disp.y = seq[a].y;
+								disp.w = seq[a].w;
+								disp.h = seq[a].h;
 								if (dispose_op == PNG_DISPOSE_OP_BACKGROUND) {
 									for (j = y0; j < y0 + h0; j++)
 										for (i = x0; i < x0 + w0; i++)
@@ -269,32 +1681,139 @@ __declspec(dllexport) void SaveAPNG(char* szImage, int n, int xres, int yres, in
 							h0 = h1;
 							x0 = x1;
 							y0 = y1;
+
+							sub = next_sub;
+							blend_op = next_sub ? next_blend_op : PNG_BLEND_OP_SOURCE;
+							pTmp = pSub;
+							pSub = pNextSub;
+							pNextSub = pTmp;
 						}
+						pImg = pNext;
+						framing = 0;
+						squish::TraceEnd("frame");
 					}
 
 					png_write_end(png_ptr, info_ptr);
 					free(row_pointers);
 					png_destroy_write_struct(&png_ptr, &info_ptr);
+					ok = 1;
 #ifdef DEBUG
           logMessage(logFile," OK");
 #endif
 				}
-				else
+				else {
+					if (framing)
+						squish::TraceEnd("frame");
 					png_destroy_write_struct(&png_ptr, &info_ptr);
+				}
 			}
 			else
 				png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
 		}
-		fclose(f);
+		if (sink.f != NULL) {
+			phaseMark(prof ? &prof->write : NULL, "write", origin, 1);
+			fclose(sink.f);
+			phaseMark(prof ? &prof->write : NULL, "write", origin, 0);
+		}
 	}
 #ifdef DEBUG
   else
     logMessage(logFile,"Error: can't open the file\r\n");
 #endif
 
+	ctx->size = ok ? sink.len : 0;
+	if (ok && (ctx->output == APNG_OUTPUT_MEMORY))
+		ctx->data = sink.p;
+	else
+		free(sink.p);
+
+	free(quant);
+	free(pCanvas[0]);
+	free(pCanvas[1]);
 	free(pDisp);
+	free(seq);
+	free(pSub);
+	free(pNextSub);
+	free(pBg);
+	free(pRed);
+	free(red);
+	for (k = 0; k < 6; k++)
+		free(c[k].p);
 #ifdef DEBUG
   fclose(logFile);
 #endif
+	return ok;
+}
+
+__declspec(dllexport) void SaveAPNG(char* szImage, int n, int xres, int yres, int bpp, unsigned char first) {
+	_APNG_CONTEXT ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.preset = APNG_PRESET_BALANCED;
+	WriteAPNG(szImage, n, xres, yres, bpp, first, &ctx);
+}
+
+__declspec(dllexport) int SaveAPNGEx(char* szImage, int n, int xres, int yres, int bpp, unsigned char first, _APNG_CONTEXT* ctx) {
+	int ok;
+
+	if ((ctx->preset < APNG_PRESET_FASTEST) || (ctx->preset > APNG_PRESET_SMALLEST))
+		ctx->preset = APNG_PRESET_BALANCED;
+	ctx->data = NULL;
+
+	auto start = std::chrono::steady_clock::now();
+	ok = WriteAPNG(szImage, n, xres, yres, bpp, first, ctx);
+	auto end = std::chrono::steady_clock::now();
+
+	ctx->ms = std::chrono::duration<double, std::milli>(end - start).count();
+	return ok;
+}
+
+// Writes frames from CreateFrameAt on the union of their rectangles, which is
+// returned in ctx->width and ctx->height
+__declspec(dllexport) int SaveAPNGPlaced(char* szImage, int n, int bpp, unsigned char first, _APNG_CONTEXT* ctx) {
+	int a, ok;
+	int x_min = 0x7fffffff, y_min = 0x7fffffff, x_max = -0x7fffffff, y_max = -0x7fffffff;
+
+	for (a = 0; a < n; a++) {
+		if ((Frame[a].w <= 0) || (Frame[a].h <= 0))
+			return 0;
+		if (Frame[a].x < x_min) x_min = Frame[a].x;
+		if (Frame[a].y < y_min) y_min = Frame[a].y;
+		if (Frame[a].x + Frame[a].w > x_max) x_max = Frame[a].x + Frame[a].w;
+		if (Frame[a].y + Frame[a].h > y_max) y_max = Frame[a].y + Frame[a].h;
+	}
+	if (n <= 0)
+		return 0;
+
+	for (a = 0; a < n; a++) {
+		Frame[a].x -= x_min;
+		Frame[a].y -= y_min;
+	}
+	ok = SaveAPNGEx(szImage, n, x_max - x_min, y_max - y_min, bpp, first, ctx);
+	for (a = 0; a < n; a++) {
+		Frame[a].x += x_min;
+		Frame[a].y += y_min;
+	}
+	return ok;
+}
+
+__declspec(dllexport) void FreeAPNGBuffer(_APNG_CONTEXT* ctx) {
+	free(ctx->data);
+	ctx->data = NULL;
+}
+
+__declspec(dllexport) int SaveAPNGPreset(char* szImage, int n, int xres, int yres, int bpp, unsigned char first, int preset, _ENCODE_RESULT* result) {
+	int ok;
+	_APNG_CONTEXT ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.preset = preset;
+	ok = SaveAPNGEx(szImage, n, xres, yres, bpp, first, &ctx);
+
+	if (result != NULL) {
+		result->ms = ctx.ms;
+		result->size = ctx.size;
+	}
+	return ok;
 }
 }
@@ -0,0 +1,546 @@
+//Encoder benchmark for libapng
+//----------------------------------------------------------
+//This program is free software; you can redistribute it and/or
+//modify it under the terms of the GNU General Public License
+//as published by the Free Software Foundation; either version 2
+//of the License, or (at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+
+// Encodes generated animations with every preset and reports where SaveAPNGEx
+// spends its time. The frames are built with integer arithmetic only, so every
+// build and machine encodes the same pixels; the output hash shows whether a
+// change altered the written file.
+//
+// With -w the hashes of a set of encoder flag combinations are stored in a
+// golden file, and -g checks a build against it. Each checked encode is also
+// decoded with ReadAPNG and compared with its source frames: lossless flags
+// must give the frames back exactly, quantised ones within the stored error.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#define APNG_PRESET_FASTEST 0
+#define APNG_PRESET_SMALLEST 2
+
+#define APNG_OPTIMIZE_OPS 0x1
+#define APNG_COLLAPSE_DUPLICATES 0x2
+#define APNG_PARALLEL_DEFLATE 0x4
+#define APNG_KEEP_COLOR_TYPE 0x8
+#define APNG_QUANTIZE 0x10
+#define APNG_DITHER 0x20
+
+#define APNG_OUTPUT_FILE 0
+#define APNG_OUTPUT_MEMORY 1
+
+#define APNG_DECODE_COMPOSITE 0
+
+// These mirror the declarations in apng.cpp
+extern "C" {
+using _APNG_PROFILE = struct {
+	double color;
+	double diff;
+	double filter;
+	double deflate;
+	double crc;
+	double write;
+};
+
+using _APNG_CONTEXT = struct {
+	int preset;
+	int flags;
+	double ms;
+	long long size;
+	int collapsed;
+	int output;
+	int (*write)(void* user, unsigned char* data, int length);
+	void* user;
+	unsigned char* data;
+	int color_type;
+	int bit_depth;
+	int width;
+	int height;
+	_APNG_PROFILE* profile;
+};
+
+// These mirror the declarations in apngread.cpp
+using _APNG_INFO = struct {
+	int width;
+	int height;
+	int frames;
+	int plays;
+	int size;
+};
+
+using _APNG_FRAME = struct {
+	int x, y, w, h;
+	int num;
+	int den;
+	unsigned char dispose_op;
+	unsigned char blend_op;
+	int offset;
+};
+
+__declspec(dllimport) void CreateFrame(unsigned char* pdata, int num, int den, int i, int len);
+__declspec(dllimport) int SaveAPNGEx(char* szImage, int n, int xres, int yres, int bpp, unsigned char first, _APNG_CONTEXT* ctx);
+__declspec(dllimport) void FreeAPNGBuffer(_APNG_CONTEXT* ctx);
+__declspec(dllimport) int ReadAPNGInfo(char* szImage, unsigned char* data, int length, _APNG_INFO* info);
+__declspec(dllimport) int ReadAPNG(char* szImage, unsigned char* data, int length, int mode, unsigned char* pixels, _APNG_FRAME* frames);
+__declspec(dllimport) int _DLLEXPORT_TraceStart(int capacity);
+__declspec(dllimport) void _DLLEXPORT_TraceStop();
+__declspec(dllimport) int _DLLEXPORT_TraceWrite(const char* path);
+}
+
+using _SIZE = struct {
+	int w, h, frames;
+};
+
+static const _SIZE Sizes[] = {
+	{128, 128, 32},
+	{400, 300, 24},
+	{1024, 768, 8}
+};
+
+static const char* PresetName[] = {"fastest", "balanced", "smallest"};
+
+static unsigned int seed;
+
+static unsigned int nextRandom() {
+	seed = seed * 1664525u + 1013904223u;
+	return seed >> 8;
+}
+
+// Integer sine approximation, period 256, range -127..127
+static int wave(int t) {
+	int x = t & 127;
+	int y = x * (128 - x) >> 5;
+	return (t & 128) ? -y : y;
+}
+
+static unsigned char clamp(int v) {
+	return (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// Shaded discs with a dark outline moving over a transparent canvas
+static void drawSprites(unsigned char* p, int w, int h, int a) {
+	int k, x, y;
+
+	memset(p, 0, w * h * 4);
+	seed = 1;
+	for (k = 0; k < 5; k++) {
+		int r = h / 10 + (int)(nextRandom() % (h / 8 + 1));
+		int cx = w / 2 + wave(a * (3 + k) + (int)(nextRandom() & 255)) * (w / 2 - r) / 127;
+		int cy = h / 2 + wave(a * (2 + k) + (int)(nextRandom() & 255) + 64) * (h / 2 - r) / 127;
+		int red = nextRandom() & 255, green = nextRandom() & 255, blue = nextRandom() & 255;
+
+		for (y = cy - r; y <= cy + r; y++)
+			for (x = cx - r; x <= cx + r; x++) {
+				int d = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+				if ((x < 0) || (y < 0) || (x >= w) || (y >= h) || (d > r * r))
+					continue;
+
+				unsigned char* q = p + (y * w + x) * 4;
+				int shade = (d > (r - 2) * (r - 2)) ? 64 : 256 - 96 * (y - cy + r) / (2 * r);
+				q[0] = clamp(blue * shade >> 8);
+				q[1] = clamp(green * shade >> 8);
+				q[2] = clamp(red * shade >> 8);
+				q[3] = (d > (r - 1) * (r - 1)) ? 128 : 255;
+			}
+	}
+}
+
+// A translucent plasma over the whole canvas: every pixel changes every frame
+static void drawEffect(unsigned char* p, int w, int h, int a) {
+	int x, y;
+
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++) {
+			unsigned char* q = p + (y * w + x) * 4;
+			int v = wave(x * 256 / w * 2 + a * 5) + wave(y * 256 / h * 3 - a * 7) + wave((x + y) * 256 / (w + h) * 4 + a * 3);
+			q[0] = clamp(128 + v);
+			q[1] = clamp(128 + v / 2 + wave(a * 4) / 4);
+			q[2] = clamp(200 - v / 2);
+			q[3] = clamp(160 + v / 3);
+		}
+}
+
+// An opaque scene held for three frames at a time, with a small blinking area
+static void drawHold(unsigned char* p, int w, int h, int a) {
+	int x, y;
+	int step = a / 3;
+	int bx = w * 3 / 5, by = h / 5, bw = w / 8, bh = h / 8;
+
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++) {
+			unsigned char* q = p + (y * w + x) * 4;
+			int ground = y > h * 2 / 3 + wave(x * 256 / w) / 16;
+			q[0] = ground ? 40 + (x * 7 + y * 3) % 16 : clamp(255 - y * 128 / h);
+			q[1] = ground ? clamp(120 + wave(x * 3) / 8) : clamp(200 - y * 64 / h);
+			q[2] = ground ? 60 : 120;
+			q[3] = 255;
+			if ((x >= bx) && (x < bx + bw) && (y >= by) && (y < by + bh) && (step & 1)) {
+				q[0] = 40;
+				q[1] = clamp(220 - step * 8);
+				q[2] = 255;
+			}
+		}
+}
+
+using _SCENARIO = struct {
+	const char* name;
+	void (*draw)(unsigned char* p, int w, int h, int a);
+};
+
+static const _SCENARIO Scenarios[] = {
+	{"sprites", drawSprites},
+	{"effect", drawEffect},
+	{"hold", drawHold}
+};
+
+// The flag combinations a golden file covers
+static const int GoldenFlags[] = {
+	0,
+	APNG_OPTIMIZE_OPS | APNG_COLLAPSE_DUPLICATES,
+	APNG_OPTIMIZE_OPS | APNG_COLLAPSE_DUPLICATES | APNG_PARALLEL_DEFLATE,
+	APNG_KEEP_COLOR_TYPE,
+	APNG_QUANTIZE,
+	APNG_OPTIMIZE_OPS | APNG_QUANTIZE | APNG_DITHER
+};
+
+using _GOLDEN = struct {
+	char key[64];
+	unsigned int hash;
+	double rms;
+};
+
+static unsigned int hashBytes(const unsigned char* p, size_t len) {
+	unsigned int h = 2166136261u;
+	size_t k;
+
+	for (k = 0; k < len; k++)
+		h = (h ^ p[k]) * 16777619u;
+	return h;
+}
+
+static unsigned int hashFile(const char* path) {
+	std::vector<unsigned char> data;
+	unsigned char buf[65536];
+	size_t len;
+	FILE* f = fopen(path, "rb");
+
+	if (f == NULL)
+		return 0;
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.insert(data.end(), buf, buf + len);
+	fclose(f);
+	return hashBytes(data.data(), data.size());
+}
+
+static void goldenKey(char* key, size_t len, const _SCENARIO* scenario, const _SIZE* size, int preset, int flags) {
+	snprintf(key, len, "%s %dx%dx%d %s 0x%02x", scenario->name, size->w, size->h, size->frames, PresetName[preset], flags);
+}
+
+static int readGolden(const char* path, std::vector<_GOLDEN>* golden) {
+	char line[256], name[32], dims[32], preset[32], flags[32];
+	_GOLDEN g;
+	FILE* f = fopen(path, "r");
+
+	if (f == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if ((line[0] == '#') || (line[0] == '\n'))
+			continue;
+		if (sscanf(line, "%31s %31s %31s %31s %x %lf", name, dims, preset, flags, &g.hash, &g.rms) != 6) {
+			fclose(f);
+			return 0;
+		}
+		snprintf(g.key, sizeof g.key, "%s %s %s %s", name, dims, preset, flags);
+		golden->push_back(g);
+	}
+	fclose(f);
+	return 1;
+}
+
+static const _GOLDEN* findGolden(const std::vector<_GOLDEN>& golden, const char* key) {
+	for (const _GOLDEN& g : golden)
+		if (strcmp(g.key, key) == 0)
+			return &g;
+	return NULL;
+}
+
+// Decodes an encoded animation (from memory when data is set) and compares every
+// frame with the source frame it stands for; a frame folded by
+// APNG_COLLAPSE_DUPLICATES stands for as many 1/10 s source frames as its delay
+// covers. Returns the RMS difference over pixels that are visible in either, or
+// -1 if it does not decode to the source's size and frame count.
+static double roundTrip(char* path, unsigned char* data, int length, const _SCENARIO* scenario, const _SIZE* size) {
+	_APNG_INFO info;
+	double sum = 0;
+	long long count = 0;
+	int i, k, a = 0;
+
+	if (!ReadAPNGInfo(path, data, length, &info) || (info.width != size->w) || (info.height != size->h))
+		return -1;
+
+	std::vector<unsigned char> pixels(info.size);
+	std::vector<_APNG_FRAME> frames(info.frames);
+	std::vector<unsigned char> source(size->w * size->h * 4);
+	if (!ReadAPNG(path, data, length, APNG_DECODE_COMPOSITE, pixels.data(), frames.data()))
+		return -1;
+
+	for (k = 0; k < info.frames; k++) {
+		const unsigned char* p = pixels.data() + frames[k].offset;
+		int span = (frames[k].num * 10 + frames[k].den / 2) / frames[k].den;
+
+		for (; span > 0; span--, a++) {
+			if (a == size->frames)
+				return -1;
+			scenario->draw(source.data(), size->w, size->h, a);
+			for (i = 0; i < size->w * size->h * 4; i += 4) {
+				if ((p[i + 3] == 0) && (source[i + 3] == 0))
+					continue;
+				for (int c = 0; c < 4; c++) {
+					int d = p[i + c] - source[i + c];
+					sum += d * d;
+				}
+				count += 4;
+			}
+		}
+	}
+	if (a != size->frames)
+		return -1;
+	return count ? sqrt(sum / count) : 0;
+}
+
+// Checks one encode against the golden file and its own decode; returns 1 if it fails
+static int checkGolden(const std::vector<_GOLDEN>& golden, const char* key, int flags, unsigned int hash, double rms, double tolerance) {
+	const _GOLDEN* g = findGolden(golden, key);
+
+	if (rms < 0) {
+		fprintf(stderr, "%s: does not decode to the source frames\n", key);
+		return 1;
+	}
+	if (!(flags & APNG_QUANTIZE) && (rms != 0)) {
+		fprintf(stderr, "%s: lossless output decodes with rms %.4f\n", key, rms);
+		return 1;
+	}
+	if (g == NULL) {
+		fprintf(stderr, "%s: not in the golden file\n", key);
+		return 0;
+	}
+	if (hash == g->hash)
+		return 0;
+
+	fprintf(stderr, "%s: output differs, %08x against %08x, rms %.4f against %.4f", key, hash, g->hash, rms, g->rms);
+	if ((tolerance >= 0) && (rms <= g->rms + tolerance + 1e-4)) {
+		fprintf(stderr, ", within the tolerance\n");
+		return 0;
+	}
+	fprintf(stderr, "\n");
+	return 1;
+}
+
+static void usage() {
+	printf("usage: apngbench [-cqodzkumt] [-g file] [-w file] [-e rms] [runs]\n"
+	       "  -c  comma separated output\n"
+	       "  -q  quick: smallest size only, one run\n"
+	       "  -o  APNG_OPTIMIZE_OPS\n"
+	       "  -d  APNG_COLLAPSE_DUPLICATES\n"
+	       "  -z  APNG_PARALLEL_DEFLATE\n"
+	       "  -k  APNG_KEEP_COLOR_TYPE\n"
+	       "  -u  APNG_QUANTIZE\n"
+	       "  -m  encode to memory instead of a file\n"
+	       "  -t  write a Chrome trace of the encodes to apngbench.json\n"
+	       "  -g  check every encode against a golden file, such as apngbench.golden,\n"
+	       "      and decode it again to compare with the source frames\n"
+	       "  -w  write the output of this build to a golden file\n"
+	       "  -e  with -g, pass different output that decodes exactly, or for\n"
+	       "      APNG_QUANTIZE within this much more rms error\n"
+	       "  -g and -w encode a fixed set of flag combinations instead of the flags given\n"
+	       "  runs  encodes per case, the fastest is reported (default 3)\n"
+	       "Times are in ms; other is the total minus the listed phases.\n");
+}
+
+int main(int argc, char** argv) {
+	int csv = 0, quick = 0, trace = 0, flags = 0, output = APNG_OUTPUT_FILE, runs = 3;
+	int i, j, a, s, z, f, preset, run, failed = 0;
+	char path[] = "apngbench.png";
+	const char* check = NULL;
+	const char* write = NULL;
+	double tolerance = -1;
+	std::vector<_GOLDEN> golden;
+	FILE* out = NULL;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') {
+			runs = atoi(argv[i]);
+			continue;
+		}
+		char* word = argv[i];
+		for (j = 1; word[j]; j++)
+			switch (word[j]) {
+			case 'c': csv = 1; break;
+			case 'q': quick = 1; break;
+			case 'o': flags |= APNG_OPTIMIZE_OPS; break;
+			case 'd': flags |= APNG_COLLAPSE_DUPLICATES; break;
+			case 'z': flags |= APNG_PARALLEL_DEFLATE; break;
+			case 'k': flags |= APNG_KEEP_COLOR_TYPE; break;
+			case 'u': flags |= APNG_QUANTIZE; break;
+			case 'm': output = APNG_OUTPUT_MEMORY; break;
+			case 't': trace = 1; break;
+			case 'g':
+			case 'w':
+			case 'e':
+				if (i + 1 == argc) {
+					usage();
+					return 1;
+				}
+				if (word[j] == 'g')
+					check = argv[++i];
+				else if (word[j] == 'w')
+					write = argv[++i];
+				else
+					tolerance = atof(argv[++i]);
+				break;
+			default:
+				usage();
+				return 1;
+			}
+	}
+	if (quick)
+		runs = 1;
+	if (runs < 1)
+		runs = 1;
+
+	if (trace && !_DLLEXPORT_TraceStart(1 << 20)) {
+		fprintf(stderr, "cannot start the trace\n");
+		return 1;
+	}
+
+	if ((check != NULL) && !readGolden(check, &golden)) {
+		fprintf(stderr, "cannot read %s\n", check);
+		return 1;
+	}
+	if ((write != NULL) && ((out = fopen(write, "w")) == NULL)) {
+		fprintf(stderr, "cannot write %s\n", write);
+		return 1;
+	}
+	if (out != NULL)
+		fprintf(out, "# apngbench golden output: scenario size preset flags hash rms\n"
+		             "# written with apngbench -w; check with apngbench -g\n");
+
+	// -g and -w cover a fixed set of flags, the other modes only those given
+	std::vector<int> flagSets;
+	if ((check != NULL) || (write != NULL))
+		flagSets.assign(GoldenFlags, GoldenFlags + sizeof(GoldenFlags) / sizeof(GoldenFlags[0]));
+	else
+		flagSets.push_back(flags);
+
+	if (csv)
+		printf("scenario,width,height,frames,preset,flags,output,total_ms,color_ms,diff_ms,filter_ms,deflate_ms,crc_ms,write_ms,other_ms,bytes,hash\n");
+	else
+		printf("%-8s %10s %-8s %5s %9s %8s %8s %8s %8s %8s %8s %8s %10s  %s\n",
+		       "scenario", "size", "preset", "flags", "total", "color", "diff", "filter", "deflate", "crc", "write", "other", "bytes", "hash");
+
+	for (s = 0; s < (int)(sizeof(Scenarios) / sizeof(Scenarios[0])); s++)
+		for (z = 0; z < (quick ? 1 : (int)(sizeof(Sizes) / sizeof(Sizes[0]))); z++) {
+			const _SIZE* size = &Sizes[z];
+			std::vector<unsigned char> frame(size->w * size->h * 4);
+
+			for (a = 0; a < size->frames; a++) {
+				Scenarios[s].draw(frame.data(), size->w, size->h, a);
+				CreateFrame(frame.data(), 1, 10, a, (int)frame.size());
+			}
+
+			for (f = 0; f < (int)flagSets.size(); f++)
+				for (preset = APNG_PRESET_FASTEST; preset <= APNG_PRESET_SMALLEST; preset++) {
+					_APNG_PROFILE best, profile;
+					_APNG_CONTEXT ctx;
+					double best_ms = 0, rms = 0;
+					long long bytes = 0;
+					unsigned int hash = 0;
+					int verify = (check != NULL) || (write != NULL);
+
+					for (run = 0; run < runs; run++) {
+						memset(&ctx, 0, sizeof(ctx));
+						ctx.preset = preset;
+						ctx.flags = flagSets[f];
+						ctx.output = output;
+						ctx.profile = &profile;
+						if (!SaveAPNGEx(path, size->frames, size->w, size->h, 4, 0, &ctx)) {
+							fprintf(stderr, "%s %dx%d %s: encode failed\n", Scenarios[s].name, size->w, size->h, PresetName[preset]);
+							return 1;
+						}
+						if ((run == 0) || (ctx.ms < best_ms)) {
+							best_ms = ctx.ms;
+							best = profile;
+						}
+						bytes = ctx.size;
+						if (output == APNG_OUTPUT_MEMORY) {
+							hash = hashBytes(ctx.data, (size_t)ctx.size);
+							if (verify && (run + 1 == runs))
+								rms = roundTrip(NULL, ctx.data, (int)ctx.size, &Scenarios[s], size);
+							FreeAPNGBuffer(&ctx);
+						}
+					}
+					if (output == APNG_OUTPUT_FILE) {
+						hash = hashFile(path);
+						if (verify)
+							rms = roundTrip(path, NULL, 0, &Scenarios[s], size);
+					}
+
+					double other = best_ms - best.color - best.diff - best.filter - best.deflate - best.crc - best.write;
+					if (csv)
+						printf("%s,%d,%d,%d,%s,%d,%s,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%lld,%08x\n",
+						       Scenarios[s].name, size->w, size->h, size->frames, PresetName[preset], flagSets[f],
+						       output == APNG_OUTPUT_MEMORY ? "memory" : "file", best_ms, best.color, best.diff,
+						       best.filter, best.deflate, best.crc, best.write, other, bytes, hash);
+					else {
+						char dims[32];
+						snprintf(dims, sizeof dims, "%dx%dx%d", size->w, size->h, size->frames);
+						printf("%-8s %10s %-8s  0x%02x %9.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %10lld  %08x\n",
+						       Scenarios[s].name, dims, PresetName[preset], flagSets[f], best_ms, best.color, best.diff,
+						       best.filter, best.deflate, best.crc, best.write, other, bytes, hash);
+					}
+					fflush(stdout);
+
+					if (verify) {
+						char key[64];
+						goldenKey(key, sizeof key, &Scenarios[s], size, preset, flagSets[f]);
+						if (out != NULL)
+							fprintf(out, "%s %08x %.4f\n", key, hash, rms);
+						if (check != NULL)
+							failed += checkGolden(golden, key, flagSets[f], hash, rms, tolerance);
+						else if (rms < 0) {
+							fprintf(stderr, "%s: does not decode to the source frames\n", key);
+							failed++;
+						}
+					}
+				}
+		}
+
+	if (output == APNG_OUTPUT_FILE)
+		remove(path);
+	if (trace) {
+		_DLLEXPORT_TraceStop();
+		if (!_DLLEXPORT_TraceWrite("apngbench.json")) {
+			fprintf(stderr, "cannot write apngbench.json\n");
+			return 1;
+		}
+	}
+	if (out != NULL)
+		fclose(out);
+	if ((check != NULL) || (write != NULL)) {
+		if (failed)
+			fprintf(stderr, "FAILED: %d encodes\n", failed);
+		else
+			fprintf(stderr, "passed\n");
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,349 @@
+//APNG decoder and compositor for libapng
+//----------------------------------------------------------
+//This program is free software; you can redistribute it and/or
+//modify it under the terms of the GNU General Public License
+//as published by the Free Software Foundation; either version 2
+//of the License, or (at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "libapng/png.h"
+#include "trace.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#ifndef APNG_USE_SSE2
+#define APNG_USE_SSE2 1
+#endif
+#endif
+
+#if APNG_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+extern "C" {
+// Modes for ReadAPNG
+#define APNG_DECODE_COMPOSITE 0 // every frame as a full BGRA canvas
+#define APNG_DECODE_REGIONS 1 // only each frame's own sub-rectangle, packed back to back
+
+using _APNG_INFO = struct {
+	int width;
+	int height;
+	int frames; // frames in the animation, not counting a hidden default image
+	int plays;
+	int size; // bytes ReadAPNG needs for pixels; images needing more than INT_MAX fail to decode
+};
+
+using _APNG_FRAME = struct {
+	int x, y, w, h;
+	int num;
+	int den;
+	unsigned char dispose_op;
+	unsigned char blend_op;
+	int offset; // of the frame's pixels within the ReadAPNG buffer
+};
+
+using _SOURCE = struct {
+	FILE* f;
+	const unsigned char* p;
+	size_t len;
+	size_t pos;
+};
+
+using _DECODER = struct {
+	png_structp png_ptr;
+	png_infop info_ptr;
+	unsigned char* pCanvas;
+	unsigned char* pSaved;
+	unsigned char* pSub;
+	png_bytepp row_pointers;
+	int reading; // inside the "read frame" trace span, which a png_error() longjmp leaves open
+};
+
+static void sourceRead(png_structp png_ptr, png_bytep data, png_size_t length) {
+	auto source = (_SOURCE*)png_get_io_ptr(png_ptr);
+
+	if (source->f != NULL) {
+		if (fread(data, 1, length, source->f) != length)
+			png_error(png_ptr, "Read Error");
+		return;
+	}
+
+	if (length > source->len - source->pos)
+		png_error(png_ptr, "Read Error");
+	memcpy(data, source->p + source->pos, length);
+	source->pos += length;
+}
+
+// APNG OVER on straight alpha BGRA pixels, as given in the APNG specification
+static inline void blendPixel(unsigned char* dst, const unsigned char* src) {
+	int k, u, v, al;
+
+	if (src[3] == 255) {
+		memcpy(dst, src, 4);
+		return;
+	}
+	if (src[3] == 0)
+		return;
+
+	u = src[3] * 255;
+	v = (255 - src[3]) * dst[3];
+	al = u + v;
+	for (k = 0; k < 3; k++)
+		dst[k] = (unsigned char)((src[k] * u + dst[k] * v) / al);
+	dst[3] = (unsigned char)(al / 255);
+}
+
+#if APNG_USE_SSE2
+// Every product and sum above stays below 2^24, so single precision holds them
+// exactly and the truncated quotient equals the integer division.
+static inline void blendPixelSSE2(unsigned char* dst, const unsigned char* src) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 c255 = _mm_set1_ps(255.0f);
+	int s, d;
+
+	memcpy(&s, src, 4);
+	memcpy(&d, dst, 4);
+
+	__m128 fs = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(s), zero), zero));
+	__m128 fd = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(d), zero), zero));
+	__m128 sa = _mm_shuffle_ps(fs, fs, _MM_SHUFFLE(3, 3, 3, 3));
+	__m128 da = _mm_shuffle_ps(fd, fd, _MM_SHUFFLE(3, 3, 3, 3));
+
+	__m128 u = _mm_mul_ps(sa, c255);
+	__m128 v = _mm_mul_ps(_mm_sub_ps(c255, sa), da);
+	__m128 al = _mm_add_ps(u, v);
+	__m128 c = _mm_div_ps(_mm_add_ps(_mm_mul_ps(fs, u), _mm_mul_ps(fd, v)), al);
+	__m128 a = _mm_div_ps(al, c255);
+
+	// lane 3 takes the alpha instead of the colour formula
+	c = _mm_shuffle_ps(c, _mm_unpackhi_ps(c, a), _MM_SHUFFLE(3, 0, 1, 0));
+
+	__m128i r = _mm_cvttps_epi32(c);
+	r = _mm_packs_epi32(r, r);
+	r = _mm_packus_epi16(r, r);
+	d = _mm_cvtsi128_si32(r);
+	memcpy(dst, &d, 4);
+}
+#endif
+
+static void blendOver(unsigned char* dst, const unsigned char* src, int count) {
+	int i = 0;
+
+#if APNG_USE_SSE2
+	const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), alpha));
+
+		if (mask == 0xffff) {
+			_mm_storeu_si128((__m128i*)(dst + i * 4), s);
+			continue;
+		}
+
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), _mm_setzero_si128()));
+		if (mask == 0xffff)
+			continue;
+
+		for (int k = i; k < i + 4; k++) {
+			if (src[k * 4 + 3] == 255)
+				memcpy(dst + k * 4, src + k * 4, 4);
+			else if (src[k * 4 + 3] != 0)
+				blendPixelSSE2(dst + k * 4, src + k * 4);
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+		blendPixel(dst + i * 4, src + i * 4);
+}
+
+static int decode(_SOURCE* source, _DECODER* d, _APNG_INFO* info, int mode, unsigned char* pixels, _APNG_FRAME* frames) {
+	png_uint_32 a, j, n, xres, yres, w, h, x, y;
+	png_uint_16 num, den;
+	png_byte dispose_op, blend_op;
+	int animated, first, out, offset;
+	long long canvas;
+	png_structp png_ptr = d->png_ptr;
+	png_infop info_ptr = d->info_ptr;
+
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		if (d->reading)
+			squish::TraceEnd("read frame");
+		return 0;
+	}
+
+	png_set_read_fn(png_ptr, source, sourceRead);
+	png_read_info(png_ptr, info_ptr);
+
+	xres = png_get_image_width(png_ptr, info_ptr);
+	yres = png_get_image_height(png_ptr, info_ptr);
+	animated = png_get_valid(png_ptr, info_ptr, PNG_INFO_acTL) != 0;
+	n = animated ? png_get_num_frames(png_ptr, info_ptr) : 1;
+	first = animated && png_get_first_frame_is_hidden(png_ptr, info_ptr);
+
+	info->width = xres;
+	info->height = yres;
+	info->frames = n - first;
+	info->plays = animated ? png_get_num_plays(png_ptr, info_ptr) : 0;
+
+	// pixels, frame offsets and the managed copy are all indexed with int
+	canvas = (long long)xres * yres * 4;
+	if ((canvas > INT_MAX) || (canvas * info->frames > INT_MAX))
+		return 0;
+	info->size = (int)(canvas * info->frames);
+	if (pixels == NULL)
+		return 1;
+
+	// everything comes out as 8-bit BGRA
+	png_set_expand(png_ptr);
+	png_set_strip_16(png_ptr);
+	png_set_gray_to_rgb(png_ptr);
+	png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+	png_set_bgr(png_ptr);
+	png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+
+	d->pCanvas = (unsigned char*)calloc(xres * yres, 4);
+	d->pSaved = (unsigned char*)malloc(xres * yres * 4);
+	d->pSub = (unsigned char*)malloc(xres * yres * 4);
+	d->row_pointers = (png_bytepp)malloc(sizeof(png_bytep) * yres);
+	if ((d->pCanvas == NULL) || (d->pSaved == NULL) || (d->pSub == NULL) || (d->row_pointers == NULL))
+		return 0;
+
+	out = 0;
+	offset = 0;
+	for (a = 0; a < n; a++) {
+		if (animated)
+			png_read_frame_head(png_ptr, info_ptr);
+
+		if (png_get_valid(png_ptr, info_ptr, PNG_INFO_fcTL))
+			png_get_next_frame_fcTL(png_ptr, info_ptr, &w, &h, &x, &y, &num, &den, &dispose_op, &blend_op);
+		else {
+			w = xres;
+			h = yres;
+			x = 0;
+			y = 0;
+			num = 0;
+			den = 0;
+			dispose_op = PNG_DISPOSE_OP_NONE;
+			blend_op = PNG_BLEND_OP_SOURCE;
+		}
+
+		if ((x + w > xres) || (y + h > yres))
+			png_error(png_ptr, "frame outside the image");
+
+		for (j = 0; j < h; j++)
+			d->row_pointers[j] = d->pSub + j * w * 4;
+		squish::TraceBegin("read frame");
+		d->reading = 1;
+		png_read_image(png_ptr, d->row_pointers);
+		d->reading = 0;
+		squish::TraceEnd("read frame");
+
+		if ((a == 0) && first)
+			continue;
+
+		frames[out].x = x;
+		frames[out].y = y;
+		frames[out].w = w;
+		frames[out].h = h;
+		frames[out].num = num;
+		frames[out].den = (den == 0) ? 100 : den;
+		frames[out].dispose_op = dispose_op;
+		frames[out].blend_op = blend_op;
+
+		if (mode == APNG_DECODE_REGIONS) {
+			memcpy(pixels + offset, d->pSub, w * h * 4);
+			frames[out].offset = offset;
+			offset += w * h * 4;
+			out++;
+			continue;
+		}
+
+		// the first frame has nothing to go back to
+		if ((out == 0) && (dispose_op == PNG_DISPOSE_OP_PREVIOUS))
+			dispose_op = PNG_DISPOSE_OP_BACKGROUND;
+
+		if (dispose_op == PNG_DISPOSE_OP_PREVIOUS)
+			memcpy(d->pSaved, d->pCanvas, xres * yres * 4);
+
+		for (j = 0; j < h; j++) {
+			unsigned char* dst = d->pCanvas + ((j + y) * xres + x) * 4;
+			if (blend_op == PNG_BLEND_OP_SOURCE)
+				memcpy(dst, d->row_pointers[j], w * 4);
+			else
+				blendOver(dst, d->row_pointers[j], w);
+		}
+
+		frames[out].offset = out * xres * yres * 4;
+		memcpy(pixels + frames[out].offset, d->pCanvas, xres * yres * 4);
+
+		if (dispose_op == PNG_DISPOSE_OP_BACKGROUND) {
+			for (j = 0; j < h; j++)
+				memset(d->pCanvas + ((j + y) * xres + x) * 4, 0, w * 4);
+		}
+		else if (dispose_op == PNG_DISPOSE_OP_PREVIOUS)
+			memcpy(d->pCanvas, d->pSaved, xres * yres * 4);
+		out++;
+	}
+	return 1;
+}
+
+static int ReadSource(char* szImage, unsigned char* data, int length, _APNG_INFO* info, int mode, unsigned char* pixels, _APNG_FRAME* frames) {
+	squish::TraceScope trace("ReadAPNG");
+	_SOURCE source;
+	_DECODER d;
+	int ok = 0;
+
+	memset(&source, 0, sizeof(source));
+	memset(&d, 0, sizeof(d));
+	if (data != NULL) {
+		if (length < 0)
+			return 0;
+		source.p = data;
+		source.len = length;
+	}
+	else if ((szImage == NULL) || ((source.f = fopen(szImage, "rb")) == NULL))
+		return 0;
+
+	d.png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (d.png_ptr != NULL) {
+		d.info_ptr = png_create_info_struct(d.png_ptr);
+
+		if (d.info_ptr != NULL)
+			ok = decode(&source, &d, info, mode, pixels, frames);
+		png_destroy_read_struct(&d.png_ptr, &d.info_ptr, NULL);
+	}
+
+	free(d.pCanvas);
+	free(d.pSaved);
+	free(d.pSub);
+	free(d.row_pointers);
+	if (source.f != NULL)
+		fclose(source.f);
+	return ok;
+}
+
+// Reads the image size and frame count from a file, or from memory when data is set
+__declspec(dllexport) int ReadAPNGInfo(char* szImage, unsigned char* data, int length, _APNG_INFO* info) {
+	return ReadSource(szImage, data, length, info, APNG_DECODE_COMPOSITE, NULL, NULL);
+}
+
+// Decodes every frame into pixels (ReadAPNGInfo's size bytes) and frames (one
+// entry per animation frame) as 8-bit BGRA
+__declspec(dllexport) int ReadAPNG(char* szImage, unsigned char* data, int length, int mode, unsigned char* pixels, _APNG_FRAME* frames) {
+	_APNG_INFO info;
+
+	if (pixels == NULL || frames == NULL)
+		return 0;
+	return ReadSource(szImage, data, length, &info, mode, pixels, frames);
+}
+}
@@ -0,0 +1,534 @@
+//Texture atlas builder for libapng
+//----------------------------------------------------------
+//This program is free software; you can redistribute it and/or
+//modify it under the terms of the GNU General Public License
+//as published by the Free Software Foundation; either version 2
+//of the License, or (at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "libapng/png.h"
+#include "squish.h"
+#include "trace.h"
+#include "atlas.h"
+
+extern "C" {
+using _AREA = struct {
+	int x, y, w, h;
+};
+
+using _SKYLINE = struct {
+	int x, y, w;
+};
+
+// One page being filled. MaxRects keeps every maximal free rectangle (they may
+// overlap); skyline keeps the top edge of the packed area from left to right.
+using _PACKER = struct {
+	int width, height;
+	std::vector<_AREA> free;
+	std::vector<_SKYLINE> skyline;
+};
+
+// A sprite after trimming: x, y, w, h is the part of it that gets packed
+using _ITEM = struct {
+	int x, y, w, h;
+	unsigned long long hash;
+	int share; // index of the sprite whose pixels are used, itself if unique
+	int page;
+	int px, py;
+};
+
+using _BUFFER = struct {
+	unsigned char* p;
+	size_t len;
+	size_t cap;
+};
+
+static void trimSprite(const _ATLAS_SPRITE* s, _ITEM* it, int trim) {
+	int i, j, x_min, x_max, y_min, y_max;
+
+	it->x = 0;
+	it->y = 0;
+	it->w = s->w;
+	it->h = s->h;
+	if (!trim)
+		return;
+
+	x_min = s->w;
+	x_max = -1;
+	y_min = s->h;
+	y_max = -1;
+	for (j = 0; j < s->h; j++) {
+		const unsigned char* row = s->p + j * s->w * 4;
+
+		for (i = 0; (i < s->w) && (row[i * 4 + 3] == 0); i++)
+			;
+		if (i == s->w)
+			continue;
+		if (i < x_min) x_min = i;
+		for (i = s->w - 1; row[i * 4 + 3] == 0; i--)
+			;
+		if (i > x_max) x_max = i;
+		if (j < y_min) y_min = j;
+		y_max = j;
+	}
+
+	if (x_max < 0) {
+		it->w = 0;
+		it->h = 0;
+		return;
+	}
+	it->x = x_min;
+	it->y = y_min;
+	it->w = x_max - x_min + 1;
+	it->h = y_max - y_min + 1;
+}
+
+static unsigned long long hashItem(const _ATLAS_SPRITE* s, const _ITEM* it) {
+	unsigned long long h = 0xcbf29ce484222325ULL ^ ((unsigned long long)it->w << 32) ^ it->h;
+	int i, j;
+
+	for (j = 0; j < it->h; j++) {
+		const unsigned char* row = s->p + ((it->y + j) * s->w + it->x) * 4;
+		for (i = 0; i < it->w * 4; i++)
+			h = (h ^ row[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static int samePixels(const _ATLAS_SPRITE* sa, const _ITEM* a, const _ATLAS_SPRITE* sb, const _ITEM* b) {
+	int j;
+
+	if ((a->w != b->w) || (a->h != b->h))
+		return 0;
+	for (j = 0; j < a->h; j++)
+		if (memcmp(sa->p + ((a->y + j) * sa->w + a->x) * 4, sb->p + ((b->y + j) * sb->w + b->x) * 4, a->w * 4) != 0)
+			return 0;
+	return 1;
+}
+
+static void initPacker(_PACKER* pk, int width, int height) {
+	pk->width = width;
+	pk->height = height;
+	pk->free.assign(1, _AREA{0, 0, width, height});
+	pk->skyline.assign(1, _SKYLINE{0, 0, width});
+}
+
+// Best short side fit: the free rectangle that leaves the least over on its
+// tighter side
+static int maxRectsFind(const _PACKER* pk, int w, int h, int* x, int* y) {
+	int best_short = 0x7fffffff, best_long = 0x7fffffff;
+
+	for (const _AREA& f : pk->free) {
+		if ((w > f.w) || (h > f.h))
+			continue;
+
+		int dw = f.w - w, dh = f.h - h;
+		int s = dw < dh ? dw : dh, l = dw < dh ? dh : dw;
+		if ((s < best_short) || ((s == best_short) && (l < best_long))) {
+			best_short = s;
+			best_long = l;
+			*x = f.x;
+			*y = f.y;
+		}
+	}
+	return best_short != 0x7fffffff;
+}
+
+static int contains(const _AREA& a, const _AREA& b) {
+	return (b.x >= a.x) && (b.y >= a.y) && (b.x + b.w <= a.x + a.w) && (b.y + b.h <= a.y + a.h);
+}
+
+static void maxRectsPlace(_PACKER* pk, int x, int y, int w, int h) {
+	std::vector<_AREA> kept, split;
+	size_t i, j;
+
+	// every free rectangle the sprite overlaps leaves up to four around it
+	for (const _AREA& f : pk->free) {
+		if ((x >= f.x + f.w) || (x + w <= f.x) || (y >= f.y + f.h) || (y + h <= f.y)) {
+			kept.push_back(f);
+			continue;
+		}
+		if (x > f.x)
+			split.push_back(_AREA{f.x, f.y, x - f.x, f.h});
+		if (x + w < f.x + f.w)
+			split.push_back(_AREA{x + w, f.y, f.x + f.w - x - w, f.h});
+		if (y > f.y)
+			split.push_back(_AREA{f.x, f.y, f.w, y - f.y});
+		if (y + h < f.y + f.h)
+			split.push_back(_AREA{f.x, y + h, f.w, f.y + f.h - y - h});
+	}
+
+	// untouched rectangles never contain each other, so only the new pieces
+	// need checking against everything
+	pk->free.clear();
+	for (i = 0; i < split.size(); i++) {
+		int inside = 0;
+
+		for (j = 0; (j < split.size()) && !inside; j++)
+			if ((i != j) && contains(split[j], split[i]) && (!contains(split[i], split[j]) || (j < i)))
+				inside = 1;
+		for (j = 0; (j < kept.size()) && !inside; j++)
+			if (contains(kept[j], split[i]))
+				inside = 1;
+		if (!inside)
+			pk->free.push_back(split[i]);
+	}
+	for (i = 0; i < kept.size(); i++) {
+		int inside = 0;
+
+		for (j = 0; (j < pk->free.size()) && !inside; j++)
+			if (contains(pk->free[j], kept[i]))
+				inside = 1;
+		if (!inside)
+			pk->free.push_back(kept[i]);
+	}
+}
+
+// Bottom left: the lowest spot, then the narrowest skyline segment
+static int skylineFind(const _PACKER* pk, int w, int h, int* x, int* y, int* index) {
+	int best_top = 0x7fffffff, best_w = 0x7fffffff;
+	size_t i, k;
+
+	for (i = 0; i < pk->skyline.size(); i++) {
+		int left = w, top = 0;
+
+		if (pk->skyline[i].x + w > pk->width)
+			break;
+		for (k = i; left > 0; k++) {
+			if (pk->skyline[k].y > top)
+				top = pk->skyline[k].y;
+			left -= pk->skyline[k].w;
+		}
+		if (top + h > pk->height)
+			continue;
+
+		if ((top + h < best_top) || ((top + h == best_top) && (pk->skyline[i].w < best_w))) {
+			best_top = top + h;
+			best_w = pk->skyline[i].w;
+			*x = pk->skyline[i].x;
+			*y = top;
+			*index = (int)i;
+		}
+	}
+	return best_top != 0x7fffffff;
+}
+
+static void skylinePlace(_PACKER* pk, int index, int x, int y, int w, int h) {
+	std::vector<_SKYLINE>& sky = pk->skyline;
+	size_t i;
+
+	sky.insert(sky.begin() + index, _SKYLINE{x, y + h, w});
+
+	// segments now under the sprite shrink or go away
+	for (i = index + 1; i < sky.size();) {
+		int end = sky[i - 1].x + sky[i - 1].w;
+		if (sky[i].x >= end)
+			break;
+		if (sky[i].x + sky[i].w <= end) {
+			sky.erase(sky.begin() + i);
+			continue;
+		}
+		sky[i].w -= end - sky[i].x;
+		sky[i].x = end;
+		break;
+	}
+
+	for (i = 0; i + 1 < sky.size();) {
+		if (sky[i].y == sky[i + 1].y) {
+			sky[i].w += sky[i + 1].w;
+			sky.erase(sky.begin() + i + 1);
+		}
+		else
+			i++;
+	}
+}
+
+static int pack(_PACKER* pk, int method, int w, int h, int* x, int* y) {
+	int index;
+
+	if (method == ATLAS_PACK_SKYLINE) {
+		if (!skylineFind(pk, w, h, x, y, &index))
+			return 0;
+		skylinePlace(pk, index, *x, *y, w, h);
+		return 1;
+	}
+
+	if (!maxRectsFind(pk, w, h, x, y))
+		return 0;
+	maxRectsPlace(pk, *x, *y, w, h);
+	return 1;
+}
+
+static void bufferWrite(png_structp png_ptr, png_bytep data, png_size_t length) {
+	auto buf = (_BUFFER*)png_get_io_ptr(png_ptr);
+
+	if (buf->len + length > buf->cap) {
+		size_t cap = buf->cap ? buf->cap : 65536;
+		while (cap < buf->len + length)
+			cap *= 2;
+
+		auto p = (unsigned char*)realloc(buf->p, cap);
+		if (p == NULL)
+			png_error(png_ptr, "Out of memory");
+		buf->p = p;
+		buf->cap = cap;
+	}
+	memcpy(buf->p + buf->len, data, length);
+	buf->len += length;
+}
+
+static void bufferFlush(png_structp png_ptr) {
+}
+
+static unsigned char* encodePNG(unsigned char* bgra, int w, int h, int* size) {
+	_BUFFER buf;
+	png_structp png_ptr;
+	png_infop info_ptr;
+	int j;
+
+	auto rows = (png_bytepp)malloc(h * sizeof(png_bytep));
+	if (rows == NULL)
+		return NULL;
+	for (j = 0; j < h; j++)
+		rows[j] = bgra + j * w * 4;
+
+	memset(&buf, 0, sizeof(buf));
+	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	info_ptr = png_ptr ? png_create_info_struct(png_ptr) : NULL;
+	if ((info_ptr == NULL) || setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		free(buf.p);
+		free(rows);
+		return NULL;
+	}
+
+	png_set_write_fn(png_ptr, &buf, bufferWrite, bufferFlush);
+	png_set_IHDR(png_ptr, info_ptr, w, h, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	png_write_info(png_ptr, info_ptr);
+	png_set_bgr(png_ptr);
+	png_write_image(png_ptr, rows);
+	png_write_end(png_ptr, info_ptr);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	free(rows);
+
+	*size = (int)buf.len;
+	return buf.p;
+}
+
+// Draws the page's sprites and encodes it in place of page->data
+static int renderPage(_ATLAS_PAGE* page, int index, const _ATLAS_SPRITE* sprites, const _ITEM* items, int count) {
+	squish::TraceScope trace("render page");
+	int a, i, j;
+	size_t len = (size_t)page->width * page->height * 4;
+
+	auto bgra = (unsigned char*)calloc(len, 1);
+	if (bgra == NULL)
+		return 0;
+
+	for (a = 0; a < count; a++) {
+		const _ITEM* it = &items[a];
+		if ((it->share != a) || (it->page != index))
+			continue;
+		for (j = 0; j < it->h; j++)
+			memcpy(bgra + ((it->py + j) * page->width + it->px) * 4,
+			       sprites[a].p + ((it->y + j) * sprites[a].w + it->x) * 4, it->w * 4);
+	}
+
+	switch (page->format) {
+		case ATLAS_FORMAT_PNG:
+			page->data = encodePNG(bgra, page->width, page->height, &page->size);
+			free(bgra);
+			break;
+
+		case ATLAS_FORMAT_DXT5:
+			for (i = 0; i < page->width * page->height; i++)
+				std::swap(bgra[i * 4], bgra[i * 4 + 2]);
+			page->size = squish::GetStorageRequirements(page->width, page->height, squish::kDxt5);
+			page->data = (unsigned char*)malloc(page->size);
+			if (page->data != NULL)
+				squish::CompressImage(bgra, page->width, page->height, page->data, squish::kDxt5);
+			free(bgra);
+			break;
+
+		default:
+			page->data = bgra;
+			page->size = (int)len;
+			break;
+	}
+	return page->data != NULL;
+}
+
+__declspec(dllexport) void FreeAtlas(_ATLAS* atlas) {
+	int i;
+
+	if (atlas == NULL)
+		return;
+	for (i = 0; i < atlas->pages; i++)
+		free(atlas->page[i].data);
+	free(atlas->page);
+	free(atlas->rect);
+	free(atlas);
+}
+
+__declspec(dllexport) _ATLAS* BuildAtlas(const _ATLAS_SPRITE* sprites, int count, int max_width, int max_height, int padding, int method, int flags, int format) {
+	squish::TraceScope trace("BuildAtlas");
+	std::vector<_PACKER> packers;
+	std::vector<int> order;
+	int a, b, i, x, y, w, h, pages;
+
+	if ((count < 0) || (max_width <= 0) || (max_height <= 0) || (max_width > 65535) || (max_height > 65535) || (padding < 0) ||
+		(format < ATLAS_FORMAT_BGRA) || (format > ATLAS_FORMAT_DXT5))
+		return NULL;
+	for (a = 0; a < count; a++)
+		if ((sprites[a].w < 0) || (sprites[a].h < 0) || (sprites[a].w > 65535) || (sprites[a].h > 65535))
+			return NULL;
+
+	// DXT5 pages are whole 4x4 blocks
+	if (format == ATLAS_FORMAT_DXT5) {
+		max_width = max_width < 4 ? 4 : max_width & ~3;
+		max_height = max_height < 4 ? 4 : max_height & ~3;
+	}
+
+	auto atlas = (_ATLAS*)calloc(1, sizeof(_ATLAS));
+	auto items = (_ITEM*)calloc(count ? count : 1, sizeof(_ITEM));
+	if ((atlas == NULL) || (items == NULL)) {
+		free(atlas);
+		free(items);
+		return NULL;
+	}
+	atlas->count = count;
+	atlas->rect = (_ATLAS_RECT*)calloc(count ? count : 1, sizeof(_ATLAS_RECT));
+	if (atlas->rect == NULL) {
+		free(items);
+		FreeAtlas(atlas);
+		return NULL;
+	}
+
+	for (a = 0; a < count; a++) {
+		trimSprite(&sprites[a], &items[a], flags & ATLAS_TRIM);
+		items[a].share = a;
+		items[a].page = -1;
+		if ((flags & ATLAS_SHARE_DUPLICATES) && items[a].w)
+			items[a].hash = hashItem(&sprites[a], &items[a]);
+	}
+
+	// sprites with equal hashes end up next to each other; each one is checked
+	// against the unique sprites before it in its run
+	if (flags & ATLAS_SHARE_DUPLICATES) {
+		for (a = 0; a < count; a++)
+			if (items[a].w)
+				order.push_back(a);
+		std::sort(order.begin(), order.end(), [items](int l, int r) {
+			return items[l].hash != items[r].hash ? items[l].hash < items[r].hash : l < r;
+		});
+
+		for (i = 0; i < (int)order.size(); i++) {
+			a = order[i];
+			for (int k = i - 1; (k >= 0) && (items[order[k]].hash == items[a].hash); k--) {
+				b = order[k];
+				if ((items[b].share == b) && samePixels(&sprites[a], &items[a], &sprites[b], &items[b])) {
+					items[a].share = b;
+					atlas->shared++;
+					break;
+				}
+			}
+		}
+		order.clear();
+	}
+
+	// biggest first
+	for (a = 0; a < count; a++)
+		if (items[a].w && (items[a].share == a))
+			order.push_back(a);
+	std::sort(order.begin(), order.end(), [items](int l, int r) {
+		int ml = std::max(items[l].w, items[l].h), mr = std::max(items[r].w, items[r].h);
+		int nl = std::min(items[l].w, items[l].h), nr = std::min(items[r].w, items[r].h);
+		return ml != mr ? ml > mr : nl != nr ? nl > nr : l < r;
+	});
+
+	// padding goes right of and below each sprite, so the packers get that much
+	// extra room past the page edge. On DXT5 pages the padded size is rounded up
+	// to whole blocks; every position then stays a multiple of 4 too, so no 4x4
+	// block holds pixels of two sprites.
+	for (int s : order) {
+		_ITEM* it = &items[s];
+		w = it->w + padding;
+		h = it->h + padding;
+		if (format == ATLAS_FORMAT_DXT5) {
+			w = (w + 3) & ~3;
+			h = (h + 3) & ~3;
+		}
+
+		for (i = 0; i < (int)packers.size(); i++)
+			if (pack(&packers[i], method, w, h, &x, &y))
+				break;
+
+		if (i == (int)packers.size()) {
+			_PACKER pk;
+			initPacker(&pk, std::max(max_width + padding, w), std::max(max_height + padding, h));
+			pack(&pk, method, w, h, &x, &y);
+			packers.push_back(pk);
+		}
+		it->page = i;
+		it->px = x;
+		it->py = y;
+	}
+
+	pages = (int)packers.size();
+	atlas->page = (_ATLAS_PAGE*)calloc(pages ? pages : 1, sizeof(_ATLAS_PAGE));
+	if ((atlas->page == NULL) || (pages > 65535)) {
+		free(items);
+		FreeAtlas(atlas);
+		return NULL;
+	}
+	atlas->pages = pages;
+
+	for (a = 0; a < count; a++) {
+		const _ITEM* it = &items[a];
+		const _ITEM* src = &items[it->share];
+		_ATLAS_RECT* r = &atlas->rect[a];
+
+		r->trim_x = (unsigned short)it->x;
+		r->trim_y = (unsigned short)it->y;
+		r->shared = it->share != a;
+		if (it->w == 0)
+			continue;
+
+		r->page = (unsigned short)src->page;
+		r->x = (unsigned short)src->px;
+		r->y = (unsigned short)src->py;
+		r->w = (unsigned short)it->w;
+		r->h = (unsigned short)it->h;
+
+		_ATLAS_PAGE* page = &atlas->page[src->page];
+		if (src->px + it->w > page->width) page->width = src->px + it->w;
+		if (src->py + it->h > page->height) page->height = src->py + it->h;
+	}
+
+	for (i = 0; i < pages; i++) {
+		_ATLAS_PAGE* page = &atlas->page[i];
+
+		page->format = format;
+		if (format == ATLAS_FORMAT_DXT5) {
+			page->width = (page->width + 3) & ~3;
+			page->height = (page->height + 3) & ~3;
+		}
+		if (!renderPage(page, i, sprites, items, count)) {
+			free(items);
+			FreeAtlas(atlas);
+			return NULL;
+		}
+	}
+
+	free(items);
+	return atlas;
+}
+}
@@ -0,0 +1,56 @@
+// Texture atlas builder: packs BGRA sprites into one or more pages
+#pragma once
+
+extern "C" {
+// Packing methods
+#define ATLAS_PACK_MAXRECTS 0
+#define ATLAS_PACK_SKYLINE 1
+
+// Flags
+#define ATLAS_TRIM 0x1 // pack only the part of each sprite that is not fully transparent
+#define ATLAS_SHARE_DUPLICATES 0x2 // identical sprites get the same rect
+
+// Page formats
+#define ATLAS_FORMAT_BGRA 0
+#define ATLAS_FORMAT_PNG 1
+#define ATLAS_FORMAT_DXT5 2 // each sprite starts on a 4x4 block and its padded size is whole blocks
+
+using _ATLAS_SPRITE = struct {
+	const unsigned char* p; // BGRA, w * 4 bytes per row
+	int w;
+	int h;
+};
+
+// Where a sprite ended up. trim_x, trim_y is where the packed pixels start in the
+// original sprite; a fully transparent trimmed sprite has w = h = 0.
+using _ATLAS_RECT = struct {
+	unsigned short page;
+	unsigned short x, y;
+	unsigned short w, h;
+	unsigned short trim_x, trim_y;
+	unsigned short shared; // 1 if the pixels belong to an earlier identical sprite
+};
+
+using _ATLAS_PAGE = struct {
+	int width;
+	int height;
+	int format;
+	int size;
+	unsigned char* data;
+};
+
+using _ATLAS = struct {
+	int pages;
+	_ATLAS_PAGE* page;
+	int count;
+	_ATLAS_RECT* rect; // one per input sprite, in input order
+	int shared;
+};
+
+// Packs count sprites into pages of at most max_width x max_height, with padding
+// transparent pixels between them. A sprite bigger than a page gets a page of its
+// own. Returns NULL on bad arguments or out of memory; release with FreeAtlas.
+__declspec(dllexport) _ATLAS* BuildAtlas(const _ATLAS_SPRITE* sprites, int count, int max_width, int max_height, int padding, int method, int flags, int format);
+
+__declspec(dllexport) void FreeAtlas(_ATLAS* atlas);
+}
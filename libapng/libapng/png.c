@@ -125,8 +125,11 @@ png_calculate_crc(png_structp png_ptr, png_const_bytep ptr, png_size_t length) {
 			need_crc = 0;
 	}
 
-	if (need_crc)
+	if (need_crc) {
+		png_write_phase(png_ptr, PNG_PHASE_CRC, 1);
 		png_ptr->crc = crc32(png_ptr->crc, ptr, (uInt)length);
+		png_write_phase(png_ptr, PNG_PHASE_CRC, 0);
+	}
 }
 
 /* Check a user supplied version number, called from both read and write
@@ -870,6 +870,24 @@ typedef PNG_CALLBACK(void, *png_user_transform_ptr, (png_structp, png_row_infop,
 	                     png_bytep));
 #endif
 
+#ifdef PNG_WRITE_SUPPORTED
+/* Compresses the filtered rows of a whole image into a complete zlib stream.
+ * Returns memory from png_malloc() with the stream length in the last
+ * argument, or NULL on failure.
+ */
+typedef PNG_CALLBACK(png_bytep, *png_compress_idat_ptr, (png_structp,
+	                     png_const_bytep, png_size_t, png_size_tp));
+
+/* Called with start = 1 before and start = 0 after each stretch of work in one
+ * of the phases below, so that an application can time them.
+ */
+typedef PNG_CALLBACK(void, *png_phase_ptr, (png_structp, int, int));
+
+#define PNG_PHASE_FILTER  0 /* choosing and applying the row filter */
+#define PNG_PHASE_DEFLATE 1 /* zlib deflate or compress_idat_fn */
+#define PNG_PHASE_CRC     2 /* chunk CRCs */
+#endif
+
 #ifdef PNG_USER_CHUNKS_SUPPORTED
 typedef PNG_CALLBACK(int, *png_user_chunk_ptr, (png_structp,
 	                     png_unknown_chunkp));
@@ -1689,6 +1707,27 @@ PNG_EXPORT(72, void, png_set_compression_window_bits, (png_structp png_ptr,
 
 PNG_EXPORT(73, void, png_set_compression_method, (png_structp png_ptr,
 	           int method));
+
+/* Replace the row by row IDAT deflate with compress_fn, which is given the
+ * filtered rows of each image (or APNG frame) at once, so that it can for
+ * example compress them on several threads.  NULL restores the built-in
+ * compressor.
+ */
+PNG_EXPORT(230, void, png_set_compression_fn, (png_structp png_ptr,
+	           png_voidp compress_ptr, png_compress_idat_ptr compress_fn));
+
+/* Return the user pointer associated with the compression function */
+PNG_EXPORT(231, png_voidp, png_get_compression_ptr,
+           (png_const_structp png_ptr));
+
+/* Report the start and end of row filtering, deflate and CRC work to phase_fn,
+ * for profiling.  NULL turns the reports off.
+ */
+PNG_EXPORT(232, void, png_set_phase_fn, (png_structp png_ptr,
+	           png_voidp phase_ptr, png_phase_ptr phase_fn));
+
+/* Return the user pointer associated with the phase function */
+PNG_EXPORT(233, png_voidp, png_get_phase_ptr, (png_const_structp png_ptr));
 #endif
 
 #ifdef PNG_WRITE_CUSTOMIZE_ZTXT_COMPRESSION_SUPPORTED
@@ -2659,7 +2698,7 @@ PNG_EXPORT(207, void, png_save_uint_16, (png_bytep buf, unsigned int i));
  * scripts/symbols.def as well.
  */
 #ifdef PNG_EXPORT_LAST_ORDINAL
-  PNG_EXPORT_LAST_ORDINAL(229);
+  PNG_EXPORT_LAST_ORDINAL(233);
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,437 @@
+/* pngfiltercheck.c - check the SIMD row filters against plain C
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ *
+ * png_read_filter_row hands 3 and 4 byte pixels to SSE2/SSSE3 code.  This
+ * compares it with the C loops it replaced, for every filter:
+ *
+ *  - every (left, up, upper-left) byte triple in every channel, at 3 and 4
+ *    bytes per pixel, which covers all the Avg rounding and Paeth tie cases;
+ *  - rows of 1 to 80 pixels and a few longer odd widths, so that the tail
+ *    after the last full 16 bytes and the last pixel of the row are tested.
+ *
+ * png_write_find_filter filters and scores a row in one SSE2 pass.  Images of
+ * 1 to 8 bytes per pixel, 1 to 69 pixels wide, are written with each of the
+ * 31 sets of filters that png_set_filter takes, and the inflated IDAT data
+ * must hold the filter and the filtered bytes that the plain "minimum sum of
+ * absolute differences" choice gives for every row.
+ *
+ * Rows are allocated at their exact size so that a memory checker catches
+ * reads or writes past the end.  Build it with the libpng and zlib sources,
+ * with PNG_USE_SSSE3=0 to test the SSE2 Paeth filter and with PNG_USE_SSE2=0
+ * for the C filters; "make check" in libapng builds all three.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pngpriv.h"
+
+static unsigned long seed = 1;
+
+static unsigned int
+rnd(void) {
+	seed = seed * 1103515245UL + 12345UL;
+	return (unsigned int)(seed >> 16) & 0xff;
+}
+
+/* The predictor of each filter, as in the PNG specification */
+static int
+predict(int filter, int a, int b, int c) {
+	int p, pa, pb, pc;
+
+	switch (filter) {
+		case PNG_FILTER_VALUE_NONE:
+			return 0;
+
+		case PNG_FILTER_VALUE_SUB:
+			return a;
+
+		case PNG_FILTER_VALUE_UP:
+			return b;
+
+		case PNG_FILTER_VALUE_AVG:
+			return (a + b) / 2;
+
+		default:
+			p = b - c;
+			pc = a - c;
+			pa = abs(p);
+			pb = abs(pc);
+			pc = abs(p + pc);
+			return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+	}
+}
+
+/* The C unfilter that png_read_filter_row used for every pixel size */
+static void
+unfilter(png_size_t rowbytes, unsigned int bpp, png_bytep row,
+	png_const_bytep prev_row, int filter) {
+	png_size_t i;
+
+	for (i = 0; i < rowbytes; i++) {
+		int a = i >= bpp ? row[i - bpp] : 0;
+		int c = i >= bpp ? prev_row[i - bpp] : 0;
+
+		row[i] = (png_byte)(row[i] + predict(filter, a, prev_row[i], c));
+	}
+}
+
+/* Filters the decoded row into raw, the bytes png_read_filter_row is given */
+static void
+filter_row(png_size_t rowbytes, unsigned int bpp, png_const_bytep row,
+	png_const_bytep prev_row, png_bytep raw, int filter) {
+	png_size_t i;
+
+	for (i = 0; i < rowbytes; i++) {
+		int a = i >= bpp ? row[i - bpp] : 0;
+		int c = i >= bpp ? prev_row[i - bpp] : 0;
+
+		raw[i] = (png_byte)(row[i] - predict(filter, a, prev_row[i], c));
+	}
+}
+
+/* Unfilters raw with libpng and with the C loop; returns 1 if they differ
+ * or do not give back the decoded row.
+ */
+static int
+check_row(png_structp png_ptr, png_size_t rowbytes, unsigned int bpp,
+	png_const_bytep row, png_const_bytep prev_row, int filter) {
+	png_bytep raw = (png_bytep)malloc(rowbytes ? rowbytes : 1);
+	png_bytep prev = (png_bytep)malloc(rowbytes ? rowbytes : 1);
+	png_bytep ref = (png_bytep)malloc(rowbytes ? rowbytes : 1);
+	png_row_info row_info;
+	int bad;
+
+	if (raw == NULL || prev == NULL || ref == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(2);
+	}
+
+	memcpy(prev, prev_row, rowbytes);
+	filter_row(rowbytes, bpp, row, prev, raw, filter);
+	memcpy(ref, raw, rowbytes);
+	unfilter(rowbytes, bpp, ref, prev, filter);
+
+	memset(&row_info, 0, sizeof(row_info));
+	row_info.rowbytes = rowbytes;
+	row_info.pixel_depth = (png_byte)(bpp * 8);
+	png_read_filter_row(png_ptr, &row_info, raw, prev, filter);
+
+	bad = memcmp(raw, row, rowbytes) != 0 || memcmp(ref, row, rowbytes) != 0;
+	free(raw);
+	free(prev);
+	free(ref);
+	return bad;
+}
+
+/* Pixel 2k of each row holds a and c, pixel 2k + 1 holds b, so pixel 2k + 1
+ * is unfiltered with (a, b, c).  Each channel steps through all 2^24 triples
+ * from a different starting point.
+ */
+static long
+check_triples(png_structp png_ptr, unsigned int bpp, int filter) {
+	const png_size_t pairs = 4096;
+	png_size_t rowbytes = 2 * pairs * bpp;
+	png_bytep row = (png_bytep)malloc(rowbytes);
+	png_bytep prev_row = (png_bytep)malloc(rowbytes);
+	png_uint_32 t;
+	png_size_t k;
+	unsigned int ch;
+	long bad = 0;
+
+	if (row == NULL || prev_row == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(2);
+	}
+
+	for (t = 0; t < (1UL << 24); t += (png_uint_32)pairs) {
+		for (k = 0; k < pairs; k++)
+			for (ch = 0; ch < bpp; ch++) {
+				png_uint_32 v = (t + (png_uint_32)k + ch * 7919U) & 0xffffff;
+
+				row[2 * k * bpp + ch] = (png_byte)(v & 0xff);
+				prev_row[2 * k * bpp + ch] = (png_byte)(v >> 16);
+				prev_row[(2 * k + 1) * bpp + ch] = (png_byte)((v >> 8) & 0xff);
+				row[(2 * k + 1) * bpp + ch] = (png_byte)rnd();
+			}
+
+		bad += check_row(png_ptr, rowbytes, bpp, row, prev_row, filter);
+	}
+
+	free(row);
+	free(prev_row);
+	return bad;
+}
+
+static long
+check_widths(png_structp png_ptr, unsigned int bpp, int filter) {
+	static const png_size_t wide[] = {127, 255, 1021, 4099};
+	png_bytep row = (png_bytep)malloc(4099 * 4);
+	png_bytep prev_row = (png_bytep)malloc(4099 * 4);
+	png_size_t width, i;
+	long bad = 0;
+	int k;
+
+	if (row == NULL || prev_row == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(2);
+	}
+
+	for (k = 0; k < 80 + 4; k++) {
+		width = k < 80 ? (png_size_t)k + 1 : wide[k - 80];
+		for (i = 0; i < width * bpp; i++) {
+			row[i] = (png_byte)rnd();
+			prev_row[i] = (png_byte)rnd();
+		}
+		bad += check_row(png_ptr, width * bpp, bpp, row, prev_row, filter);
+	}
+
+	free(row);
+	free(prev_row);
+	return bad;
+}
+
+/* PNG file bytes written by libpng */
+typedef struct {
+	png_bytep data;
+	png_size_t size;
+	png_size_t cap;
+} out_buf;
+
+static void
+write_data(png_structp png_ptr, png_bytep data, png_size_t length) {
+	out_buf* out = (out_buf*)png_get_io_ptr(png_ptr);
+
+	if (out->size + length > out->cap) {
+		out->cap = 2 * (out->size + length);
+		out->data = (png_bytep)realloc(out->data, out->cap);
+		if (out->data == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(2);
+		}
+	}
+	memcpy(out->data + out->size, data, length);
+	out->size += length;
+}
+
+static void
+flush_data(png_structp png_ptr) {
+	(void)png_ptr;
+}
+
+/* The row png_write_find_filter should write for filters: the filter with the
+ * smallest sum of absolute values, anything >= 128 counted as negative, and
+ * the earlier filter on a tie; out gets the filter byte and the row.
+ */
+static int
+find_filter(int filters, png_size_t rowbytes, unsigned int bpp,
+	png_const_bytep row, png_const_bytep prev_row, png_bytep out) {
+	png_uint_32 sum, mins = 0;
+	png_size_t i;
+	int filter, best = -1;
+
+	for (filter = PNG_FILTER_VALUE_NONE; filter < PNG_FILTER_VALUE_LAST; filter++) {
+		if (!(filters & (PNG_FILTER_NONE << filter)))
+			continue;
+
+		filter_row(rowbytes, bpp, row, prev_row, out + 1, filter);
+		for (i = 1, sum = 0; i <= rowbytes; i++)
+			sum += out[i] < 128 ? out[i] : 256 - out[i];
+		if (best < 0 || sum < mins) {
+			best = filter;
+			mins = sum;
+		}
+	}
+
+	out[0] = (png_byte)best;
+	filter_row(rowbytes, bpp, row, prev_row, out + 1, best);
+	return best;
+}
+
+/* Rows that different filters do best on: noise, horizontal and vertical
+ * gradients, the row above with noise, and flat runs.
+ */
+static void
+make_row(png_bytep row, png_const_bytep prev_row, png_size_t rowbytes,
+	unsigned int bpp) {
+	png_size_t i;
+	unsigned int kind = rnd() % 5, step = rnd() % 7;
+
+	for (i = 0; i < rowbytes; i++)
+		switch (kind) {
+			case 0:
+				row[i] = (png_byte)rnd();
+				break;
+
+			case 1:
+				row[i] = (png_byte)(i < bpp ? rnd() : row[i - bpp] + step + rnd() % 3);
+				break;
+
+			case 2:
+				row[i] = (png_byte)(prev_row[i] + step);
+				break;
+
+			case 3:
+				row[i] = (png_byte)(prev_row[i] + rnd() % 5 - 2);
+				break;
+
+			default:
+				row[i] = (png_byte)(i < bpp || rnd() % 16 == 0 ? rnd() : row[i - bpp]);
+				break;
+		}
+}
+
+/* Writes one image with filters and checks every row of its IDAT data;
+ * returns the number of rows that differ, and counts the filters used.
+ */
+static long
+check_write(unsigned int width, int color_type, int channels, int bit_depth,
+	int filters, long* used) {
+	const png_uint_32 height = 6;
+	unsigned int bpp = channels * bit_depth / 8;
+	png_size_t rowbytes = width * bpp;
+	png_bytep image = (png_bytep)calloc(height + 1, rowbytes);
+	png_bytep want = (png_bytep)malloc(height * (rowbytes + 1));
+	png_bytep got = (png_bytep)malloc(height * (rowbytes + 1) + 1);
+	png_bytep idat = NULL;
+	png_bytep rows[6];
+	png_structp png_ptr;
+	png_infop info_ptr;
+	out_buf out = {NULL, 0, 0};
+	png_size_t pos, idat_len = 0;
+	png_size_t got_len = height * (rowbytes + 1) + 1;
+	z_stream strm;
+	png_uint_32 y;
+	long bad = 0;
+
+	if (image == NULL || want == NULL || got == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(2);
+	}
+
+	/* image holds a row of zeros, the previous row of the first one */
+	for (y = 0; y < height; y++) {
+		rows[y] = image + (y + 1) * rowbytes;
+		make_row(rows[y], rows[y] - rowbytes, rowbytes, bpp);
+		used[find_filter(filters, rowbytes, bpp, rows[y], rows[y] - rowbytes, want + y * (rowbytes + 1))]++;
+	}
+
+	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	info_ptr = png_ptr != NULL ? png_create_info_struct(png_ptr) : NULL;
+	if (info_ptr == NULL) {
+		fprintf(stderr, "png_create_write_struct failed\n");
+		exit(2);
+	}
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		free(image);
+		free(want);
+		free(got);
+		free(out.data);
+		return height;
+	}
+
+	png_set_write_fn(png_ptr, &out, write_data, flush_data);
+	png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filters);
+	png_set_compression_level(png_ptr, 1);
+	png_set_IHDR(png_ptr, info_ptr, width, height, bit_depth, color_type,
+		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	png_write_info(png_ptr, info_ptr);
+	png_write_image(png_ptr, rows);
+	png_write_end(png_ptr, info_ptr);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+
+	/* gather the IDAT chunks after the signature and inflate them */
+	idat = (png_bytep)malloc(out.size);
+	for (pos = 8; idat != NULL && pos + 12 <= out.size; ) {
+		png_size_t len = png_get_uint_32(out.data + pos);
+
+		if (memcmp(out.data + pos + 4, "IDAT", 4) == 0) {
+			memcpy(idat + idat_len, out.data + pos + 8, len);
+			idat_len += len;
+		}
+		pos += len + 12;
+	}
+
+	memset(&strm, 0, sizeof(strm));
+	if (idat == NULL || inflateInit(&strm) != Z_OK)
+		bad = height;
+	else {
+		strm.next_in = idat;
+		strm.avail_in = (uInt)idat_len;
+		strm.next_out = got;
+		strm.avail_out = (uInt)got_len;
+		if (inflate(&strm, Z_FINISH) != Z_STREAM_END || strm.total_out != height * (rowbytes + 1))
+			bad = height;
+		else
+			for (y = 0; y < height; y++)
+				bad += memcmp(got + y * (rowbytes + 1), want + y * (rowbytes + 1), rowbytes + 1) != 0;
+		inflateEnd(&strm);
+	}
+
+	free(image);
+	free(want);
+	free(got);
+	free(idat);
+	free(out.data);
+	return bad;
+}
+
+int
+main(void) {
+	static const char* names[] = {"", "sub", "up", "avg", "paeth"};
+	png_structp png_ptr;
+	unsigned int bpp;
+	int filter, failed = 0;
+
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (png_ptr == NULL) {
+		fprintf(stderr, "png_create_read_struct failed\n");
+		return 2;
+	}
+
+	for (bpp = 3; bpp <= 4; bpp++)
+		for (filter = PNG_FILTER_VALUE_SUB; filter < PNG_FILTER_VALUE_LAST; filter++) {
+			long triples = check_triples(png_ptr, bpp, filter);
+			long widths = check_widths(png_ptr, bpp, filter);
+
+			printf("%-5s bpp %u: %ld rows of triples, %ld row widths differ\n", names[filter], bpp, triples,
+				widths);
+			if (triples != 0 || widths != 0)
+				failed = 1;
+		}
+
+	png_destroy_read_struct(&png_ptr, NULL, NULL);
+
+	{
+		/* colour type, channels and bit depth: 1, 2, 3, 4 and 8 bytes per pixel */
+		static const int types[][3] = {
+			{PNG_COLOR_TYPE_GRAY, 1, 8}, {PNG_COLOR_TYPE_GRAY_ALPHA, 2, 8}, {PNG_COLOR_TYPE_RGB, 3, 8},
+			{PNG_COLOR_TYPE_RGB_ALPHA, 4, 8}, {PNG_COLOR_TYPE_RGB_ALPHA, 4, 16}
+		};
+		long used[PNG_FILTER_VALUE_LAST] = {0, 0, 0, 0, 0};
+		long rows = 0, bad = 0;
+		unsigned int width;
+		int t, set;
+
+		for (t = 0; t < 5; t++)
+			for (width = 1; width <= 69; width++)
+				for (set = 1; set < 32; set++) {
+					bad += check_write(width, types[t][0], types[t][1], types[t][2], set << 3, used);
+					rows += 6;
+				}
+
+		printf("write: %ld rows, %ld differ; none %ld, sub %ld, up %ld, avg %ld, paeth %ld\n", rows, bad,
+			used[0], used[1], used[2], used[3], used[4]);
+		if (bad != 0)
+			failed = 1;
+	}
+
+	printf(failed ? "FAILED: png_read_filter_row and png_write_find_filter\n" :
+		"passed: png_read_filter_row and png_write_find_filter\n");
+	return failed;
+}
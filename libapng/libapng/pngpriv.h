@@ -106,6 +106,17 @@ typedef PNG_CONST png_uint_16p FAR * png_const_uint_16pp;
 #  define PNG_UNUSED(param) (void)param;
 #endif
 
+/* SSE2 versions of the row filters are used wherever the compiler already
+ * targets SSE2 (always the case on x64).  Define PNG_USE_SSE2 to 0 to build
+ * the plain C filters only.
+ */
+#if defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  ifndef PNG_USE_SSE2
+#    define PNG_USE_SSE2 1
+#  endif
+#endif
+
 /* Just a little check that someone hasn't tried to define something
  * contradictory.
  */
@@ -280,6 +291,15 @@ typedef PNG_CONST png_uint_16p FAR * png_const_uint_16pp;
 #define PNG_HAVE_fcTL             0x8000L
 #endif
 
+/* Report the start (1) or end (0) of a phase to png_set_phase_fn's callback */
+#ifdef PNG_WRITE_SUPPORTED
+#define png_write_phase(png_ptr, phase, start) \
+   do { if ((png_ptr)->phase_fn != NULL) \
+      (*(png_ptr)->phase_fn)((png_ptr), (phase), (start)); } while (0)
+#else
+#define png_write_phase(png_ptr, phase, start) ((void)0)
+#endif
+
 /* Flags for the transformations the PNG library does on the image data */
 #define PNG_BGR                 0x0001
 #define PNG_INTERLACE           0x0002
@@ -3065,11 +3065,213 @@ png_do_read_interlace(png_structp png_ptr) {
 }
 #endif /* PNG_READ_INTERLACING_SUPPORTED */
 
+#if PNG_USE_SSE2
+#include <emmintrin.h>
+
+/* The SSSE3 Paeth filter is picked at run time, so it has to be compiled
+ * for SSSE3 even when the rest of the file is not.  Define PNG_USE_SSSE3 to
+ * 0 to always use the SSE2 one.
+ */
+#ifndef PNG_USE_SSSE3
+#  define PNG_USE_SSSE3 1
+#endif
+
+#if PNG_USE_SSSE3
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#  include <intrin.h>
+#else
+#  include <cpuid.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__SSSE3__)
+#  define PNG_SSSE3_TARGET __attribute__((target("ssse3")))
+#else
+#  define PNG_SSSE3_TARGET
+#endif
+
+static int
+png_cpu_has_ssse3(void) {
+	static int has_ssse3 = -1;
+
+	if (has_ssse3 < 0) {
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuid(regs, 1);
+		has_ssse3 = (regs[2] >> 9) & 1;
+#else
+		unsigned int eax, ebx, ecx, edx;
+		has_ssse3 = __get_cpuid(1, &eax, &ebx, &ecx, &edx) ? (ecx >> 9) & 1 : 0;
+#endif
+	}
+
+	return has_ssse3;
+}
+#endif /* PNG_USE_SSSE3 */
+
+/* Unfiltering is serial from one pixel to the next, so these work on a
+ * whole 3 or 4 byte pixel per step rather than on 16 bytes.  Pixels are
+ * moved with memcpy so the last one never reads past the end of the row.
+ */
+static __m128i
+png_load_pixel(png_const_bytep p, unsigned int bpp) {
+	png_uint_32 v = 0;
+
+	if (bpp == 4)
+		png_memcpy(&v, p, 4);
+	else
+		png_memcpy(&v, p, 3);
+
+	return _mm_cvtsi32_si128((int)v);
+}
+
+static void
+png_store_pixel(png_bytep p, __m128i v, unsigned int bpp) {
+	png_uint_32 x = (png_uint_32)_mm_cvtsi128_si32(v);
+
+	if (bpp == 4)
+		png_memcpy(p, &x, 4);
+	else
+		png_memcpy(p, &x, 3);
+}
+
+/* Picks a, b or c per 16 bit lane given pa = |b - c|, pb = |a - c| and
+ * pc = |a + b - 2c|, with the same tie breaking as the C code.
+ */
+static __m128i
+png_paeth_select(__m128i a, __m128i b, __m128i c, __m128i pa, __m128i pb,
+	__m128i pc) {
+	__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+	__m128i use_a = _mm_cmpeq_epi16(smallest, pa);
+	__m128i use_b = _mm_cmpeq_epi16(smallest, pb);
+	__m128i pred = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c));
+
+	return _mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, pred));
+}
+
+static void
+png_read_filter_paeth_sse2(png_size_t rowbytes, unsigned int bpp,
+	png_bytep row, png_const_bytep prev_row) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i a, b = zero, c, d = zero;
+	png_size_t i;
+
+	for (i = 0; i < rowbytes; i += bpp) {
+		__m128i pa, pb, pc;
+
+		c = b;
+		b = _mm_unpacklo_epi8(png_load_pixel(prev_row + i, bpp), zero);
+		a = d;
+		d = _mm_unpacklo_epi8(png_load_pixel(row + i, bpp), zero);
+
+		pa = _mm_sub_epi16(b, c);
+		pb = _mm_sub_epi16(a, c);
+		pc = _mm_add_epi16(pa, pb);
+		pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+		pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+		pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+		/* Adding bytes keeps each lane's high byte zero */
+		d = _mm_add_epi8(d, png_paeth_select(a, b, c, pa, pb, pc));
+		png_store_pixel(row + i, _mm_packus_epi16(d, d), bpp);
+	}
+}
+
+#if PNG_USE_SSSE3
+static void PNG_SSSE3_TARGET
+png_read_filter_paeth_ssse3(png_size_t rowbytes, unsigned int bpp,
+	png_bytep row, png_const_bytep prev_row) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i a, b = zero, c, d = zero;
+	png_size_t i;
+
+	for (i = 0; i < rowbytes; i += bpp) {
+		__m128i pa, pb, pc;
+
+		c = b;
+		b = _mm_unpacklo_epi8(png_load_pixel(prev_row + i, bpp), zero);
+		a = d;
+		d = _mm_unpacklo_epi8(png_load_pixel(row + i, bpp), zero);
+
+		pa = _mm_sub_epi16(b, c);
+		pb = _mm_sub_epi16(a, c);
+		pc = _mm_add_epi16(pa, pb);
+		pa = _mm_abs_epi16(pa);
+		pb = _mm_abs_epi16(pb);
+		pc = _mm_abs_epi16(pc);
+
+		d = _mm_add_epi8(d, png_paeth_select(a, b, c, pa, pb, pc));
+		png_store_pixel(row + i, _mm_packus_epi16(d, d), bpp);
+	}
+}
+#endif /* PNG_USE_SSSE3 */
+
+static void
+png_read_filter_row_sse2(png_size_t rowbytes, unsigned int bpp, png_bytep row,
+	png_const_bytep prev_row, int filter) {
+	__m128i a = _mm_setzero_si128();
+	png_size_t i = 0;
+
+	switch (filter) {
+		case PNG_FILTER_VALUE_SUB:
+			for (; i < rowbytes; i += bpp) {
+				a = _mm_add_epi8(a, png_load_pixel(row + i, bpp));
+				png_store_pixel(row + i, a, bpp);
+			}
+			break;
+
+		case PNG_FILTER_VALUE_UP:
+			for (; i + 16 <= rowbytes; i += 16) {
+				__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+				__m128i b = _mm_loadu_si128((const __m128i*)(prev_row + i));
+				_mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+			}
+
+			for (; i < rowbytes; i++)
+				row[i] = (png_byte)((row[i] + prev_row[i]) & 0xff);
+			break;
+
+		case PNG_FILTER_VALUE_AVG:
+			for (; i < rowbytes; i += bpp) {
+				__m128i b = png_load_pixel(prev_row + i, bpp);
+				/* pavgb rounds up, the filter rounds down */
+				__m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b),
+					_mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+
+				a = _mm_add_epi8(png_load_pixel(row + i, bpp), avg);
+				png_store_pixel(row + i, a, bpp);
+			}
+			break;
+
+		case PNG_FILTER_VALUE_PAETH:
+#if PNG_USE_SSSE3
+			if (png_cpu_has_ssse3()) {
+				png_read_filter_paeth_ssse3(rowbytes, bpp, row, prev_row);
+				break;
+			}
+#endif
+			png_read_filter_paeth_sse2(rowbytes, bpp, row, prev_row);
+			break;
+	}
+}
+#endif
+
 void /* PRIVATE */
 png_read_filter_row(png_structp png_ptr, png_row_infop row_info, png_bytep row,
                     png_const_bytep prev_row, int filter) {
 	png_debug(1, "in png_read_filter_row");
 	png_debug2(2, "row = %u, filter = %d", png_ptr->row_number, filter);
+#if PNG_USE_SSE2
+	if (filter > PNG_FILTER_VALUE_NONE && filter < PNG_FILTER_VALUE_LAST) {
+		unsigned int bpp = (row_info->pixel_depth + 7) >> 3;
+
+		if (bpp == 3 || bpp == 4) {
+			png_read_filter_row_sse2(row_info->rowbytes, bpp, row, prev_row, filter);
+			return;
+		}
+	}
+#endif
+
 	switch (filter) {
 		case PNG_FILTER_VALUE_NONE:
 			break;
@@ -3558,6 +3760,9 @@ png_read_reinit(png_structp png_ptr, png_infop info_ptr) {
 	png_ptr->width = info_ptr->next_frame_width;
 	png_ptr->height = info_ptr->next_frame_height;
 	png_ptr->rowbytes = PNG_ROWBYTES(png_ptr->pixel_depth, png_ptr->width);
+	/* keep the png_read_update_info row size check in step with the frame */
+	if (png_ptr->info_rowbytes != 0)
+		png_ptr->info_rowbytes = PNG_ROWBYTES(info_ptr->pixel_depth, png_ptr->width);
 	if (png_ptr->prev_row)
 		png_memset(png_ptr->prev_row, 0, png_ptr->rowbytes + 1);
 }
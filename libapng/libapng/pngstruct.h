@@ -83,6 +83,16 @@ struct png_struct_def {
 	int zlib_window_bits; /* holds zlib compression window bits */
 	int zlib_mem_level; /* holds zlib compression memory level */
 	int zlib_strategy; /* holds zlib compression strategy */
+
+	png_compress_idat_ptr compress_idat_fn; /* whole image IDAT compressor */
+	png_voidp compress_idat_ptr; /* user supplied struct for it */
+	png_bytep idat_buf; /* filtered rows collected for compress_idat_fn */
+	png_size_t idat_buf_len; /* bytes used in idat_buf */
+	png_size_t idat_buf_size; /* allocated size of idat_buf */
+	png_bytep idat_stream; /* compress_idat_fn result while it is written */
+
+	png_phase_ptr phase_fn; /* profiling: start and end of each phase */
+	png_voidp phase_ptr; /* user supplied struct for it */
 #endif
 	/* Added at libpng 1.5.4 */
 #if defined(PNG_WRITE_COMPRESSED_TEXT_SUPPORTED) || \
@@ -781,11 +781,19 @@ png_write_flush(png_structp png_ptr) {
 	if (png_ptr->row_number >= png_ptr->num_rows)
 		return;
 
+	/* A compression function gets the whole image at the end, so there is
+	 * nothing to flush before that.
+	 */
+	if (png_ptr->compress_idat_fn != NULL)
+		return;
+
 	do {
 		int ret;
 
 		/* Compress the data */
+		png_write_phase(png_ptr, PNG_PHASE_DEFLATE, 1);
 		ret = deflate(&png_ptr->zstream, Z_SYNC_FLUSH);
+		png_write_phase(png_ptr, PNG_PHASE_DEFLATE, 0);
 		wrote_IDAT = 0;
 
 		/* Check for compression errors */
@@ -903,6 +911,8 @@ png_write_destroy(png_structp png_ptr) {
 
 	/* Free our memory.  png_free checks NULL for us. */
 	png_free(png_ptr, png_ptr->zbuf);
+	png_free(png_ptr, png_ptr->idat_buf);
+	png_free(png_ptr, png_ptr->idat_stream);
 	png_free(png_ptr, png_ptr->row_buf);
 #ifdef PNG_WRITE_FILTER_SUPPORTED
 	png_free(png_ptr, png_ptr->prev_row);
@@ -1363,6 +1373,46 @@ png_set_compression_method(png_structp png_ptr, int method) {
 	png_ptr->zlib_method = method;
 }
 
+void PNGAPI
+png_set_compression_fn(png_structp png_ptr, png_voidp compress_ptr,
+                       png_compress_idat_ptr compress_fn) {
+	png_debug(1, "in png_set_compression_fn");
+
+	if (png_ptr == NULL)
+		return;
+
+	png_ptr->compress_idat_ptr = compress_ptr;
+	png_ptr->compress_idat_fn = compress_fn;
+}
+
+png_voidp PNGAPI
+png_get_compression_ptr(png_const_structp png_ptr) {
+	if (png_ptr == NULL)
+		return (NULL);
+
+	return ((png_voidp)png_ptr->compress_idat_ptr);
+}
+
+void PNGAPI
+png_set_phase_fn(png_structp png_ptr, png_voidp phase_ptr,
+                 png_phase_ptr phase_fn) {
+	png_debug(1, "in png_set_phase_fn");
+
+	if (png_ptr == NULL)
+		return;
+
+	png_ptr->phase_ptr = phase_ptr;
+	png_ptr->phase_fn = phase_fn;
+}
+
+png_voidp PNGAPI
+png_get_phase_ptr(png_const_structp png_ptr) {
+	if (png_ptr == NULL)
+		return (NULL);
+
+	return ((png_voidp)png_ptr->phase_ptr);
+}
+
 /* The following were added to libpng-1.5.4 */
 #ifdef PNG_WRITE_CUSTOMIZE_ZTXT_COMPRESSION_SUPPORTED
 void PNGAPI
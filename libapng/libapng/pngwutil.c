@@ -2048,11 +2048,71 @@ png_write_start_row(png_structp png_ptr) {
 		png_ptr->usr_width = png_ptr->width;
 	}
 
+	if (png_ptr->compress_idat_fn != NULL) {
+		png_ptr->idat_buf_len = 0;
+		return;
+	}
+
 	png_zlib_claim(png_ptr, PNG_ZLIB_FOR_IDAT);
 	png_ptr->zstream.avail_out = (uInt)png_ptr->zbuf_size;
 	png_ptr->zstream.next_out = png_ptr->zbuf;
 }
 
+/* Append a filtered row to the data handed to compress_idat_fn */
+static void
+png_write_collect_row(png_structp png_ptr, png_const_bytep row,
+                      png_size_t length) {
+	if (length > png_ptr->idat_buf_size - png_ptr->idat_buf_len) {
+		png_size_t size;
+		png_bytep buf;
+
+		if (length > PNG_SIZE_MAX - png_ptr->idat_buf_len)
+			png_error(png_ptr, "Image too large to compress");
+
+		/* Exact for non-interlaced images, which fill it in one go */
+		size = png_ptr->idat_buf_len + length;
+		if (size < png_ptr->height * (png_ptr->rowbytes + 1))
+			size = png_ptr->height * (png_ptr->rowbytes + 1);
+		else if (size < PNG_SIZE_MAX / 2)
+			size *= 2;
+
+		buf = (png_bytep)png_malloc(png_ptr, (png_alloc_size_t)size);
+		if (png_ptr->idat_buf_len != 0)
+			png_memcpy(buf, png_ptr->idat_buf, png_ptr->idat_buf_len);
+		png_free(png_ptr, png_ptr->idat_buf);
+		png_ptr->idat_buf = buf;
+		png_ptr->idat_buf_size = size;
+	}
+
+	png_memcpy(png_ptr->idat_buf + png_ptr->idat_buf_len, row, length);
+	png_ptr->idat_buf_len += length;
+}
+
+/* Compress the collected rows with compress_idat_fn and write the stream out
+ * in IDAT (or fdAT) chunks of the usual zbuf_size.
+ */
+static void
+png_write_compressed_idat(png_structp png_ptr) {
+	png_size_t length = 0;
+	png_size_t pos;
+
+	png_write_phase(png_ptr, PNG_PHASE_DEFLATE, 1);
+	png_ptr->idat_stream = png_ptr->compress_idat_fn(png_ptr,
+	                                                 png_ptr->idat_buf, png_ptr->idat_buf_len, &length);
+	png_write_phase(png_ptr, PNG_PHASE_DEFLATE, 0);
+
+	if (png_ptr->idat_stream == NULL || length < 2)
+		png_error(png_ptr, "IDAT compression failed");
+
+	for (pos = 0; pos < length; pos += png_ptr->zbuf_size)
+		png_write_IDAT(png_ptr, png_ptr->idat_stream + pos,
+		               length - pos < png_ptr->zbuf_size ? length - pos : png_ptr->zbuf_size);
+
+	png_free(png_ptr, png_ptr->idat_stream);
+	png_ptr->idat_stream = NULL;
+	png_ptr->idat_buf_len = 0;
+}
+
 /* Internal use only.  Called when finished processing a row of data. */
 void /* PRIVATE */
 png_write_finish_row(png_structp png_ptr) {
@@ -2127,11 +2187,18 @@ png_write_finish_row(png_structp png_ptr) {
 	}
 #endif
 
+	if (png_ptr->compress_idat_fn != NULL) {
+		png_write_compressed_idat(png_ptr);
+		return;
+	}
+
 	/* If we get here, we've just written the last row, so we need
 	   to flush the compressor */
 	do {
 		/* Tell the compressor we are done */
+		png_write_phase(png_ptr, PNG_PHASE_DEFLATE, 1);
 		ret = deflate(&png_ptr->zstream, Z_FINISH);
+		png_write_phase(png_ptr, PNG_PHASE_DEFLATE, 0);
 
 		/* Check for an error */
 		if (ret == Z_OK) {
@@ -2340,6 +2407,178 @@ static void png_write_filtered_row(png_structp png_ptr, png_bytep filtered_row);
 #define PNG_LOMASK ((png_uint_32)0xffffL)
 #define PNG_HIMASK ((png_uint_32)(~PNG_LOMASK >> PNG_HISHIFT))
 
+#if defined(PNG_WRITE_FILTER_SUPPORTED) && PNG_USE_SSE2
+#include <emmintrin.h>
+
+/* Sum of absolute values of the filtered bytes, with anything >= 128
+ * counted as negative: min(v, 256 - v) per byte, added up by psadbw.
+ */
+#define PNG_SSE2_SAD(sum, v) \
+	sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_min_epu8(v, \
+		_mm_sub_epi8(_mm_setzero_si128(), v)), _mm_setzero_si128()))
+
+static __m128i
+png_paeth_sse2(__m128i a, __m128i b, __m128i c) {
+	/* Same predictor as the C code below, on 16 bit lanes and without
+	 * branches: p = b - c, pc = a - c, then pick a, b or c by comparing
+	 * |p|, |pc| and |p + pc|.
+	 */
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo, hi;
+	int half;
+
+	for (half = 0; half < 2; half++) {
+		__m128i a16 = half ? _mm_unpackhi_epi8(a, zero) : _mm_unpacklo_epi8(a, zero);
+		__m128i b16 = half ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+		__m128i c16 = half ? _mm_unpackhi_epi8(c, zero) : _mm_unpacklo_epi8(c, zero);
+		__m128i p = _mm_sub_epi16(b16, c16);
+		__m128i pc = _mm_sub_epi16(a16, c16);
+		__m128i pa, pb, not_a, not_b, pred;
+
+		pc = _mm_add_epi16(p, pc);
+		pa = _mm_max_epi16(p, _mm_sub_epi16(zero, p));
+		pb = _mm_sub_epi16(a16, c16);
+		pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+		pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+		not_b = _mm_cmpgt_epi16(pb, pc);
+		pred = _mm_or_si128(_mm_and_si128(not_b, c16), _mm_andnot_si128(not_b, b16));
+		not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+		pred = _mm_or_si128(_mm_and_si128(not_a, pred), _mm_andnot_si128(not_a, a16));
+
+		if (half)
+			hi = pred;
+		else
+			lo = pred;
+	}
+
+	return _mm_packus_epi16(lo, hi);
+}
+
+/* Applies every filter in filter_to_do to the current row in a single pass
+ * and returns the unweighted sum for each one in sums[], indexed by filter
+ * value.  Each filter only reads the raw row and the previous row, so they
+ * can all be done together 16 bytes at a time; the first pixel (whose left
+ * neighbour is zero) and the tail are done one byte at a time.
+ */
+static void
+png_write_filter_row_sse2(png_structp png_ptr, png_byte filter_to_do,
+	png_size_t bpp, png_size_t row_bytes, png_uint_32 *sums) {
+	png_const_bytep rp = png_ptr->row_buf + 1;
+	png_const_bytep pp = NULL;
+	png_bytep sub = png_ptr->sub_row;
+	png_bytep up = png_ptr->up_row;
+	png_bytep avg = png_ptr->avg_row;
+	png_bytep paeth = png_ptr->paeth_row;
+	__m128i acc[5];
+	png_size_t i;
+	int f, v;
+
+	/* prev_row is only allocated when a filter needs it */
+	if (filter_to_do & (PNG_FILTER_UP | PNG_FILTER_AVG | PNG_FILTER_PAETH))
+		pp = png_ptr->prev_row + 1;
+
+	for (f = 0; f < 5; f++) {
+		acc[f] = _mm_setzero_si128();
+		sums[f] = 0;
+	}
+
+	for (i = 0; i < row_bytes; i++) {
+		int x, a, b, c, pa, pb, pc, p;
+
+		/* Leave the whole 16 byte blocks after the first pixel to the loop
+		 * below
+		 */
+		if (i == bpp)
+			i += ((row_bytes - bpp) & ~(png_size_t)15);
+
+		if (i == row_bytes)
+			break;
+
+		x = rp[i];
+		a = i >= bpp ? rp[i - bpp] : 0;
+		b = pp != NULL ? pp[i] : 0;
+		c = pp != NULL && i >= bpp ? pp[i - bpp] : 0;
+
+		if (filter_to_do & PNG_FILTER_NONE) {
+			sums[PNG_FILTER_VALUE_NONE] += (x < 128) ? x : 256 - x;
+		}
+
+		if (filter_to_do & PNG_FILTER_SUB) {
+			v = sub[i + 1] = (png_byte)((x - a) & 0xff);
+			sums[PNG_FILTER_VALUE_SUB] += (v < 128) ? v : 256 - v;
+		}
+
+		if (filter_to_do & PNG_FILTER_UP) {
+			v = up[i + 1] = (png_byte)((x - b) & 0xff);
+			sums[PNG_FILTER_VALUE_UP] += (v < 128) ? v : 256 - v;
+		}
+
+		if (filter_to_do & PNG_FILTER_AVG) {
+			v = avg[i + 1] = (png_byte)((x - ((a + b) / 2)) & 0xff);
+			sums[PNG_FILTER_VALUE_AVG] += (v < 128) ? v : 256 - v;
+		}
+
+		if (filter_to_do & PNG_FILTER_PAETH) {
+			p = b - c;
+			pc = a - c;
+			pa = p < 0 ? -p : p;
+			pb = pc < 0 ? -pc : pc;
+			pc = (p + pc) < 0 ? -(p + pc) : p + pc;
+			p = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+
+			v = paeth[i + 1] = (png_byte)((x - p) & 0xff);
+			sums[PNG_FILTER_VALUE_PAETH] += (v < 128) ? v : 256 - v;
+		}
+	}
+
+	for (i = bpp; i + 16 <= row_bytes; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(rp + i));
+		__m128i a = _mm_loadu_si128((const __m128i*)(rp + i - bpp));
+		__m128i b = pp != NULL ? _mm_loadu_si128((const __m128i*)(pp + i)) :
+			_mm_setzero_si128();
+		__m128i d;
+
+		if (filter_to_do & PNG_FILTER_NONE) {
+			PNG_SSE2_SAD(acc[PNG_FILTER_VALUE_NONE], x);
+		}
+
+		if (filter_to_do & PNG_FILTER_SUB) {
+			d = _mm_sub_epi8(x, a);
+			_mm_storeu_si128((__m128i*)(sub + 1 + i), d);
+			PNG_SSE2_SAD(acc[PNG_FILTER_VALUE_SUB], d);
+		}
+
+		if (filter_to_do & PNG_FILTER_UP) {
+			d = _mm_sub_epi8(x, b);
+			_mm_storeu_si128((__m128i*)(up + 1 + i), d);
+			PNG_SSE2_SAD(acc[PNG_FILTER_VALUE_UP], d);
+		}
+
+		if (filter_to_do & PNG_FILTER_AVG) {
+			/* pavgb rounds up, the filter rounds down */
+			d = _mm_sub_epi8(_mm_avg_epu8(a, b),
+				_mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+			d = _mm_sub_epi8(x, d);
+			_mm_storeu_si128((__m128i*)(avg + 1 + i), d);
+			PNG_SSE2_SAD(acc[PNG_FILTER_VALUE_AVG], d);
+		}
+
+		if (filter_to_do & PNG_FILTER_PAETH) {
+			__m128i c = _mm_loadu_si128((const __m128i*)(pp + i - bpp));
+			d = _mm_sub_epi8(x, png_paeth_sse2(a, b, c));
+			_mm_storeu_si128((__m128i*)(paeth + 1 + i), d);
+			PNG_SSE2_SAD(acc[PNG_FILTER_VALUE_PAETH], d);
+		}
+	}
+
+	for (f = 0; f < 5; f++) {
+		sums[f] += (png_uint_32)_mm_cvtsi128_si32(acc[f]) +
+			(png_uint_32)_mm_cvtsi128_si32(_mm_srli_si128(acc[f], 8));
+	}
+}
+#endif
+
 void /* PRIVATE */
 png_write_find_filter(png_structp png_ptr, png_row_infop row_info) {
 	png_bytep best_row;
@@ -2367,6 +2606,7 @@ png_write_find_filter(png_structp png_ptr, png_row_infop row_info) {
 
 	prev_row = png_ptr->prev_row;
 #endif
+	png_write_phase(png_ptr, PNG_PHASE_FILTER, 1);
 	best_row = png_ptr->row_buf;
 #ifdef PNG_WRITE_FILTER_SUPPORTED
 	row_buf = best_row;
@@ -2397,6 +2637,47 @@ png_write_find_filter(png_structp png_ptr, png_row_infop row_info) {
 	 */
 
 
+#if PNG_USE_SSE2
+	/* Filter and score the row in one pass.  The early exits below only ever
+	 * stop a filter that is already losing, so comparing the full sums in the
+	 * same order picks the same filter.  Rows long enough to overflow the sums
+	 * and the weighted heuristic still go through the code below.
+	 */
+	if ((filter_to_do & PNG_ALL_FILTERS) != 0 &&
+	    (filter_to_do & PNG_ALL_FILTERS) != PNG_FILTER_NONE &&
+#ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
+	    png_ptr->heuristic_method != PNG_FILTER_HEURISTIC_WEIGHTED &&
+#endif
+	    row_bytes < (PNG_MAXSUM >> 8)) {
+		png_uint_32 sums[5];
+
+		png_write_filter_row_sse2(png_ptr, filter_to_do, bpp, row_bytes, sums);
+
+		if (filter_to_do & PNG_FILTER_NONE)
+			mins = sums[PNG_FILTER_VALUE_NONE];
+
+		if ((filter_to_do & PNG_FILTER_SUB) && sums[PNG_FILTER_VALUE_SUB] < mins) {
+			mins = sums[PNG_FILTER_VALUE_SUB];
+			best_row = png_ptr->sub_row;
+		}
+
+		if ((filter_to_do & PNG_FILTER_UP) && sums[PNG_FILTER_VALUE_UP] < mins) {
+			mins = sums[PNG_FILTER_VALUE_UP];
+			best_row = png_ptr->up_row;
+		}
+
+		if ((filter_to_do & PNG_FILTER_AVG) && sums[PNG_FILTER_VALUE_AVG] < mins) {
+			mins = sums[PNG_FILTER_VALUE_AVG];
+			best_row = png_ptr->avg_row;
+		}
+
+		if ((filter_to_do & PNG_FILTER_PAETH) && sums[PNG_FILTER_VALUE_PAETH] < mins)
+			best_row = png_ptr->paeth_row;
+
+		filter_to_do = 0; /* Already done, skip the byte-at-a-time filters */
+	}
+#endif
+
 	/* We don't need to test the 'no filter' case if this is the only filter
 	 * that has been chosen, as it doesn't actually do anything to the data.
 	 */
@@ -2933,6 +3214,7 @@ png_write_find_filter(png_structp png_ptr, png_row_infop row_info) {
 	}
 #endif /* PNG_WRITE_FILTER_SUPPORTED */
 	/* Do the actual writing of the filtered row data from the chosen filter. */
+	png_write_phase(png_ptr, PNG_PHASE_FILTER, 0);
 
 	png_write_filtered_row(png_ptr, best_row);
 
@@ -2966,8 +3248,15 @@ png_write_filtered_row(png_structp png_ptr, png_bytep filtered_row) {
 	png_ptr->zstream.next_in = filtered_row;
 	png_ptr->zstream.avail_in = 0;
 	avail = png_ptr->row_info.rowbytes + 1;
+
+	/* compress_idat_fn compresses all the rows once the image is done */
+	if (png_ptr->compress_idat_fn != NULL) {
+		png_write_collect_row(png_ptr, filtered_row, avail);
+		avail = 0;
+	}
+
 	/* Repeat until we have compressed all the data */
-	do {
+	while (avail > 0 || png_ptr->zstream.avail_in > 0) {
 		int ret; /* Return of zlib */
 
 		/* Record the number of bytes available - zlib supports at least 65535
@@ -2992,7 +3281,9 @@ png_write_filtered_row(png_structp png_ptr, png_bytep filtered_row) {
 		}
 
 		/* Compress the data */
+		png_write_phase(png_ptr, PNG_PHASE_DEFLATE, 1);
 		ret = deflate(&png_ptr->zstream, Z_NO_FLUSH);
+		png_write_phase(png_ptr, PNG_PHASE_DEFLATE, 0);
 
 		/* Check for compression errors */
 		if (ret != Z_OK) {
@@ -3010,7 +3301,6 @@ png_write_filtered_row(png_structp png_ptr, png_bytep filtered_row) {
 		}
 		/* Repeat until all data has been compressed */
 	}
-	while (avail > 0 || png_ptr->zstream.avail_in > 0);
 
 	/* Swap the current and previous rows */
 	if (png_ptr->prev_row != NULL) {
@@ -3040,6 +3330,24 @@ png_write_reset(png_structp png_ptr) {
 	png_ptr->row_number = 0;
 	png_ptr->pass = 0;
 	png_ptr->mode &= ~PNG_HAVE_IDAT;
+
+	/* png_write_start_row() allocates the row buffers again for the next
+	 * frame, for its width and for the filters set for it.
+	 */
+	png_free(png_ptr, png_ptr->row_buf);
+	png_ptr->row_buf = NULL;
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+	png_free(png_ptr, png_ptr->prev_row);
+	png_ptr->prev_row = NULL;
+	png_free(png_ptr, png_ptr->sub_row);
+	png_ptr->sub_row = NULL;
+	png_free(png_ptr, png_ptr->up_row);
+	png_ptr->up_row = NULL;
+	png_free(png_ptr, png_ptr->avg_row);
+	png_ptr->avg_row = NULL;
+	png_free(png_ptr, png_ptr->paeth_row);
+	png_ptr->paeth_row = NULL;
+#endif
 }
 
 void /* PRIVATE */
@@ -56,6 +56,83 @@ local uLong adler32_combine_(uLong adler1, uLong adler2, z_off64_t len2);
 #  define MOD4(a) a %= BASE
 #endif
 
+#ifdef X86_SIMD
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+/* ========================================================================= */
+/* Sums 32 bytes per step: psadbw adds the bytes for the first sum, and
+ * pmaddubsw weights them by 32..1 for the second.  The second sum also
+ * collects 32 times the first sum as it was before each step, which is
+ * added at the end of each run of up to NMAX bytes.
+ */
+local X86_TARGET("ssse3") uLong adler32_ssse3(adler, sum2, buf, len)
+unsigned long adler;
+unsigned long sum2;
+const Bytef* buf;
+uInt len; {
+	const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+		24, 23, 22, 21, 20, 19, 18, 17);
+	const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+		8, 7, 6, 5, 4, 3, 2, 1);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+	unsigned blocks = len / 32;
+
+	len -= blocks * 32;
+	while (blocks) {
+		unsigned n = NMAX / 32;
+		__m128i v_ps, v_s1, v_s2;
+
+		if (n > blocks)
+			n = blocks;
+		blocks -= n;
+
+		v_ps = _mm_cvtsi32_si128((int)(adler * n));
+		v_s2 = _mm_cvtsi32_si128((int)sum2);
+		v_s1 = zero;
+		do {
+			__m128i bytes1 = _mm_loadu_si128((const __m128i*)buf);
+			__m128i bytes2 = _mm_loadu_si128((const __m128i*)(buf + 16));
+
+			v_ps = _mm_add_epi32(v_ps, v_s1);
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+			buf += 32;
+		}
+		while (--n);
+		v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+		v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+		adler += (unsigned)_mm_cvtsi128_si32(v_s1);
+		sum2 = (unsigned)_mm_cvtsi128_si32(v_s2);
+		MOD(adler);
+		MOD(sum2);
+	}
+
+	/* less than 32 bytes left */
+	if (len) {
+		if (len >= 16) {
+			len -= 16;
+			DO16(buf);
+			buf += 16;
+		}
+		while (len--) {
+			adler += *buf++;
+			sum2 += adler;
+		}
+		MOD(adler);
+		MOD(sum2);
+	}
+
+	return adler | (sum2 << 16);
+}
+#endif /* X86_SIMD */
+
 /* ========================================================================= */
 uLong ZEXPORT adler32(adler, buf, len)
 uLong adler;
@@ -95,6 +172,11 @@ uInt len; {
 		return adler | (sum2 << 16);
 	}
 
+#ifdef X86_SIMD
+	if (len >= 64 && (x86_cpu_features() & X86_CPU_SSSE3))
+		return adler32_ssse3(adler, sum2, buf, len);
+#endif /* X86_SIMD */
+
 	/* do length NMAX blocks -- requires just one modulo operation */
 	while (len >= NMAX) {
 		len -= NMAX;
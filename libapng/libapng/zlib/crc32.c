@@ -216,6 +216,83 @@ const unsigned long FAR * ZEXPORT get_crc_table() {
 #define DO1 crc = crc_table[0][((int)crc ^ (*buf++)) & 0xff] ^ (crc >> 8)
 #define DO8 DO1; DO1; DO1; DO1; DO1; DO1; DO1; DO1
 
+#ifdef X86_SIMD
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+/* ========================================================================= */
+/* Folds buf into crc (already inverted) 64 bytes at a time with carry-less
+ * multiplies, then 16 at a time, and reduces the remaining 128 bits to the
+ * 32 bit crc with a Barrett reduction.  len must be a multiple of 16 and at
+ * least 64.  The constants are powers of x modulo the bit-reflected crc
+ * polynomial, as in Intel's "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction".
+ */
+#define FOLD(x, k, next) \
+        x = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), \
+            _mm_clmulepi64_si128(x, k, 0x11)), next)
+
+local X86_TARGET("sse2,pclmul") unsigned crc32_pclmul(crc, buf, len)
+unsigned crc;
+const unsigned char FAR * buf;
+uInt len; {
+	const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+	__m128i k, x1, x2, x3, x4;
+
+	x1 = _mm_loadu_si128((const __m128i*)buf);
+	x2 = _mm_loadu_si128((const __m128i*)(buf + 16));
+	x3 = _mm_loadu_si128((const __m128i*)(buf + 32));
+	x4 = _mm_loadu_si128((const __m128i*)(buf + 48));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	buf += 64;
+	len -= 64;
+
+	/* x^(4*128+32) and x^(4*128-32) */
+	k = _mm_set_epi32(0x00000001, (int)0xc6e41596, 0x00000001, 0x54442bd4);
+	while (len >= 64) {
+		FOLD(x1, k, _mm_loadu_si128((const __m128i*)buf));
+		FOLD(x2, k, _mm_loadu_si128((const __m128i*)(buf + 16)));
+		FOLD(x3, k, _mm_loadu_si128((const __m128i*)(buf + 32)));
+		FOLD(x4, k, _mm_loadu_si128((const __m128i*)(buf + 48)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* x^(128+32) and x^(128-32) */
+	k = _mm_set_epi32(0x00000000, (int)0xccaa009e, 0x00000001, 0x751997d0);
+	FOLD(x1, k, x2);
+	FOLD(x1, k, x3);
+	FOLD(x1, k, x4);
+	while (len >= 16) {
+		FOLD(x1, k, _mm_loadu_si128((const __m128i*)buf));
+		buf += 16;
+		len -= 16;
+	}
+
+	/* 128 bits down to 64 */
+	x2 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x10), x2);
+
+	/* 64 bits down to 32, with x^64 */
+	k = _mm_set_epi32(0, 0, 0x00000001, 0x63cd6124);
+	x2 = _mm_and_si128(x1, mask32);
+	x1 = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(x1, _mm_clmulepi64_si128(x2, k, 0x00));
+
+	/* Barrett reduction with the polynomial and its quotient */
+	k = _mm_set_epi32(0x00000001, (int)0xf7011641, 0x00000001, (int)0xdb710641);
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+#undef FOLD
+#endif /* X86_SIMD */
+
 /* ========================================================================= */
 unsigned long ZEXPORT crc32(crc, buf, len)
 unsigned long crc;
@@ -228,6 +305,16 @@ uInt len; {
         make_crc_table();
 #endif /* DYNAMIC_CRC_TABLE */
 
+#ifdef X86_SIMD
+	if (len >= 64 && (x86_cpu_features() & X86_CPU_PCLMUL)) {
+		uInt n = len & ~15U;
+
+		crc = crc32_pclmul((unsigned)crc ^ 0xffffffffU, buf, n) ^ 0xffffffffUL;
+		buf += n;
+		len -= n;
+	}
+#endif /* X86_SIMD */
+
 #ifdef BYFOUR
 	if (sizeof(void*) == sizeof(ptrdiff_t)) {
 		u4 endian;
@@ -94,6 +94,7 @@ local int read_buf OF((z_streamp strm, Bytef *buf, unsigned size));
 #else
 local uInt longest_match OF((deflate_state *s, IPos cur_match));
 #endif
+local uInt compare258 OF((const Bytef *scan, const Bytef *match));
 
 #ifdef DEBUG
 local  void check_match OF((deflate_state *s, IPos start, IPos match,
@@ -162,12 +163,21 @@ struct static_tree_desc_s {
 #endif
 
 /* ===========================================================================
- * Update a hash value with the given input byte
- * IN  assertion: all calls to to UPDATE_HASH are made with consecutive
- *    input characters, so that a running hash key can be computed from the
- *    previous key instead of complete recalculation each time.
+ * Compute the hash of the MIN_MATCH bytes at str.  This is a multiplicative
+ * hash of the whole 24 bit key, taking the top hash_bits of the product.
+ * The old running shift-xor hash only kept the low bits of the first two
+ * bytes, so similar strings (such as pixels that differ only in alpha)
+ * landed on the same chain.  Equal hashes no longer imply equal third bytes,
+ * so longest_match() compares every byte.
+ * The assembler longest_match() versions rely on the old hash.
  */
-#define UPDATE_HASH(s,h,c) (h = (((h)<<s->hash_shift) ^ (c)) & s->hash_mask)
+#ifdef ASMV
+#  error "match.asm assumes the shift-xor hash"
+#endif
+#define HASH(s, str) \
+   (((((ulg)s->window[(str)] | ((ulg)s->window[(str)+1] << 8) | \
+       ((ulg)s->window[(str)+2] << 16)) * 0x9e3779b1UL) & 0xffffffffUL) >> \
+    (32 - s->hash_bits))
 
 
 /* ===========================================================================
@@ -176,18 +186,17 @@ struct static_tree_desc_s {
  * the previous length of the hash chain.
  * If this file is compiled with -DFASTEST, the compression level is forced
  * to 1, and no hash chains are maintained.
- * IN  assertion: all calls to to INSERT_STRING are made with consecutive
- *    input characters and the first MIN_MATCH bytes of str are valid
- *    (except for the last MIN_MATCH-1 bytes of the input file).
+ * IN  assertion: the first MIN_MATCH bytes of str are valid (except for the
+ *    last MIN_MATCH-1 bytes of the input file).
  */
 #ifdef FASTEST
 #define INSERT_STRING(s, str, match_head) \
-   (UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)]), \
+   (s->ins_h = (uInt)HASH(s, str), \
     match_head = s->head[s->ins_h], \
     s->head[s->ins_h] = (Pos)(str))
 #else
 #define INSERT_STRING(s, str, match_head) \
-   (UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)]), \
+   (s->ins_h = (uInt)HASH(s, str), \
     match_head = s->prev[(str) & s->w_mask] = s->head[s->ins_h], \
     s->head[s->ins_h] = (Pos)(str))
 #endif
@@ -281,9 +290,8 @@ int stream_size; {
 	s->hash_bits = memLevel + 7;
 	s->hash_size = 1 << s->hash_bits;
 	s->hash_mask = s->hash_size - 1;
-	s->hash_shift = ((s->hash_bits + MIN_MATCH - 1) / MIN_MATCH);
 
-	s->window = (Bytef*)ZALLOC(strm, s->w_size, 2*sizeof(Byte));
+	s->window = (Bytef*)ZALLOC(strm, 2*s->w_size + WIN_PAD, sizeof(Byte));
 	s->prev = (Posf*)ZALLOC(strm, s->w_size, sizeof(Pos));
 	s->head = (Posf*)ZALLOC(strm, s->hash_size, sizeof(Pos));
 
@@ -302,6 +310,7 @@ int stream_size; {
 		deflateEnd(strm);
 		return Z_MEM_ERROR;
 	}
+	zmemzero(s->window + 2*s->w_size, WIN_PAD);
 	s->d_buf = overlay + s->lit_bufsize / sizeof(ush);
 	s->l_buf = s->pending_buf + (1 + sizeof(ush)) * s->lit_bufsize;
 
@@ -341,11 +350,7 @@ uInt dictLength; {
 	s->block_start = (long)length;
 
 	/* Insert all strings in the hash table (except for the last two bytes).
-	 * s->lookahead stays null, so s->ins_h will be recomputed at the next
-	 * call of fill_window.
 	 */
-	s->ins_h = s->window[0];
-	UPDATE_HASH(s, s->ins_h, s->window[1]);
 	for (n = 0; n <= length - MIN_MATCH; n++) {
 		INSERT_STRING(s, n, hash_head);
 	}
@@ -955,7 +960,7 @@ z_streamp source; {
 	zmemcpy(ds, ss, sizeof(deflate_state));
 	ds->strm = dest;
 
-	ds->window = (Bytef*)ZALLOC(dest, ds->w_size, 2*sizeof(Byte));
+	ds->window = (Bytef*)ZALLOC(dest, 2*ds->w_size + WIN_PAD, sizeof(Byte));
 	ds->prev = (Posf*)ZALLOC(dest, ds->w_size, sizeof(Pos));
 	ds->head = (Posf*)ZALLOC(dest, ds->hash_size, sizeof(Pos));
 	overlay = (ushf*)ZALLOC(dest, ds->lit_bufsize, sizeof(ush)+2);
@@ -967,7 +972,7 @@ z_streamp source; {
 		return Z_MEM_ERROR;
 	}
 	/* following zmemcpy do not work for 16-bit MSDOS */
-	zmemcpy(ds->window, ss->window, ds->w_size * 2 * sizeof(Byte));
+	zmemcpy(ds->window, ss->window, (ds->w_size * 2 + WIN_PAD) * sizeof(Byte));
 	zmemcpy(ds->prev, ss->prev, ds->w_size * sizeof(Pos));
 	zmemcpy(ds->head, ss->head, ds->hash_size * sizeof(Pos));
 	zmemcpy(ds->pending_buf, ss->pending_buf, (uInt)ds->pending_buf_size);
@@ -1046,6 +1051,55 @@ deflate_state* s; {
 #endif
 }
 
+/* ===========================================================================
+ * Return the length of the common prefix of scan and match, at most
+ * MAX_MATCH.  With SSE2 this compares 16 bytes per step and finds the first
+ * difference from the compare mask with a bit scan.  It may read up to
+ * WIN_PAD bytes past scan+MAX_MATCH.
+ */
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  define COMPARE_SSE2
+#  include <emmintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  endif
+#endif
+
+local uInt compare258(scan, match)
+const Bytef* scan;
+const Bytef* match; {
+#ifdef COMPARE_SSE2
+	uInt len = 0;
+
+	do {
+		__m128i a = _mm_loadu_si128((const __m128i*)(scan + len));
+		__m128i b = _mm_loadu_si128((const __m128i*)(match + len));
+		unsigned diff = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xffff;
+
+		if (diff != 0) {
+#ifdef _MSC_VER
+			unsigned long first;
+			_BitScanForward(&first, diff);
+#else
+			unsigned first = (unsigned)__builtin_ctz(diff);
+#endif
+			len += (uInt)first;
+			return len < MAX_MATCH ? len : MAX_MATCH;
+		}
+		len += 16;
+	}
+	while (len < MAX_MATCH);
+	return MAX_MATCH;
+#else
+	const Bytef* start = scan;
+	const Bytef* strend = scan + MAX_MATCH;
+
+	while (scan < strend && *scan == *match)
+		scan++, match++;
+	return (uInt)(scan - start);
+#endif
+}
+
 #ifndef FASTEST
 /* ===========================================================================
  * Set match_start to the longest match starting at the given string and
@@ -1076,24 +1130,10 @@ IPos cur_match; /* current match */
 	 */
 	Posf* prev = s->prev;
 	uInt wmask = s->w_mask;
-
-#ifdef UNALIGNED_OK
-    /* Compare two bytes at a time. Note: this is not always beneficial.
-     * Try with and without -DUNALIGNED_OK to check.
-     */
-    register Bytef *strend = s->window + s->strstart + MAX_MATCH - 1;
-    register ush scan_start = *(ushf*)scan;
-    register ush scan_end   = *(ushf*)(scan+best_len-1);
-#else
-	register Bytef* strend = s->window + s->strstart + MAX_MATCH;
 	register Byte scan_end1 = scan[best_len - 1];
 	register Byte scan_end = scan[best_len];
-#endif
 
-	/* The code is optimized for HASH_BITS >= 8 and MAX_MATCH-2 multiple of 16.
-	 * It is easy to get rid of this optimization if necessary.
-	 */
-	Assert(s->hash_bits >= 8 && MAX_MATCH == 258, "Code too clever");
+	Assert(MAX_MATCH == 258, "Code too clever");
 
 	/* Do not waste too much time if we already have a good match: */
 	if (s->prev_length >= s->good_match) {
@@ -1111,91 +1151,26 @@ IPos cur_match; /* current match */
 		match = s->window + cur_match;
 
 		/* Skip to next match if the match length cannot increase
-		 * or if the match length is less than 2.  Note that the checks below
-		 * for insufficient lookahead only occur occasionally for performance
-		 * reasons.  Therefore uninitialized memory will be accessed, and
-		 * conditional jumps will be made that depend on those values.
-		 * However the length of the match is limited to the lookahead, so
-		 * the output of deflate is not affected by the uninitialized values.
+		 * or if the match length is less than 2.  Note that compare258()
+		 * only stops at MAX_MATCH, so uninitialized memory beyond the
+		 * lookahead may be compared.  However the length of the match is
+		 * limited to the lookahead, so the output of deflate is not affected
+		 * by the uninitialized values.
 		 */
-#if (defined(UNALIGNED_OK) && MAX_MATCH == 258)
-        /* This code assumes sizeof(unsigned short) == 2. Do not use
-         * UNALIGNED_OK if your compiler uses a different size.
-         */
-        if (*(ushf*)(match+best_len-1) != scan_end ||
-            *(ushf*)match != scan_start) continue;
-
-        /* It is not necessary to compare scan[2] and match[2] since they are
-         * always equal when the other bytes match, given that the hash keys
-         * are equal and that HASH_BITS >= 8. Compare 2 bytes at a time at
-         * strstart+3, +5, ... up to strstart+257. We check for insufficient
-         * lookahead only every 4th comparison; the 128th check will be made
-         * at strstart+257. If MAX_MATCH-2 is not a multiple of 8, it is
-         * necessary to put more guard bytes at the end of the window, or
-         * to check more often for insufficient lookahead.
-         */
-        Assert(scan[2] == match[2], "scan[2]?");
-        scan++, match++;
-        do {
-        } while (*(ushf*)(scan+=2) == *(ushf*)(match+=2) &&
-                 *(ushf*)(scan+=2) == *(ushf*)(match+=2) &&
-                 *(ushf*)(scan+=2) == *(ushf*)(match+=2) &&
-                 *(ushf*)(scan+=2) == *(ushf*)(match+=2) &&
-                 scan < strend);
-        /* The funny "do {}" generates better code on most compilers */
-
-        /* Here, scan <= window+strstart+257 */
-        Assert(scan <= s->window+(unsigned)(s->window_size-1), "wild scan");
-        if (*scan == *match) scan++;
-
-        len = (MAX_MATCH - 1) - (int)(strend-scan);
-        scan = strend - (MAX_MATCH-1);
-
-#else /* UNALIGNED_OK */
-
 		if (match[best_len] != scan_end ||
 			match[best_len - 1] != scan_end1 ||
 			*match != *scan ||
-			*++match != scan[1])
+			match[1] != scan[1])
 			continue;
 
-		/* The check at best_len-1 can be removed because it will be made
-		 * again later. (This heuristic is not always a win.)
-		 * It is not necessary to compare scan[2] and match[2] since they
-		 * are always equal when the other bytes match, given that
-		 * the hash keys are equal and that HASH_BITS >= 8.
-		 */
-		scan += 2, match++;
-		Assert(*scan == *match, "match[2]?");
-
-		/* We check for insufficient lookahead only every 8th comparison;
-		 * the 256th check will be made at strstart+258.
-		 */
-		do {
-		}
-		while (*++scan == *++match && *++scan == *++match &&
-			*++scan == *++match && *++scan == *++match &&
-			*++scan == *++match && *++scan == *++match &&
-			*++scan == *++match && *++scan == *++match &&
-			scan < strend);
-
-		Assert(scan <= s->window+(unsigned)(s->window_size-1), "wild scan");
-
-		len = MAX_MATCH - (int)(strend - scan);
-		scan = strend - MAX_MATCH;
-
-#endif /* UNALIGNED_OK */
+		len = (int)compare258(scan, match);
 
 		if (len > best_len) {
 			s->match_start = cur_match;
 			best_len = len;
 			if (len >= nice_match) break;
-#ifdef UNALIGNED_OK
-            scan_end = *(ushf*)(scan+best_len-1);
-#else
 			scan_end1 = scan[best_len - 1];
 			scan_end = scan[best_len];
-#endif
 		}
 	}
 	while ((cur_match = prev[cur_match & wmask]) > limit
@@ -1218,12 +1193,8 @@ local uInt longest_match(s, cur_match)
     register Bytef *scan = s->window + s->strstart; /* current string */
     register Bytef *match;                       /* matched string */
     register int len;                           /* length of current match */
-    register Bytef *strend = s->window + s->strstart + MAX_MATCH;
 
-    /* The code is optimized for HASH_BITS >= 8 and MAX_MATCH-2 multiple of 16.
-     * It is easy to get rid of this optimization if necessary.
-     */
-    Assert(s->hash_bits >= 8 && MAX_MATCH == 258, "Code too clever");
+    Assert(MAX_MATCH == 258, "Code too clever");
 
     Assert((ulg)s->strstart <= s->window_size-MIN_LOOKAHEAD, "need lookahead");
 
@@ -1235,28 +1206,7 @@ local uInt longest_match(s, cur_match)
      */
     if (match[0] != scan[0] || match[1] != scan[1]) return MIN_MATCH-1;
 
-    /* The check at best_len-1 can be removed because it will be made
-     * again later. (This heuristic is not always a win.)
-     * It is not necessary to compare scan[2] and match[2] since they
-     * are always equal when the other bytes match, given that
-     * the hash keys are equal and that HASH_BITS >= 8.
-     */
-    scan += 2, match += 2;
-    Assert(*scan == *match, "match[2]?");
-
-    /* We check for insufficient lookahead only every 8th comparison;
-     * the 256th check will be made at strstart+258.
-     */
-    do {
-    } while (*++scan == *++match && *++scan == *++match &&
-             *++scan == *++match && *++scan == *++match &&
-             *++scan == *++match && *++scan == *++match &&
-             *++scan == *++match && *++scan == *++match &&
-             scan < strend);
-
-    Assert(scan <= s->window+(unsigned)(s->window_size-1), "wild scan");
-
-    len = MAX_MATCH - (int)(strend - scan);
+    len = (int)compare258(scan, match);
 
     if (len < MIN_MATCH) return MIN_MATCH - 1;
 
@@ -1382,17 +1332,6 @@ deflate_state* s; {
 		n = read_buf(s->strm, s->window + s->strstart + s->lookahead, more);
 		s->lookahead += n;
 
-		/* Initialize the hash value now that we have some input: */
-		if (s->lookahead >= MIN_MATCH) {
-			s->ins_h = s->window[s->strstart];
-			UPDATE_HASH(s, s->ins_h, s->window[s->strstart+1]);
-#if MIN_MATCH != 3
-            Call UPDATE_HASH() MIN_MATCH-3 more times
-#endif
-		}
-		/* If the whole input has less than MIN_MATCH bytes, ins_h is garbage,
-		 * but this is not important since only literal bytes will be emitted.
-		 */
 	}
 	while (s->lookahead < MIN_LOOKAHEAD && s->strm->avail_in != 0);
 
@@ -1586,14 +1525,6 @@ int flush; {
 			{
 				s->strstart += s->match_length;
 				s->match_length = 0;
-				s->ins_h = s->window[s->strstart];
-				UPDATE_HASH(s, s->ins_h, s->window[s->strstart+1]);
-#if MIN_MATCH != 3
-                Call UPDATE_HASH() MIN_MATCH-3 more times
-#endif
-				/* If lookahead < MIN_MATCH, ins_h is garbage, but it does not
-				 * matter since it will be recomputed at next deflate call.
-				 */
 			}
 		}
 		else {
@@ -1744,8 +1675,7 @@ local block_state deflate_rle(s, flush)
 deflate_state* s;
 int flush; {
 	int bflush; /* set if current block must be flushed */
-	uInt prev; /* byte at distance one to match */
-	Bytef *scan, *strend; /* scan goes up to strend for length of run */
+	Bytef* scan; /* start of the run */
 
 	for (;;) {
 		/* Make sure that we always have enough lookahead, except
@@ -1763,21 +1693,11 @@ int flush; {
 		/* See how many times the previous byte repeats */
 		s->match_length = 0;
 		if (s->lookahead >= MIN_MATCH && s->strstart > 0) {
-			scan = s->window + s->strstart - 1;
-			prev = *scan;
-			if (prev == *++scan && prev == *++scan && prev == *++scan) {
-				strend = s->window + s->strstart + MAX_MATCH;
-				do {
-				}
-				while (prev == *++scan && prev == *++scan &&
-					prev == *++scan && prev == *++scan &&
-					prev == *++scan && prev == *++scan &&
-					prev == *++scan && prev == *++scan &&
-					scan < strend);
-				s->match_length = MAX_MATCH - (int)(strend - scan);
-				if (s->match_length > s->lookahead)
-					s->match_length = s->lookahead;
-			}
+			/* A run of the previous byte is a match at distance one */
+			scan = s->window + s->strstart;
+			s->match_length = compare258(scan, scan - 1);
+			if (s->match_length > s->lookahead)
+				s->match_length = s->lookahead;
 		}
 
 		/* Emit match if have run of MIN_MATCH or longer, else emit literal */
@@ -136,16 +136,9 @@ typedef struct internal_state {
 
 	uInt ins_h; /* hash index of string to be inserted */
 	uInt hash_size; /* number of elements in hash table */
-	uInt hash_bits; /* log2(hash_size) */
+	uInt hash_bits; /* log2(hash_size), the bits HASH() keeps of its product */
 	uInt hash_mask; /* hash_size-1 */
 
-	uInt hash_shift;
-	/* Number of bits by which ins_h must be shifted at each input
-	 * step. It must be such that after MIN_MATCH steps, the oldest
-	 * byte no longer takes part in the hash key, that is:
-	 *   hash_shift * MIN_MATCH >= hash_bits
-	 */
-
 	long block_start;
 	/* Window position at the beginning of the current output block. Gets
 	 * negative when the window is moved backwards.
@@ -289,6 +282,10 @@ typedef struct internal_state {
 /* Number of bytes after end of data in window to initialize in order to avoid
    memory checker errors from longest match routines */
 
+#define WIN_PAD 16
+/* Extra bytes allocated (and zeroed) after the window, so that compare258()
+   can read whole 16 byte blocks past strstart+MAX_MATCH */
+
 /* in trees.c */
 void ZLIB_INTERNAL _tr_init OF((deflate_state *s));
 int ZLIB_INTERNAL _tr_tally OF((deflate_state *s, unsigned dist, unsigned lc));
@@ -0,0 +1,199 @@
+/* deflatebench.c -- deflate/inflate throughput benchmark
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Compresses each input at a few levels and strategies, checks that it
+ * inflates back to the same bytes, and prints the throughput and ratio.
+ * Without file arguments it uses generated inputs: BGRA sprite frames
+ * (mostly runs of transparent pixels), PNG-filtered gradients and noise.
+ *
+ * Build it against the zlib sources without minigzip.c, e.g.
+ *    cc -O2 -o deflatebench deflatebench.c adler32.c compress.c crc32.c \
+ *       deflate.c infback.c inffast.c inflate.c inftrees.c trees.c zutil.c
+ *
+ * usage: deflatebench [-r repeats] [file ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "zlib.h"
+
+#define INPUT_SIZE (8L << 20)
+
+typedef struct {
+	const char* name;
+	unsigned char* data;
+	unsigned long size;
+} input_t;
+
+static unsigned long seed = 1;
+
+static unsigned rnd(void) {
+	seed = seed * 1103515245UL + 12345UL;
+	return (unsigned)(seed >> 16) & 0x7fff;
+}
+
+/* Sprite-like BGRA frames: a few opaque shapes over transparent pixels */
+static void make_sprites(unsigned char* p, unsigned long size) {
+	unsigned long i, w = 256;
+	memset(p, 0, size);
+	for (i = 0; i + 4 <= size; i += 4) {
+		unsigned long x = (i / 4) % w, y = (i / 4 / w) % w;
+		long dx = (long)x - 128, dy = (long)y - 128;
+		if (dx * dx + dy * dy < 60 * 60 || (x / 16 + y / 16) % 7 == 0) {
+			p[i] = (unsigned char)(x * 3);
+			p[i + 1] = (unsigned char)(y * 2);
+			p[i + 2] = (unsigned char)(x + y);
+			p[i + 3] = 255;
+		}
+	}
+}
+
+/* What a Sub-filtered photo row looks like: small deltas around zero */
+static void make_gradients(unsigned char* p, unsigned long size) {
+	unsigned long i;
+	for (i = 0; i < size; i++)
+		p[i] = (unsigned char)((rnd() % 9) - 4);
+}
+
+static void make_noise(unsigned char* p, unsigned long size) {
+	unsigned long i;
+	for (i = 0; i < size; i++)
+		p[i] = (unsigned char)rnd();
+}
+
+static int load_file(const char* path, input_t* in) {
+	FILE* f = fopen(path, "rb");
+	long size;
+	if (f == NULL) return 0;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	in->name = path;
+	in->size = (unsigned long)size;
+	in->data = (unsigned char*)malloc(in->size ? in->size : 1);
+	if (in->data == NULL || fread(in->data, 1, in->size, f) != in->size) {
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	return 1;
+}
+
+static double seconds(clock_t start) {
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void bench(const input_t* in, int level, int strategy, const char* sname, int repeats) {
+	uLong bound = compressBound(in->size);
+	unsigned char* packed = (unsigned char*)malloc(bound);
+	unsigned char* unpacked = (unsigned char*)malloc(in->size ? in->size : 1);
+	double best_deflate = 1e30, best_inflate = 1e30;
+	uLong packed_size = 0;
+	int r;
+
+	if (packed == NULL || unpacked == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (r = 0; r < repeats; r++) {
+		z_stream strm;
+		clock_t start;
+		double t;
+
+		memset(&strm, 0, sizeof(strm));
+		start = clock();
+		deflateInit2(&strm, level, Z_DEFLATED, 15, 8, strategy);
+		strm.next_in = in->data;
+		strm.avail_in = (uInt)in->size;
+		strm.next_out = packed;
+		strm.avail_out = (uInt)bound;
+		if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+			fprintf(stderr, "%s: deflate failed\n", in->name);
+			exit(1);
+		}
+		packed_size = strm.total_out;
+		deflateEnd(&strm);
+		t = seconds(start);
+		if (t < best_deflate) best_deflate = t;
+
+		memset(&strm, 0, sizeof(strm));
+		start = clock();
+		inflateInit(&strm);
+		strm.next_in = packed;
+		strm.avail_in = (uInt)packed_size;
+		strm.next_out = unpacked;
+		strm.avail_out = (uInt)in->size;
+		if (inflate(&strm, Z_FINISH) != Z_STREAM_END || strm.total_out != in->size) {
+			fprintf(stderr, "%s: inflate failed\n", in->name);
+			exit(1);
+		}
+		inflateEnd(&strm);
+		t = seconds(start);
+		if (t < best_inflate) best_inflate = t;
+	}
+
+	if (memcmp(unpacked, in->data, in->size) != 0) {
+		fprintf(stderr, "%s: round trip mismatch at level %d %s\n", in->name, level, sname);
+		exit(1);
+	}
+
+	printf("%-12s %5d %-9s %10lu %10lu %7.3f %9.1f %9.1f\n", in->name, level, sname,
+		in->size, packed_size, in->size ? (double)packed_size / in->size : 0.0,
+		best_deflate > 0 ? in->size / best_deflate / 1e6 : 0.0,
+		best_inflate > 0 ? in->size / best_inflate / 1e6 : 0.0);
+
+	free(packed);
+	free(unpacked);
+}
+
+int main(int argc, char** argv) {
+	static const int levels[] = {1, 6, 9};
+	static const int strategies[] = {Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE};
+	static const char* const snames[] = {"default", "filtered", "rle"};
+	input_t inputs[64];
+	int count = 0, repeats = 3, i, l, k;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			repeats = atoi(argv[++i]);
+			if (repeats < 1) repeats = 1;
+		}
+		else if (count < 64) {
+			if (!load_file(argv[i], &inputs[count])) {
+				fprintf(stderr, "cannot read %s\n", argv[i]);
+				return 1;
+			}
+			count++;
+		}
+	}
+
+	if (count == 0) {
+		inputs[0].name = "sprites";
+		inputs[1].name = "gradients";
+		inputs[2].name = "noise";
+		for (i = 0; i < 3; i++) {
+			inputs[i].size = INPUT_SIZE;
+			inputs[i].data = (unsigned char*)malloc(INPUT_SIZE);
+			if (inputs[i].data == NULL) return 1;
+		}
+		make_sprites(inputs[0].data, INPUT_SIZE);
+		make_gradients(inputs[1].data, INPUT_SIZE);
+		make_noise(inputs[2].data, INPUT_SIZE);
+		count = 3;
+	}
+
+	printf("zlib %s, best of %d\n", zlibVersion(), repeats);
+	printf("%-12s %5s %-9s %10s %10s %7s %9s %9s\n", "input", "level", "strategy",
+		"bytes", "packed", "ratio", "def MB/s", "inf MB/s");
+	for (i = 0; i < count; i++)
+		for (l = 0; l < 3; l++)
+			for (k = 0; k < 3; k++)
+				bench(&inputs[i], levels[l], strategies[k], snames[k], repeats);
+
+	for (i = 0; i < count; i++)
+		free(inputs[i].data);
+	return 0;
+}
@@ -469,7 +469,7 @@ void FAR * out_desc; {
 
 			case LEN:
 				/* use inflate_fast() if we have enough input and output */
-				if (have >= 6 && left >= 258) {
+				if (have >= INFLATE_FAST_MIN_HAVE && left >= INFLATE_FAST_MIN_LEFT) {
 					RESTORE();
 					if (state->whave < state->wsize)
 						state->whave = state->wsize - left;
@@ -10,25 +10,76 @@
 
 #ifndef ASMINF
 
-/* Allow machine dependent optimization for post-increment or pre-increment.
-   Based on testing to date,
-   Pre-increment preferred for:
-   - PowerPC G3 (Adler)
-   - MIPS R5000 (Randers-Pehrson)
-   Post-increment preferred for:
-   - none
-   No measurable difference:
-   - Pentium III (Anderson)
-   - M68060 (Nikl)
+/* Bit buffer: a 64 bit accumulator refilled a whole word at a time.  After a
+   refill it holds at least 56 bits, enough for a literal/length code, its
+   extra bits, a distance code and its extra bits (48 bits at most), so each
+   symbol needs only one refill.  Bits above "bits" may already hold the next
+   input bytes; they are ORed in again, unchanged, by the next refill.
  */
-#ifdef POSTINC
-#  define OFF 0
-#  define PUP(a) *(a)++
+typedef unsigned long long hold_t;
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__) || defined(_M_ARM64) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#  define LOAD64(p, w) zmemcpy(&(w), (p), 8)
 #else
-#  define OFF 1
-#  define PUP(a) *++(a)
+#  define LOAD64(p, w) \
+    (w = (hold_t)(p)[0] | ((hold_t)(p)[1] << 8) | ((hold_t)(p)[2] << 16) | \
+         ((hold_t)(p)[3] << 24) | ((hold_t)(p)[4] << 32) | \
+         ((hold_t)(p)[5] << 40) | ((hold_t)(p)[6] << 48) | \
+         ((hold_t)(p)[7] << 56))
 #endif
 
+#define REFILL() \
+    do { \
+        LOAD64(in, word); \
+        hold |= word << bits; \
+        in += (63 - bits) >> 3; \
+        bits |= 56; \
+    } while (0)
+
+/* Copy len bytes from earlier in the output, where from < out.  Copies whole
+   16 or 8 byte chunks when the distance allows, so up to 15 bytes past
+   out + len may be written.  Returns out + len.
+ */
+local unsigned char FAR *chunk_copy OF((unsigned char FAR *out,
+    const unsigned char FAR *from, unsigned len));
+
+local unsigned char FAR *chunk_copy(out, from, len)
+unsigned char FAR *out;
+const unsigned char FAR *from;
+unsigned len; {
+	unsigned dist = (unsigned)(out - from);
+	unsigned char FAR *stop = out + len;
+
+	if (dist >= 16) {
+		do {
+			zmemcpy(out, from, 16);
+			out += 16;
+			from += 16;
+		}
+		while (out < stop);
+	}
+	else if (dist >= 8) {
+		do {
+			zmemcpy(out, from, 8);
+			out += 8;
+			from += 8;
+		}
+		while (out < stop);
+	}
+	else if (dist == 1) {
+		memset(out, *from, len);
+	}
+	else {
+		do {
+			*out++ = *from++;
+		}
+		while (out < stop);
+	}
+	return stop;
+}
+
 /*
    Decode literal, length, and distance codes and write out the resulting
    literal and match bytes until either not enough input or output is
@@ -40,8 +91,8 @@
    Entry assumptions:
 
         state->mode == LEN
-        strm->avail_in >= 6
-        strm->avail_out >= 258
+        strm->avail_in >= INFLATE_FAST_MIN_HAVE
+        strm->avail_out >= INFLATE_FAST_MIN_LEFT
         start >= strm->avail_out
         state->bits < 8
 
@@ -53,16 +104,19 @@
 
    Notes:
 
-    - The maximum input bits used by a length/distance pair is 15 bits for the
-      length code, 5 bits for the length extra, 15 bits for the distance code,
-      and 13 bits for the distance extra.  This totals 48 bits, or six bytes.
-      Therefore if strm->avail_in >= 6, then there is enough input to avoid
-      checking for available input while decoding.
+    - Each pass of the loop refills the bit buffer at most twice, and each
+      refill reads eight bytes and consumes at most seven.  So if there are
+      INFLATE_FAST_MIN_HAVE (16) bytes of input at the top of the loop, there
+      is no need to check for available input while decoding.
 
     - The maximum bytes that a single length/distance pair can output is 258
-      bytes, which is the maximum length that can be coded.  inflate_fast()
-      requires strm->avail_out >= 258 for each loop to avoid checking for
-      output space.
+      bytes, which is the maximum length that can be coded.  A pass of the
+      loop may write two literals before it, and match copies may write up
+      to 15 bytes beyond it, so inflate_fast() requires strm->avail_out >=
+      INFLATE_FAST_MIN_LEFT (2 + 258 + 15) for each loop to avoid checking
+      for output space.
+
+    - Up to three literals are decoded per refill (15 bits each at most).
  */
 void ZLIB_INTERNAL inflate_fast(strm, start)
 z_streamp strm;
@@ -81,7 +135,8 @@ unsigned start; /* inflate()'s starting value for strm->avail_out */
 	unsigned whave; /* valid bytes in the window */
 	unsigned wnext; /* window write index */
 	unsigned char FAR * window; /* allocated sliding window, if wsize != 0 */
-	unsigned long hold; /* local strm->hold */
+	hold_t hold; /* local strm->hold */
+	hold_t word; /* next eight input bytes */
 	unsigned bits; /* local strm->bits */
 	const code FAR * lcode; /* local strm->lencode */
 	const code FAR * dcode; /* local strm->distcode */
@@ -96,11 +151,11 @@ unsigned start; /* inflate()'s starting value for strm->avail_out */
 
 	/* copy state to local variables */
 	state = (struct inflate_state FAR *)strm->state;
-	in = strm->next_in - OFF;
-	last = in + (strm->avail_in - 5);
-	out = strm->next_out - OFF;
+	in = strm->next_in;
+	last = in + (strm->avail_in - (INFLATE_FAST_MIN_HAVE - 1));
+	out = strm->next_out;
 	beg = out - (start - strm->avail_out);
-	end = out + (strm->avail_out - 257);
+	end = out + (strm->avail_out - (INFLATE_FAST_MIN_LEFT - 1));
 #ifdef INFLATE_STRICT
     dmax = state->dmax;
 #endif
@@ -118,13 +173,37 @@ unsigned start; /* inflate()'s starting value for strm->avail_out */
 	/* decode literals and length/distances until end-of-block or not enough
 	   input data or output space */
 	do {
-		if (bits < 15) {
-			hold += (unsigned long)(PUP(in)) << bits;
-			bits += 8;
-			hold += (unsigned long)(PUP(in)) << bits;
-			bits += 8;
-		}
+		REFILL();
 		here = lcode[hold & lmask];
+		if (here.op == 0) {
+			/* literals, while the bits last */
+			hold >>= here.bits;
+			bits -= here.bits;
+			Tracevv((stderr, here.val >= 0x20 && here.val < 0x7f ?
+				"inflate:         literal '%c'\n" :
+				"inflate:         literal 0x%02x\n", here.val));
+			*out++ = (unsigned char)(here.val);
+			here = lcode[hold & lmask];
+			if (here.op == 0) {
+				hold >>= here.bits;
+				bits -= here.bits;
+				Tracevv((stderr, here.val >= 0x20 && here.val < 0x7f ?
+					"inflate:         literal '%c'\n" :
+					"inflate:         literal 0x%02x\n", here.val));
+				*out++ = (unsigned char)(here.val);
+				here = lcode[hold & lmask];
+				if (here.op == 0) {
+					hold >>= here.bits;
+					bits -= here.bits;
+					Tracevv((stderr, here.val >= 0x20 && here.val < 0x7f ?
+						"inflate:         literal '%c'\n" :
+						"inflate:         literal 0x%02x\n", here.val));
+					*out++ = (unsigned char)(here.val);
+					continue;
+				}
+			}
+			REFILL();
+		}
 	dolen:
 		op = (unsigned)(here.bits);
 		hold >>= op;
@@ -135,28 +214,18 @@ unsigned start; /* inflate()'s starting value for strm->avail_out */
 			Tracevv((stderr, here.val >= 0x20 && here.val < 0x7f ?
 				"inflate:         literal '%c'\n" :
 				"inflate:         literal 0x%02x\n", here.val));
-			PUP(out) = (unsigned char)(here.val);
+			*out++ = (unsigned char)(here.val);
 		}
 		else if (op & 16) {
 			/* length base */
 			len = (unsigned)(here.val);
 			op &= 15; /* number of extra bits */
 			if (op) {
-				if (bits < op) {
-					hold += (unsigned long)(PUP(in)) << bits;
-					bits += 8;
-				}
 				len += (unsigned)hold & ((1U << op) - 1);
 				hold >>= op;
 				bits -= op;
 			}
 			Tracevv((stderr, "inflate:         length %u\n", len));
-			if (bits < 15) {
-				hold += (unsigned long)(PUP(in)) << bits;
-				bits += 8;
-				hold += (unsigned long)(PUP(in)) << bits;
-				bits += 8;
-			}
 			here = dcode[hold & dmask];
 		dodist:
 			op = (unsigned)(here.bits);
@@ -167,14 +236,6 @@ unsigned start; /* inflate()'s starting value for strm->avail_out */
 				/* distance base */
 				dist = (unsigned)(here.val);
 				op &= 15; /* number of extra bits */
-				if (bits < op) {
-					hold += (unsigned long)(PUP(in)) << bits;
-					bits += 8;
-					if (bits < op) {
-						hold += (unsigned long)(PUP(in)) << bits;
-						bits += 8;
-					}
-				}
 				dist += (unsigned)hold & ((1U << op) - 1);
 #ifdef INFLATE_STRICT
                 if (dist > dmax) {
@@ -200,36 +261,27 @@ unsigned start; /* inflate()'s starting value for strm->avail_out */
 #ifdef INFLATE_ALLOW_INVALID_DISTANCE_TOOFAR_ARRR
                         if (len <= op - whave) {
                             do {
-                                PUP(out) = 0;
+                                *out++ = 0;
                             } while (--len);
                             continue;
                         }
                         len -= op - whave;
                         do {
-                            PUP(out) = 0;
+                            *out++ = 0;
                         } while (--op > whave);
                         if (op == 0) {
                             from = out - dist;
                             do {
-                                PUP(out) = PUP(from);
+                                *out++ = *from++;
                             } while (--len);
                             continue;
                         }
 #endif
 					}
-					from = window - OFF;
+					from = window;
 					if (wnext == 0) {
 						/* very common case */
 						from += wsize - op;
-						if (op < len) {
-							/* some from window */
-							len -= op;
-							do {
-								PUP(out) = PUP(from);
-							}
-							while (--op);
-							from = out - dist; /* rest from output */
-						}
 					}
 					else if (wnext < op) {
 						/* wrap around window */
@@ -238,63 +290,31 @@ unsigned start; /* inflate()'s starting value for strm->avail_out */
 						if (op < len) {
 							/* some from end of window */
 							len -= op;
-							do {
-								PUP(out) = PUP(from);
-							}
-							while (--op);
-							from = window - OFF;
-							if (wnext < len) {
-								/* some from start of window */
-								op = wnext;
-								len -= op;
-								do {
-									PUP(out) = PUP(from);
-								}
-								while (--op);
-								from = out - dist; /* rest from output */
-							}
+							zmemcpy(out, from, op);
+							out += op;
+							from = window;
+							op = wnext; /* then from start of window */
 						}
 					}
 					else {
 						/* contiguous in window */
 						from += wnext - op;
-						if (op < len) {
-							/* some from window */
-							len -= op;
-							do {
-								PUP(out) = PUP(from);
-							}
-							while (--op);
-							from = out - dist; /* rest from output */
-						}
 					}
-					while (len > 2) {
-						PUP(out) = PUP(from);
-						PUP(out) = PUP(from);
-						PUP(out) = PUP(from);
-						len -= 3;
+					if (op < len) {
+						/* some from window, rest from output */
+						len -= op;
+						zmemcpy(out, from, op);
+						out += op;
+						out = chunk_copy(out, out - dist, len);
 					}
-					if (len) {
-						PUP(out) = PUP(from);
-						if (len > 1)
-							PUP(out) = PUP(from);
+					else {
+						zmemcpy(out, from, len);
+						out += len;
 					}
 				}
 				else {
-					from = out - dist; /* copy direct from output */
-					do {
-						/* minimum length is three */
-						PUP(out) = PUP(from);
-						PUP(out) = PUP(from);
-						PUP(out) = PUP(from);
-						len -= 3;
-					}
-					while (len > 2);
-					if (len) {
-						PUP(out) = PUP(from);
-						if (len > 1)
-							PUP(out) = PUP(from);
-					}
+					/* copy direct from output */
+					out = chunk_copy(out, out - dist, len);
 				}
 			}
 			else if ((op & 64) == 0) {
@@ -334,11 +354,13 @@ unsigned start; /* inflate()'s starting value for strm->avail_out */
 	hold &= (1U << bits) - 1;
 
 	/* update state and return */
-	strm->next_in = in + OFF;
-	strm->next_out = out + OFF;
-	strm->avail_in = (unsigned)(in < last ? 5 + (last - in) : 5 - (in - last));
-	strm->avail_out = (unsigned)(out < end ? 257 + (end - out) : 257 - (out - end));
-	state->hold = hold;
+	strm->next_in = in;
+	strm->next_out = out;
+	strm->avail_in = (unsigned)(in < last ? (INFLATE_FAST_MIN_HAVE - 1) + (last - in) :
+		(INFLATE_FAST_MIN_HAVE - 1) - (in - last));
+	strm->avail_out = (unsigned)(out < end ? (INFLATE_FAST_MIN_LEFT - 1) + (end - out) :
+		(INFLATE_FAST_MIN_LEFT - 1) - (out - end));
+	state->hold = (unsigned long)hold;
 	state->bits = bits;
 	return;
 }
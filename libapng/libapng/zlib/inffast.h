@@ -8,4 +8,12 @@
    subject to change. Applications should only use zlib.h.
  */
 
+/* inflate_fast() reads the input eight bytes at a time and copies matches in
+   chunks of up to 16 bytes, so inflate() only calls it with at least this
+   much input and output space available: one pass of its loop writes up to
+   two literals and a 258 byte match, and the match's last chunk may write
+   15 bytes past it */
+#define INFLATE_FAST_MIN_HAVE 16
+#define INFLATE_FAST_MIN_LEFT (2 + 258 + 15)
+
 void ZLIB_INTERNAL inflate_fast OF((z_streamp strm, unsigned start));
@@ -1002,7 +1002,7 @@ int flush; {
 			case LEN_:
 				state->mode = LEN;
 			case LEN:
-				if (have >= 6 && left >= 258) {
+				if (have >= INFLATE_FAST_MIN_HAVE && left >= INFLATE_FAST_MIN_LEFT) {
 					RESTORE();
 					inflate_fast(strm, out);
 					LOAD();
@@ -0,0 +1,579 @@
+/* zlibcheck.c -- checks for the SIMD checksums and the fast inflate path
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * crc32() and adler32() hand 64 bytes or more to PCLMULQDQ and SSSE3 code
+ * when the CPU has them.  Each checksum is compared with a bitwise reference
+ * and with zlib's own table code (the same data fed in pieces under 64
+ * bytes) over lengths around every block and NMAX boundary, unaligned
+ * starts and split calls.
+ *
+ * inflate_fast() is checked by inflating known streams and round trips of
+ * data chosen for its edge cases: distance 1 runs and short overlapping
+ * distances that the chunked copies must handle, distances that reach back
+ * into the window or a preset dictionary, input and output buffers that
+ * end anywhere around the fast path limits, and a stream of the longest
+ * passes the fast path can make.  Output buffers are allocated at the size
+ * handed to inflate(), so a memory checker catches writes past avail_out;
+ * "make check" in libapng also runs an AddressSanitizer build.
+ * inflateBack() is run on the same streams.
+ *
+ * Build it against the zlib sources without minigzip.c, e.g.
+ *    cc -O2 -o zlibcheck zlibcheck.c adler32.c compress.c crc32.c \
+ *       deflate.c infback.c inffast.c inflate.c inftrees.c trees.c zutil.c
+ *
+ * usage: zlibcheck
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zlib.h"
+
+#define MAX_LEN (3L << 20)
+
+static unsigned long seed = 1;
+static int failures = 0;
+
+static unsigned rnd(void) {
+	seed = seed * 1103515245UL + 12345UL;
+	return (unsigned)(seed >> 16) & 0x7fff;
+}
+
+static void fail(const char* what, unsigned long len, unsigned offset) {
+	if (failures++ < 20)
+		printf("mismatch: %s, length %lu, offset %u\n", what, len, offset);
+}
+
+static void* alloc(unsigned long size) {
+	void* p = malloc(size ? size : 1);
+	if (p == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(2);
+	}
+	return p;
+}
+
+/* ===========================================================================
+ * Checksums
+ */
+
+static unsigned long crc_bitwise(unsigned long crc, const unsigned char* p, unsigned long len) {
+	int k;
+
+	crc = ~crc & 0xffffffffUL;
+	while (len--) {
+		crc ^= *p++;
+		for (k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xedb88320UL & (0UL - (crc & 1)));
+	}
+	return ~crc & 0xffffffffUL;
+}
+
+static unsigned long adler_bytewise(unsigned long adler, const unsigned char* p, unsigned long len) {
+	unsigned long a = adler & 0xffff, b = adler >> 16;
+
+	while (len--) {
+		a = (a + *p++) % 65521UL;
+		b = (b + a) % 65521UL;
+	}
+	return (b << 16) | a;
+}
+
+/* zlib's table code: no call is long enough for the SIMD path */
+static unsigned long crc_table_code(const unsigned char* p, unsigned long len) {
+	unsigned long crc = crc32(0L, Z_NULL, 0);
+
+	while (len > 0) {
+		uInt n = len < 63 ? (uInt)len : 63;
+		crc = crc32(crc, p, n);
+		p += n;
+		len -= n;
+	}
+	return crc;
+}
+
+static unsigned long adler_table_code(const unsigned char* p, unsigned long len) {
+	unsigned long adler = adler32(0L, Z_NULL, 0);
+
+	while (len > 0) {
+		uInt n = len < 63 ? (uInt)len : 63;
+		adler = adler32(adler, p, n);
+		p += n;
+		len -= n;
+	}
+	return adler;
+}
+
+/* Random split points, so that SIMD calls start from any running value */
+static void check_pieces(const unsigned char* p, unsigned long len, unsigned offset,
+                         unsigned long crc, unsigned long adler) {
+	unsigned long c = crc32(0L, Z_NULL, 0), a = adler32(0L, Z_NULL, 0);
+	unsigned long done = 0;
+
+	while (done < len) {
+		unsigned long n = (rnd() & 1) ? rnd() % 80 : (unsigned long)rnd() * 8;
+		if (n > len - done)
+			n = len - done;
+		c = crc32(c, p + done, (uInt)n);
+		a = adler32(a, p + done, (uInt)n);
+		done += n;
+	}
+	if (c != crc)
+		fail("crc32 in pieces", len, offset);
+	if (a != adler)
+		fail("adler32 in pieces", len, offset);
+}
+
+static void check_checksums(void) {
+	static const unsigned long lengths[] = {
+		0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 79, 80, 95,
+		96, 127, 128, 129, 255, 256, 257, 1000, 4095, 4096, 4097,
+		5551, 5552, 5553, 5552 * 2 - 1, 5552 * 2, 5552 * 2 + 1, 65536 + 7, 1L << 20, MAX_LEN - 16
+	};
+	unsigned char* buf = (unsigned char*)alloc(MAX_LEN + 16);
+	unsigned long i, len, crc, adler;
+	unsigned offset;
+	int fill, k, runs = 0;
+
+	for (fill = 0; fill < 3; fill++) {
+		/* random bytes, all 0xff (the largest sums), all 0 */
+		for (i = 0; i < MAX_LEN + 16; i++)
+			buf[i] = fill == 0 ? (unsigned char)rnd() : fill == 1 ? 0xff : 0;
+
+		for (k = 0; k < (int)(sizeof(lengths) / sizeof(lengths[0])) + 40; k++) {
+			len = k < (int)(sizeof(lengths) / sizeof(lengths[0])) ? lengths[k] :
+				(unsigned long)rnd() * (rnd() % 64) % MAX_LEN;
+			offset = (unsigned)(k * 7 + fill) % 16;
+
+			crc = crc32(0L, buf + offset, (uInt)len);
+			adler = adler32(1L, buf + offset, (uInt)len);
+			if (crc != crc_bitwise(0, buf + offset, len) || crc != crc_table_code(buf + offset, len))
+				fail("crc32", len, offset);
+			if (adler != adler_bytewise(1, buf + offset, len) || adler != adler_table_code(buf + offset, len))
+				fail("adler32", len, offset);
+			check_pieces(buf + offset, len, offset, crc, adler);
+			runs++;
+		}
+	}
+
+	/* every offset and every length around the 16 byte blocks */
+	for (offset = 0; offset < 16; offset++)
+		for (len = 0; len < 300; len++) {
+			if (crc32(0L, buf + offset, (uInt)len) != crc_bitwise(0, buf + offset, len))
+				fail("crc32", len, offset);
+			if (adler32(1L, buf + offset, (uInt)len) != adler_bytewise(1, buf + offset, len))
+				fail("adler32", len, offset);
+			runs++;
+		}
+
+	free(buf);
+	printf("checksums: %d buffers\n", runs);
+}
+
+/* ===========================================================================
+ * Inflate
+ */
+
+/* Streams made by another deflate implementation, with their output */
+typedef struct {
+	const char* name;
+	const unsigned char* stream;
+	unsigned len;
+	unsigned long size;
+	unsigned long crc;
+} known_t;
+
+static const unsigned char run_stream[] = {
+	0x78, 0xda, 0x4b, 0x4c, 0x1c, 0x05, 0xa3, 0x60, 0x14, 0x0c, 0x77, 0x00, 0x00, 0xf9, 0xd8, 0x7a, 0xf8
+};
+
+static const unsigned char period3_stream[] = {
+	0x78, 0x9c, 0x4b, 0x4c, 0x4a, 0x4e, 0x1c, 0x45, 0xa3, 0x68, 0x14, 0x8d, 0xa2, 0x51, 0x34, 0x8a,
+	0x46, 0xd1, 0x28, 0x22, 0x84, 0x00, 0x9b, 0x8d, 0x24, 0x16
+};
+
+static const unsigned char period13_stream[] = {
+	0x78, 0x9c, 0x63, 0x50, 0xf5, 0xca, 0x9f, 0xb2, 0xf3, 0x1e, 0xb3, 0x86, 0x6f, 0xd1, 0xf4, 0x3d,
+	0x0c, 0xa3, 0x9c, 0x51, 0xce, 0x28, 0x67, 0x94, 0x33, 0xca, 0x19, 0xe5, 0x8c, 0x72, 0x06, 0x9e,
+	0x03, 0x00, 0xd0, 0x15, 0x17, 0x32
+};
+
+static const known_t known[] = {
+	{"1000 x 'a', distance 1", run_stream, sizeof(run_stream), 1000, 0x9a38da03UL},
+	{"'abc' x 700, distance 3", period3_stream, sizeof(period3_stream), 2100, 0x42ad31e8UL},
+	{"13 byte pattern x 150, distance 13", period13_stream, sizeof(period13_stream), 1950, 0x5e168126UL}
+};
+
+/* Inflates with the input and output handed over in chunks of the given
+ * sizes, or of random sizes when a size is 0; returns the inflate result.
+ */
+static int inflate_chunked(const unsigned char* in, unsigned long in_len, unsigned char* out,
+                           unsigned long out_cap, unsigned long* out_len, int window_bits,
+                           const unsigned char* dict, unsigned dict_len, unsigned in_chunk, unsigned out_chunk) {
+	z_stream strm;
+	int ret;
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, window_bits) != Z_OK)
+		return Z_MEM_ERROR;
+	if (dict != NULL && window_bits < 0)
+		inflateSetDictionary(&strm, dict, dict_len);
+
+	strm.next_in = (Bytef*)in;
+	strm.next_out = out;
+	do {
+		unsigned long in_left = in_len - (unsigned long)(strm.next_in - in);
+		unsigned long out_left = out_cap - (unsigned long)(strm.next_out - out);
+		unsigned long n = in_chunk ? in_chunk : 1 + rnd() % 40;
+		unsigned long m = out_chunk ? out_chunk : 1 + rnd() % 600;
+
+		strm.avail_in = (uInt)(n < in_left ? n : in_left);
+		strm.avail_out = (uInt)(m < out_left ? m : out_left);
+		ret = inflate(&strm, Z_NO_FLUSH);
+		if (ret == Z_NEED_DICT && dict != NULL) {
+			inflateSetDictionary(&strm, dict, dict_len);
+			ret = Z_OK;
+		}
+		if (ret == Z_BUF_ERROR && (in_left > 0 && out_left > 0))
+			ret = Z_OK;
+	} while (ret == Z_OK);
+
+	*out_len = strm.total_out;
+	inflateEnd(&strm);
+	return ret;
+}
+
+typedef struct {
+	const unsigned char* in;
+	unsigned long in_len;
+	unsigned long in_pos;
+	unsigned char* out;
+	unsigned long out_cap;
+	unsigned long out_len;
+} back_t;
+
+static unsigned back_in(void FAR* desc, unsigned char FAR* FAR* buf) {
+	back_t* b = (back_t*)desc;
+	unsigned n = 1 + rnd() % 40;
+
+	if (n > b->in_len - b->in_pos)
+		n = (unsigned)(b->in_len - b->in_pos);
+	*buf = (unsigned char*)b->in + b->in_pos;
+	b->in_pos += n;
+	return n;
+}
+
+static int back_out(void FAR* desc, unsigned char FAR* buf, unsigned len) {
+	back_t* b = (back_t*)desc;
+
+	if (len > b->out_cap - b->out_len)
+		return 1;
+	memcpy(b->out + b->out_len, buf, len);
+	b->out_len += len;
+	return 0;
+}
+
+/* inflateBack() on a raw deflate stream */
+static int inflate_back(const unsigned char* in, unsigned long in_len, unsigned char* out,
+                        unsigned long out_cap, unsigned long* out_len) {
+	static unsigned char window[32768];
+	z_stream strm;
+	back_t b;
+	int ret;
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateBackInit(&strm, 15, window) != Z_OK)
+		return Z_MEM_ERROR;
+	b.in = in;
+	b.in_len = in_len;
+	b.in_pos = 0;
+	b.out = out;
+	b.out_cap = out_cap;
+	b.out_len = 0;
+	ret = inflateBack(&strm, back_in, &b, back_out, &b);
+	inflateBackEnd(&strm);
+	*out_len = b.out_len;
+	return ret;
+}
+
+/* Inflates into output buffers allocated at exactly the size handed to each
+ * inflate() call, out_chunk bytes or random sizes when it is 0, so that a
+ * memory checker catches any write past avail_out; returns the inflate result.
+ */
+static int inflate_exact(const unsigned char* in, unsigned long in_len, unsigned char* out,
+                         unsigned long out_cap, unsigned long* out_len, unsigned out_chunk) {
+	z_stream strm;
+	int ret;
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, -15) != Z_OK)
+		return Z_MEM_ERROR;
+
+	strm.next_in = (Bytef*)in;
+	strm.avail_in = (uInt)in_len;
+	do {
+		unsigned long out_left = out_cap - strm.total_out;
+		unsigned long m = out_chunk ? out_chunk : 1 + rnd() % 600;
+		unsigned char* buf;
+
+		if (m > out_left)
+			m = out_left;
+		buf = (unsigned char*)alloc(m);
+		strm.next_out = buf;
+		strm.avail_out = (uInt)m;
+		ret = inflate(&strm, Z_NO_FLUSH);
+		memcpy(out + (out_cap - out_left), buf, m - strm.avail_out);
+		free(buf);
+		if (ret == Z_BUF_ERROR && out_left > 0)
+			ret = Z_OK;
+	} while (ret == Z_OK);
+
+	*out_len = strm.total_out;
+	inflateEnd(&strm);
+	return ret;
+}
+
+static void check_known(unsigned char* out, unsigned long cap) {
+	unsigned long len;
+	unsigned k, in_chunk, out_chunk;
+	int ret;
+
+	for (k = 0; k < sizeof(known) / sizeof(known[0]); k++)
+		for (in_chunk = 0; in_chunk <= 17; in_chunk += 17)
+			for (out_chunk = 0; out_chunk <= 275; out_chunk += 275) {
+				ret = inflate_chunked(known[k].stream, known[k].len, out, cap, &len, 15, NULL, 0,
+				                      in_chunk ? in_chunk : known[k].len, out_chunk ? out_chunk : (unsigned)cap);
+				if (ret != Z_STREAM_END || len != known[k].size || crc32(0L, out, (uInt)len) != known[k].crc)
+					fail(known[k].name, known[k].size, in_chunk * 1000 + out_chunk);
+			}
+}
+
+/* Data for the inflate_fast() edge cases */
+static unsigned long make_input(int kind, unsigned char* p, unsigned long size) {
+	unsigned long i, j, n, period;
+
+	switch (kind) {
+	case 0: /* runs of one byte: distance 1 */
+		for (i = 0; i < size; i += n) {
+			unsigned char c = (unsigned char)rnd();
+			n = 1 + rnd() % 700;
+			if (n > size - i)
+				n = size - i;
+			memset(p + i, c, n);
+		}
+		break;
+	case 1: /* short periods, so that matches overlap their own output */
+		for (i = 0; i < size; ) {
+			period = 2 + rnd() % 39;
+			n = period + rnd() % 600;
+			if (n > size - i)
+				n = size - i;
+			for (j = 0; j < n; j++, i++)
+				p[i] = j < period ? (unsigned char)rnd() : p[i - period];
+		}
+		break;
+	case 2: /* copies from up to 32K back, which a small output buffer has left in the window */
+		for (i = 0; i < size && i < 4096; i++)
+			p[i] = (unsigned char)rnd();
+		for (; i < size; i += n) {
+			unsigned long dist = 1 + (((unsigned long)rnd() << 15) | rnd()) % (i < 32768 ? i : 32768);
+			if (rnd() % 4 == 0) {
+				p[i] = (unsigned char)rnd();
+				n = 1;
+				continue;
+			}
+			n = 3 + rnd() % 256;
+			if (n > size - i)
+				n = size - i;
+			for (j = 0; j < n; j++)
+				p[i + j] = p[i + j - dist];
+		}
+		break;
+	default: /* 4 byte pixels, mostly transparent, like sprite frames */
+		memset(p, 0, size);
+		for (i = 0; i + 4 <= size; i += 4)
+			if ((i / 4) % 97 < 40 + (i / 388) % 17) {
+				p[i] = (unsigned char)(i >> 4);
+				p[i + 1] = (unsigned char)(i >> 9);
+				p[i + 2] = 0x80;
+				p[i + 3] = 0xff;
+			}
+		break;
+	}
+	return size;
+}
+
+static void check_round_trips(unsigned char* out, unsigned long cap) {
+	static const int levels[] = {1, 6, 9};
+	static const int strategies[] = {Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE, Z_FIXED};
+	static const int windows[] = {15, 12, 9};
+	static const unsigned in_chunks[] = {0, 1, 15, 16, 17, 1 << 20};
+	static const unsigned out_chunks[] = {0, 1, 258, 274, 275, 276, 1 << 20};
+	unsigned long size = 200000;
+	unsigned char* data = (unsigned char*)alloc(size);
+	unsigned long zcap = compressBound(size) + 64;
+	unsigned char* z = (unsigned char*)alloc(zcap);
+	unsigned long len, zlen;
+	int kind, l, s, w, k, ret, runs = 0;
+	z_stream strm;
+
+	for (kind = 0; kind < 4; kind++) {
+		make_input(kind, data, size);
+		for (l = 0; l < 3; l++)
+			for (s = 0; s < 4; s++)
+				for (w = 0; w < 3; w++) {
+					/* raw deflate, so that inflateBack() can take it too */
+					memset(&strm, 0, sizeof(strm));
+					deflateInit2(&strm, levels[l], Z_DEFLATED, -windows[w], 8, strategies[s]);
+					strm.next_in = data;
+					strm.avail_in = (uInt)size;
+					strm.next_out = z;
+					strm.avail_out = (uInt)zcap;
+					ret = deflate(&strm, Z_FINISH);
+					zlen = strm.total_out;
+					deflateEnd(&strm);
+					if (ret != Z_STREAM_END) {
+						fail("deflate", size, kind);
+						continue;
+					}
+
+					/* output buffers of exactly the size given: the fast path runs up to their end */
+					ret = inflate_exact(z, zlen, out, size, &len, 0);
+					if (ret != Z_STREAM_END || len != size || memcmp(out, data, size) != 0)
+						fail("inflate into exact buffers", size, kind);
+
+					for (k = 0; k < 7; k++) {
+						ret = inflate_chunked(z, zlen, out, cap, &len, -15, NULL, 0, in_chunks[k % 6], out_chunks[k]);
+						if (ret != Z_STREAM_END || len != size || memcmp(out, data, size) != 0)
+							fail("inflate in chunks", size, (unsigned)(kind * 100 + k));
+					}
+
+					ret = inflate_back(z, zlen, out, cap, &len);
+					if (ret != Z_STREAM_END || len != size || memcmp(out, data, size) != 0)
+						fail("inflateBack", size, kind);
+					runs++;
+				}
+	}
+
+	free(data);
+	free(z);
+	printf("inflate: %d round trips\n", runs);
+}
+
+/* Matches that reach into a preset dictionary, and the error without it */
+static void check_dictionary(unsigned char* out, unsigned long cap) {
+	unsigned char dict[32768], data[8192], z[16384];
+	unsigned long len, i;
+	z_stream strm;
+	int ret;
+
+	for (i = 0; i < sizeof(dict); i++)
+		dict[i] = (unsigned char)rnd();
+	for (i = 0; i < sizeof(data); i += 64)
+		memcpy(data + i, dict + (rnd() * 7919UL) % (sizeof(dict) - 64), 64);
+
+	memset(&strm, 0, sizeof(strm));
+	deflateInit2(&strm, 9, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	deflateSetDictionary(&strm, dict, sizeof(dict));
+	strm.next_in = data;
+	strm.avail_in = sizeof(data);
+	strm.next_out = z;
+	strm.avail_out = sizeof(z);
+	deflate(&strm, Z_FINISH);
+	deflateEnd(&strm);
+
+	ret = inflate_chunked(z, strm.total_out, out, cap, &len, -15, dict, sizeof(dict), 0, 0);
+	if (ret != Z_STREAM_END || len != sizeof(data) || memcmp(out, data, sizeof(data)) != 0)
+		fail("inflate with a dictionary", sizeof(data), 0);
+
+	ret = inflate_chunked(z, strm.total_out, out, cap, &len, -15, NULL, 0, 1 << 20, 1 << 20);
+	if (ret != Z_DATA_ERROR)
+		fail("inflate without the dictionary", sizeof(data), 0);
+	printf("inflate: dictionary distances\n");
+}
+
+/* Writes a fixed Huffman code, most significant bit first */
+static void put_code(unsigned char* z, unsigned long* bit, unsigned code, int n) {
+	while (n--) {
+		if ((code >> n) & 1)
+			z[*bit >> 3] |= (unsigned char)(1 << (*bit & 7));
+		++*bit;
+	}
+}
+
+/* Writes extra bits, least significant bit first */
+static void put_bits(unsigned char* z, unsigned long* bit, unsigned value, int n) {
+	while (n--) {
+		if (value & 1)
+			z[*bit >> 3] |= (unsigned char)(1 << (*bit & 7));
+		value >>= 1;
+		++*bit;
+	}
+}
+
+static void put_literal(unsigned char* z, unsigned long* bit, unsigned c) {
+	if (c < 144)
+		put_code(z, bit, 0x30 + c, 8);
+	else
+		put_code(z, bit, 0x190 + c - 144, 9);
+}
+
+/* The most one pass of inflate_fast() writes: two literals and then a 258
+ * byte match at distance 16, whose last chunk runs past the match.  The
+ * stream repeats that, and is inflated into exact buffers of every size
+ * around one repeat, so that some pass starts with the least output space
+ * the fast path is entered with.
+ */
+static void check_longest_pass(unsigned char* out, unsigned long cap) {
+	const unsigned repeats = 200;
+	unsigned long size = 16 + repeats * 260UL, zcap = size + 64, bit = 0, len, i;
+	unsigned char* data = (unsigned char*)alloc(size);
+	unsigned char* z = (unsigned char*)alloc(zcap);
+	unsigned r, m;
+	int ret;
+
+	memset(z, 0, zcap);
+	put_bits(z, &bit, 1, 1);    /* last block */
+	put_bits(z, &bit, 1, 2);    /* fixed Huffman codes */
+	for (i = 0; i < 16; i++) {
+		data[i] = (unsigned char)rnd();
+		put_literal(z, &bit, data[i]);
+	}
+	for (r = 0; r < repeats; r++) {
+		data[i] = (unsigned char)rnd();
+		put_literal(z, &bit, data[i++]);
+		data[i] = (unsigned char)rnd();
+		put_literal(z, &bit, data[i++]);
+		for (m = 0; m < 258; m++, i++)
+			data[i] = data[i - 16];
+		put_code(z, &bit, 0xc5, 8);    /* length 258 */
+		put_code(z, &bit, 7, 5);       /* distance 13 to 16 */
+		put_bits(z, &bit, 16 - 13, 2);
+	}
+	put_code(z, &bit, 0, 7);           /* end of block */
+
+	for (m = 250; m <= 530; m++) {
+		ret = inflate_exact(z, (bit + 7) >> 3, out, cap, &len, m);
+		if (ret != Z_STREAM_END || len != size || memcmp(out, data, size) != 0)
+			fail("two literals and a 258 byte match", size, m);
+	}
+
+	free(data);
+	free(z);
+	printf("inflate: longest fast path pass\n");
+}
+
+int main(void) {
+	unsigned long cap = 1L << 20;
+	unsigned char* out = (unsigned char*)alloc(cap);
+
+	check_checksums();
+	check_known(out, cap);
+	check_round_trips(out, cap);
+	check_dictionary(out, cap);
+	check_longest_pass(out, cap);
+	free(out);
+
+	printf(failures ? "FAILED: %d mismatches\n" : "passed: zlib checksums and inflate\n", failures);
+	return failures != 0;
+}
@@ -321,3 +321,36 @@ voidpf ptr; {
 }
 
 #endif /* MY_ZCALLOC */
+
+
+#ifdef X86_SIMD
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#else
+#  include <cpuid.h>
+#endif
+
+int ZLIB_INTERNAL x86_cpu_features() {
+	static volatile int features = -1;
+
+	if (features < 0) {
+		int found = 0;
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuid(regs, 1);
+		if (regs[2] & (1 << 9)) found |= X86_CPU_SSSE3;
+		if (regs[2] & (1 << 1)) found |= X86_CPU_PCLMUL;
+#else
+		unsigned eax, ebx, ecx, edx;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+			if (ecx & (1 << 9)) found |= X86_CPU_SSSE3;
+			if (ecx & (1 << 1)) found |= X86_CPU_PCLMUL;
+		}
+#endif
+		features = found;
+	}
+	return features;
+}
+
+#endif /* X86_SIMD */
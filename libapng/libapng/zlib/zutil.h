@@ -271,4 +271,19 @@ void ZLIB_INTERNAL zcfree OF((voidpf opaque, voidpf ptr));
 #define ZFREE(strm, addr)  (*((strm)->zfree))((strm)->opaque, (voidpf)(addr))
 #define TRY_FREE(s, p) {if (p) ZFREE(s, p);}
 
+/* x86: carry-less multiply crc32() and SSSE3 adler32(), picked at run time
+   from cpuid.  Define NO_X86_SIMD to build only the portable versions. */
+#if !defined(NO_X86_SIMD) && (defined(_M_IX86) || defined(_M_X64) || \
+    defined(__i386__) || defined(__x86_64__))
+#  define X86_SIMD
+#  define X86_CPU_SSSE3  0x1
+#  define X86_CPU_PCLMUL 0x2
+#  ifdef __GNUC__
+#    define X86_TARGET(x) __attribute__((target(x)))
+#  else
+#    define X86_TARGET(x)
+#  endif
+   int ZLIB_INTERNAL x86_cpu_features OF((void));
+#endif
+
 #endif /* ZUTIL_H */
@@ -0,0 +1,218 @@
+//Parallel deflate for libapng
+//----------------------------------------------------------
+//This program is free software; you can redistribute it and/or
+//modify it under the terms of the GNU General Public License
+//as published by the Free Software Foundation; either version 2
+//of the License, or (at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "libapng/zlib/zlib.h"
+#include "pdeflate.h"
+#include "trace.h"
+
+extern "C" {
+// Each block is a run of raw deflate blocks ending in a sync flush (the last one
+// in a final block instead), so the block outputs can simply be concatenated.
+// Priming every block with the 32 KB of input before it keeps matches reaching
+// back across block boundaries, which is what keeps the ratio close to a single
+// threaded deflate.
+using _BLOCK = struct {
+	const unsigned char* p;
+	size_t len;
+	size_t dict;
+	int last;
+	unsigned char* out;
+	size_t out_len;
+	unsigned long adler;
+	int ret;
+};
+
+using _JOB = struct {
+	_BLOCK* block;
+	int count;
+	int level;
+	int mem_level;
+	int strategy;
+	std::atomic<int> next;
+};
+
+// Worst case for one block: stored blocks plus the sync flush marker
+static size_t blockBound(size_t len) {
+	return len + ((len + 7) >> 3) + ((len + 63) >> 6) + 16;
+}
+
+static void compressBlock(z_stream* z, _BLOCK* b) {
+	squish::TraceScope trace("deflate block");
+	int ret;
+
+	b->out_len = 0;
+	b->adler = adler32(1, b->p, (uInt)b->len);
+	b->out = (unsigned char*)malloc(blockBound(b->len));
+	if (b->out == NULL) {
+		b->ret = Z_MEM_ERROR;
+		return;
+	}
+
+	ret = deflateReset(z);
+	if ((ret == Z_OK) && b->dict)
+		ret = deflateSetDictionary(z, b->p - b->dict, (uInt)b->dict);
+	if (ret != Z_OK) {
+		b->ret = ret;
+		return;
+	}
+
+	z->next_in = (Bytef*)b->p;
+	z->avail_in = (uInt)b->len;
+	z->next_out = b->out;
+	z->avail_out = (uInt)blockBound(b->len);
+	ret = deflate(z, b->last ? Z_FINISH : Z_SYNC_FLUSH);
+
+	b->out_len = blockBound(b->len) - z->avail_out;
+	b->ret = (ret == (b->last ? Z_STREAM_END : Z_OK)) && (z->avail_in == 0) ? Z_OK : Z_BUF_ERROR;
+}
+
+// Takes blocks off the shared counter until none are left
+static void worker(_JOB* job) {
+	z_stream z;
+	int i;
+
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, job->level, Z_DEFLATED, -15, job->mem_level, job->strategy) != Z_OK) {
+		while ((i = job->next++) < job->count)
+			job->block[i].ret = Z_MEM_ERROR;
+		return;
+	}
+
+	while ((i = job->next++) < job->count)
+		compressBlock(&z, &job->block[i]);
+
+	deflateEnd(&z);
+}
+
+size_t ParallelDeflateBound(size_t len) {
+	size_t blocks = len ? (len + PDEFLATE_BLOCK - 1) / PDEFLATE_BLOCK : 1;
+
+	return len + ((len + 7) >> 3) + ((len + 63) >> 6) + blocks * 16 + 6;
+}
+
+int ParallelDeflate(const unsigned char* src, size_t len, int level, int mem_level, int strategy, int threads,
+                    unsigned char* dst, size_t cap, size_t* out_len) {
+	squish::TraceScope trace("ParallelDeflate");
+	_JOB job;
+	std::thread* pool;
+	unsigned long adler;
+	unsigned header, level_flags;
+	size_t pos;
+	int i, ret;
+
+	*out_len = 0;
+	if ((level == Z_DEFAULT_COMPRESSION) || (level < 0) || (level > 9))
+		level = 6;
+	if (cap < 6)
+		return Z_BUF_ERROR;
+
+	job.count = len ? (int)((len + PDEFLATE_BLOCK - 1) / PDEFLATE_BLOCK) : 1;
+	job.level = level;
+	job.mem_level = mem_level;
+	job.strategy = strategy;
+	job.next = 0;
+	job.block = (_BLOCK*)calloc(job.count, sizeof(_BLOCK));
+	if (job.block == NULL)
+		return Z_MEM_ERROR;
+
+	for (i = 0; i < job.count; i++) {
+		size_t start = (size_t)i * PDEFLATE_BLOCK;
+
+		job.block[i].p = src + start;
+		job.block[i].len = len - start < PDEFLATE_BLOCK ? len - start : PDEFLATE_BLOCK;
+		job.block[i].dict = start < 32768 ? start : 32768;
+		job.block[i].last = i == job.count - 1;
+	}
+
+	if (threads <= 0)
+		threads = (int)std::thread::hardware_concurrency();
+	if (threads > job.count)
+		threads = job.count;
+	if (threads < 1)
+		threads = 1;
+
+	// the calling thread works through the blocks alongside the pool
+	pool = threads > 1 ? new std::thread[threads - 1] : NULL;
+	for (i = 0; i < threads - 1; i++)
+		pool[i] = std::thread(worker, &job);
+	worker(&job);
+	for (i = 0; i < threads - 1; i++)
+		pool[i].join();
+	delete[] pool;
+
+	// zlib header, with the same level hint deflate() would write
+	if ((strategy >= Z_HUFFMAN_ONLY) || (level < 2))
+		level_flags = 0;
+	else if (level < 6)
+		level_flags = 1;
+	else if (level == 6)
+		level_flags = 2;
+	else
+		level_flags = 3;
+	header = ((Z_DEFLATED + (7 << 4)) << 8) | (level_flags << 6);
+	header += 31 - (header % 31);
+	dst[0] = (unsigned char)(header >> 8);
+	dst[1] = (unsigned char)header;
+	pos = 2;
+
+	ret = Z_OK;
+	adler = 1;
+	for (i = 0; i < job.count; i++) {
+		_BLOCK* b = &job.block[i];
+
+		if (ret == Z_OK) {
+			if (b->ret != Z_OK)
+				ret = b->ret;
+			else if (pos + b->out_len + 4 > cap)
+				ret = Z_BUF_ERROR;
+			else {
+				memcpy(dst + pos, b->out, b->out_len);
+				pos += b->out_len;
+				adler = i ? adler32_combine(adler, b->adler, (z_off_t)b->len) : b->adler;
+			}
+		}
+		free(b->out);
+	}
+	free(job.block);
+
+	if (ret != Z_OK)
+		return ret;
+
+	dst[pos++] = (unsigned char)(adler >> 24);
+	dst[pos++] = (unsigned char)(adler >> 16);
+	dst[pos++] = (unsigned char)(adler >> 8);
+	dst[pos++] = (unsigned char)adler;
+	*out_len = pos;
+	return Z_OK;
+}
+
+__declspec(dllexport) int DeflateParallelBound(int len) {
+	return (int)ParallelDeflateBound(len > 0 ? (size_t)len : 0);
+}
+
+// Buffer to buffer entry point for WZ saves. Returns the zlib stream length, or a
+// negative zlib error code.
+__declspec(dllexport) int DeflateParallel(unsigned char* src, int len, unsigned char* dst, int cap, int level, int threads) {
+	size_t out_len;
+	int ret;
+
+	if ((len < 0) || (cap < 0))
+		return Z_STREAM_ERROR;
+
+	ret = ParallelDeflate(src, len, level, 8, Z_DEFAULT_STRATEGY, threads, dst, cap, &out_len);
+	return ret == Z_OK ? (int)out_len : ret;
+}
+}
@@ -0,0 +1,18 @@
+// Parallel deflate: one standard zlib stream compressed on several threads
+#pragma once
+
+#include <stddef.h>
+
+extern "C" {
+// Input is split into blocks of this size, each primed with the 32 KB before it
+#define PDEFLATE_BLOCK (128 << 10)
+
+// Largest stream ParallelDeflate can produce for len input bytes
+size_t ParallelDeflateBound(size_t len);
+
+// Compresses src into dst as a zlib stream (header, deflate data, Adler-32).
+// threads <= 0 uses one thread per core. Returns Z_OK and the stream length in
+// *out_len, Z_BUF_ERROR if cap is too small, or another zlib error code.
+int ParallelDeflate(const unsigned char* src, size_t len, int level, int mem_level, int strategy, int threads,
+                    unsigned char* dst, size_t cap, size_t* out_len);
+}
@@ -25,6 +25,10 @@
 
 #include "alpha.h"
 #include <algorithm>
+#include <climits>
+#if SQUISH_USE_SSE > 1
+#include <emmintrin.h>
+#endif
 
 namespace squish {
 	static int FloatToInt(float a, int limit) {
@@ -90,6 +94,140 @@ namespace squish {
 			min = std::max(0, max - steps);
 	}
 
+#if SQUISH_USE_SSE > 1
+	//! Gathers the alpha of the 16 pixels into one register.
+	static __m128i LoadAlpha(const u8* rgba) {
+		__m128i a0 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)rgba), 24);
+		__m128i a1 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)rgba + 1), 24);
+		__m128i a2 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)rgba + 2), 24);
+		__m128i a3 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)rgba + 3), 24);
+		return _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+	}
+
+	//! Returns 0xff in the byte of each pixel that is not in the mask.
+	static __m128i MaskedPixels(int mask) {
+		const __m128i bits = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+		__m128i spread = _mm_unpacklo_epi64(_mm_set1_epi8((char)mask), _mm_set1_epi8((char)(mask >> 8)));
+		return _mm_cmpeq_epi8(_mm_and_si128(spread, bits), _mm_setzero_si128());
+	}
+
+	static int MinByte(__m128i v) {
+		v = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+		v = _mm_min_epu8(v, _mm_srli_si128(v, 4));
+		v = _mm_min_epu8(v, _mm_srli_si128(v, 2));
+		v = _mm_min_epu8(v, _mm_srli_si128(v, 1));
+		return _mm_cvtsi128_si32(v) & 0xff;
+	}
+
+	static int MaxByte(__m128i v) {
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+		return _mm_cvtsi128_si32(v) & 0xff;
+	}
+
+	/*! @brief Builds the 5-alpha code book in bytes 0-7 and the 7-alpha one in 8-15
+
+		Each entry is a weighted sum of the endpoints over 5 or 7, divided with
+		a 16 bit reciprocal multiply that is exact for sums up to 7 * 255.
+	*/
+	static __m128i BuildCodes(int min5, int max5, int min7, int max7) {
+		__m128i codes5 = _mm_add_epi16(
+			_mm_add_epi16(_mm_mullo_epi16(_mm_set1_epi16((short)min5), _mm_setr_epi16(5, 0, 4, 3, 2, 1, 0, 0)),
+				_mm_mullo_epi16(_mm_set1_epi16((short)max5), _mm_setr_epi16(0, 5, 1, 2, 3, 4, 0, 0))),
+			_mm_setr_epi16(0, 0, 0, 0, 0, 0, 0, 5 * 255));
+		__m128i codes7 = _mm_add_epi16(
+			_mm_mullo_epi16(_mm_set1_epi16((short)min7), _mm_setr_epi16(7, 0, 6, 5, 4, 3, 2, 1)),
+			_mm_mullo_epi16(_mm_set1_epi16((short)max7), _mm_setr_epi16(0, 7, 1, 2, 3, 4, 5, 6)));
+		codes5 = _mm_mulhi_epu16(codes5, _mm_set1_epi16((short)13108));
+		codes7 = _mm_mulhi_epu16(codes7, _mm_set1_epi16((short)9363));
+		return _mm_packus_epi16(codes5, codes7);
+	}
+
+	static int FitCodes(__m128i alpha, __m128i masked, const u8* codes, __m128i& indices) {
+		// find the closest code for all 16 pixels at once, keeping the first on ties
+		__m128i code = _mm_set1_epi8((char)codes[0]);
+		__m128i least = _mm_or_si128(_mm_subs_epu8(alpha, code), _mm_subs_epu8(code, alpha));
+		__m128i index = _mm_setzero_si128();
+		for (int j = 1; j < 8; ++j) {
+			code = _mm_set1_epi8((char)codes[j]);
+			__m128i dist = _mm_or_si128(_mm_subs_epu8(alpha, code), _mm_subs_epu8(code, alpha));
+			__m128i keep = _mm_cmpeq_epi8(_mm_max_epu8(dist, least), dist);
+			index = _mm_or_si128(_mm_and_si128(keep, index), _mm_andnot_si128(keep, _mm_set1_epi8((char)j)));
+			least = _mm_min_epu8(least, dist);
+		}
+
+		// masked pixels use the first code and add no error
+		indices = _mm_andnot_si128(masked, index);
+		least = _mm_andnot_si128(masked, least);
+
+		// sum the squared errors
+		__m128i lo = _mm_unpacklo_epi8(least, _mm_setzero_si128());
+		__m128i hi = _mm_unpackhi_epi8(least, _mm_setzero_si128());
+		__m128i err = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+		err = _mm_add_epi32(err, _mm_srli_si128(err, 8));
+		err = _mm_add_epi32(err, _mm_srli_si128(err, 4));
+		return _mm_cvtsi128_si32(err);
+	}
+
+	static void WriteAlphaBlock(int alpha0, int alpha1, __m128i indices, void* block) {
+		auto bytes = reinterpret_cast<u8*>(block);
+
+		// write the first two bytes
+		bytes[0] = (u8)alpha0;
+		bytes[1] = (u8)alpha1;
+
+		// merge the 3-bit indices in pairs, then fours, then eights
+		__m128i pairs = _mm_or_si128(_mm_and_si128(indices, _mm_set1_epi16(0x00ff)), _mm_srli_epi16(indices, 5));
+		__m128i fours = _mm_madd_epi16(pairs, _mm_set1_epi32(1 | (64 << 16)));
+		__m128i eights = _mm_or_si128(fours, _mm_srli_epi64(fours, 20));
+
+		// store each group of eight in 3 bytes
+		int value[2] = {_mm_cvtsi128_si32(eights), _mm_cvtsi128_si32(_mm_srli_si128(eights, 8))};
+		u8* dest = bytes + 2;
+		for (int i = 0; i < 2; ++i) {
+			for (int j = 0; j < 3; ++j)
+				*dest++ = (u8)(value[i] >> 8 * j);
+		}
+	}
+
+	static void WriteAlphaBlock5(int alpha0, int alpha1, __m128i indices, void* block) {
+		// check the relative values of the endpoints
+		if (alpha0 > alpha1) {
+			// swap the indices: 0 and 1 trade places and 2-5 reverse
+			__m128i low = _mm_cmplt_epi8(indices, _mm_set1_epi8(2));
+			__m128i middle = _mm_andnot_si128(low, _mm_cmplt_epi8(indices, _mm_set1_epi8(6)));
+			__m128i swapped = _mm_or_si128(_mm_and_si128(low, _mm_xor_si128(indices, _mm_set1_epi8(1))),
+				_mm_or_si128(_mm_and_si128(middle, _mm_sub_epi8(_mm_set1_epi8(7), indices)),
+					_mm_andnot_si128(_mm_or_si128(low, middle), indices)));
+
+			// write the block
+			WriteAlphaBlock(alpha1, alpha0, swapped, block);
+		}
+		else {
+			// write the block
+			WriteAlphaBlock(alpha0, alpha1, indices, block);
+		}
+	}
+
+	static void WriteAlphaBlock7(int alpha0, int alpha1, __m128i indices, void* block) {
+		// check the relative values of the endpoints
+		if (alpha0 < alpha1) {
+			// swap the indices: 0 and 1 trade places and 2-7 reverse
+			__m128i low = _mm_cmplt_epi8(indices, _mm_set1_epi8(2));
+			__m128i swapped = _mm_or_si128(_mm_and_si128(low, _mm_xor_si128(indices, _mm_set1_epi8(1))),
+				_mm_andnot_si128(low, _mm_sub_epi8(_mm_set1_epi8(9), indices)));
+
+			// write the block
+			WriteAlphaBlock(alpha1, alpha0, swapped, block);
+		}
+		else {
+			// write the block
+			WriteAlphaBlock(alpha0, alpha1, indices, block);
+		}
+	}
+#else
 	static int FitCodes(const u8* rgba, int mask, const u8* codes, u8* indices) {
 		// fit each alpha value to the codebook
 		int err = 0;
@@ -202,8 +340,46 @@ namespace squish {
 			WriteAlphaBlock(alpha0, alpha1, indices, block);
 		}
 	}
+#endif
 
 	void CompressAlphaDxt5(const u8* rgba, int mask, void* block) {
+#if SQUISH_USE_SSE > 1
+		// get the range for 5-alpha and 7-alpha interpolation, leaving out masked
+		// pixels and, for 5-alpha, the 0 and 255 that it has codes for
+		__m128i alpha = LoadAlpha(rgba);
+		__m128i masked = MaskedPixels(mask);
+		__m128i ends = _mm_cmpeq_epi8(alpha, _mm_setzero_si128());
+		int min7 = MinByte(_mm_or_si128(alpha, masked));
+		int max7 = MaxByte(_mm_andnot_si128(masked, alpha));
+		int min5 = MinByte(_mm_or_si128(alpha, _mm_or_si128(masked, ends)));
+		ends = _mm_cmpeq_epi8(alpha, _mm_set1_epi8(-1));
+		int max5 = MaxByte(_mm_andnot_si128(_mm_or_si128(masked, ends), alpha));
+
+		// handle the case that no valid range was found
+		if (min5 > max5)
+			min5 = max5;
+		if (min7 > max7)
+			min7 = max7;
+
+		// fix the range to be the minimum in each case
+		FixRange(min5, max5, 5);
+		FixRange(min7, max7, 7);
+
+		// set up both code books
+		u8 codes[16];
+		_mm_storeu_si128((__m128i*)codes, BuildCodes(min5, max5, min7, max7));
+
+		// fit the data to both code books
+		__m128i indices5, indices7;
+		int err5 = FitCodes(alpha, masked, codes, indices5);
+		int err7 = FitCodes(alpha, masked, codes + 8, indices7);
+
+		// save the block with least error
+		if (err5 <= err7)
+			WriteAlphaBlock5(min5, max5, indices5, block);
+		else
+			WriteAlphaBlock7(min7, max7, indices7, block);
+#else
 		// get the range for 5-alpha and 7-alpha interpolation
 		int min5 = 255;
 		int max5 = 0;
@@ -264,6 +440,7 @@ namespace squish {
 			WriteAlphaBlock5(min5, max5, indices5, block);
 		else
 			WriteAlphaBlock7(min7, max7, indices7, block);
+#endif
 	}
 
 	void DecompressAlphaDxt5(u8* rgba, const void* block) {
@@ -28,10 +28,185 @@
 #include "colourset.h"
 #include "colourblock.h"
 #include <cfloat>
+#include <cstring>
+#include <vector>
+#if SQUISH_USE_SSE
+#include <xmmintrin.h>
+#endif
+#if SQUISH_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+#if SQUISH_USE_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SQUISH_TARGET_AVX2
+#else
+#define SQUISH_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
 
 namespace squish {
-	ClusterFit::ClusterFit(const ColourSet* colours, int flags)
-		: ColourFit(colours, flags) {
+#if SQUISH_USE_AVX2
+	//! Checks that the processor and operating system support AVX2.
+	static bool HasAvx2() {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+
+	/*! @brief The (i, j, k) splits Compress4 tries for a number of points
+
+		Each split is packed as i | j << 8 | k << 16, in the order of the loops
+		in Compress4.
+	*/
+	static const std::vector<int>& Splits4(int count) {
+		struct Table {
+			std::vector<int> splits[17];
+
+			Table() {
+				for (int count = 1; count <= 16; ++count)
+					for (int i = 0; i < count; ++i)
+						for (int j = i; j <= count; ++j)
+							for (int k = (j == 0) ? 1 : j; k <= count; ++k)
+								splits[count].push_back(i | (j << 8) | (k << 16));
+			}
+		};
+		static const Table table;
+		return table.splits[count];
+	}
+
+	/*! @brief Evaluates the Compress4 splits of an ordering eight at a time
+
+		@param sums			The run sums of the ordering, one table per component.
+		@param count		The number of points.
+		@param splits		The splits to try, from Splits4.
+		@param total		The number of splits.
+		@param metric		The error metric.
+		@param besterror	The error to beat; lowered when a split wins.
+		@param start		Receives the start point of the winner.
+		@param end			Receives the end point of the winner.
+
+		Each lane evaluates one split with the same operations, in the same
+		order, as the Vec4 loop, and the winning lanes are taken in split order,
+		so the winner and its error match that loop exactly. Returns the index of
+		the winning split, or -1 if none beat the error.
+	*/
+	SQUISH_TARGET_AVX2 static int FindBestSplit4(const float (*sums)[17 * 17], int count, const int* splits, int total,
+		const Vec3& metric, float& besterror, Vec3& start, Vec3& end) {
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 two = _mm256_set1_ps(2.0f);
+		const __m256 onethird = _mm256_set1_ps(1.0f / 3.0f);
+		const __m256 twothirds = _mm256_set1_ps(2.0f / 3.0f);
+		const __m256 onethird2 = _mm256_set1_ps(1.0f / 9.0f);
+		const __m256 twothirds2 = _mm256_set1_ps(4.0f / 9.0f);
+		const __m256 twonineths = _mm256_set1_ps(2.0f / 9.0f);
+		const __m256 grid[3] = {_mm256_set1_ps(31.0f), _mm256_set1_ps(63.0f), _mm256_set1_ps(31.0f)};
+		const __m256 gridrcp[3] = {_mm256_set1_ps(1.0f / 31.0f), _mm256_set1_ps(1.0f / 63.0f), _mm256_set1_ps(1.0f / 31.0f)};
+		const __m256 weights[3] = {_mm256_set1_ps(metric.X()), _mm256_set1_ps(metric.Y()), _mm256_set1_ps(metric.Z())};
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i byte = _mm256_set1_epi32(0xff);
+
+		__m256 xsum[4];
+		for (int c = 0; c < 4; ++c)
+			xsum[c] = _mm256_set1_ps(sums[c][count]);
+
+		int best = -1;
+		for (int n = 0; n < total; n += 8) {
+			// lanes past the last split read the empty run at 0 and cannot win
+			__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(total), _mm256_add_epi32(lanes, _mm256_set1_epi32(n)));
+			__m256i packed = _mm256_maskload_epi32(splits + n, valid);
+			__m256i i = _mm256_and_si256(packed, byte);
+			__m256i j = _mm256_and_si256(_mm256_srli_epi32(packed, 8), byte);
+			__m256i k = _mm256_srli_epi32(packed, 16);
+
+			// clusters [0,i), [i,j), [j,k) from the run sums, and [k,count) from the total
+			__m256i run1 = _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(i, 4), i), j);
+			__m256i run2 = _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(j, 4), j), k);
+			__m256 part0[4], part1[4], part2[4], part3[4];
+			for (int c = 0; c < 4; ++c) {
+				part0[c] = _mm256_i32gather_ps(sums[c], i, 4);
+				part1[c] = _mm256_i32gather_ps(sums[c], run1, 4);
+				part2[c] = _mm256_i32gather_ps(sums[c], run2, 4);
+				part3[c] = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(xsum[c], part2[c]), part1[c]), part0[c]);
+			}
+
+			// compute least squares terms directly
+			__m256 alpha2_sum = _mm256_add_ps(_mm256_mul_ps(part2[3], onethird2), _mm256_add_ps(_mm256_mul_ps(part1[3], twothirds2), part0[3]));
+			__m256 beta2_sum = _mm256_add_ps(_mm256_mul_ps(part1[3], onethird2), _mm256_add_ps(_mm256_mul_ps(part2[3], twothirds2), part3[3]));
+			__m256 alphabeta_sum = _mm256_mul_ps(twonineths, _mm256_add_ps(part1[3], part2[3]));
+
+			// the reciprocal estimate with one round of Newton-Rhaphson refinement, as Reciprocal
+			__m256 denominator = _mm256_sub_ps(_mm256_mul_ps(alpha2_sum, beta2_sum), _mm256_mul_ps(alphabeta_sum, alphabeta_sum));
+			__m256 estimate = _mm256_rcp_ps(denominator);
+			__m256 diff = _mm256_sub_ps(one, _mm256_mul_ps(estimate, denominator));
+			__m256 factor = _mm256_add_ps(_mm256_mul_ps(diff, estimate), estimate);
+
+			__m256 a[3], b[3], error = zero;
+			for (int c = 0; c < 3; ++c) {
+				__m256 alphax_sum = _mm256_add_ps(_mm256_mul_ps(part2[c], onethird), _mm256_add_ps(_mm256_mul_ps(part1[c], twothirds), part0[c]));
+				__m256 betax_sum = _mm256_add_ps(_mm256_mul_ps(part1[c], onethird), _mm256_add_ps(_mm256_mul_ps(part2[c], twothirds), part3[c]));
+
+				// compute the least-squares optimal points
+				a[c] = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(alphax_sum, beta2_sum), _mm256_mul_ps(betax_sum, alphabeta_sum)), factor);
+				b[c] = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(betax_sum, alpha2_sum), _mm256_mul_ps(alphax_sum, alphabeta_sum)), factor);
+
+				// clamp to the grid
+				a[c] = _mm256_min_ps(one, _mm256_max_ps(zero, a[c]));
+				b[c] = _mm256_min_ps(one, _mm256_max_ps(zero, b[c]));
+				a[c] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(grid[c], a[c]), half))), gridrcp[c]);
+				b[c] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(grid[c], b[c]), half))), gridrcp[c]);
+
+				// compute the error (we skip the constant xxsum)
+				__m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(a[c], a[c]), alpha2_sum), _mm256_mul_ps(_mm256_mul_ps(b[c], b[c]), beta2_sum));
+				__m256 e2 = _mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(a[c], b[c]), alphabeta_sum), _mm256_mul_ps(a[c], alphax_sum));
+				__m256 e3 = _mm256_sub_ps(e2, _mm256_mul_ps(b[c], betax_sum));
+				__m256 e4 = _mm256_add_ps(_mm256_mul_ps(two, e3), e1);
+
+				// apply the metric to the error term, summing x + y + z in that order
+				__m256 e5 = _mm256_mul_ps(e4, weights[c]);
+				error = (c == 0) ? e5 : _mm256_add_ps(error, e5);
+			}
+
+			// take the winning lanes in split order, as the Vec4 loop would meet them
+			__m256 better = _mm256_and_ps(_mm256_cmp_ps(error, _mm256_set1_ps(besterror), _CMP_LT_OQ), _mm256_castsi256_ps(valid));
+			int mask = _mm256_movemask_ps(better);
+			if (mask == 0)
+				continue;
+
+			float errors[8], values[6][8];
+			_mm256_storeu_ps(errors, error);
+			for (int c = 0; c < 3; ++c) {
+				_mm256_storeu_ps(values[c], a[c]);
+				_mm256_storeu_ps(values[3 + c], b[c]);
+			}
+			for (int l = 0; l < 8; ++l) {
+				if ((mask & (1 << l)) != 0 && errors[l] < besterror) {
+					besterror = errors[l];
+					start = Vec3(values[0][l], values[1][l], values[2][l]);
+					end = Vec3(values[3][l], values[4][l], values[5][l]);
+					best = n + l;
+				}
+			}
+		}
+		return best;
+	}
+#endif
+
+	ClusterFit::ClusterFit(const ColourSet* colours, int flags, Statistics* statistics)
+		: ColourFit(colours, flags), m_statistics(statistics) {
 		// set the iteration count
 		m_iterationCount = (m_flags & kColourIterativeClusterFit) ? kMaxIterations : 1;
 
@@ -54,6 +229,17 @@ namespace squish {
 
 		// compute the principle component
 		m_principle = ComputePrincipleComponent(covariance);
+
+		// weight the points once; each ordering only permutes them
+		const float* weights = m_colours->GetWeights();
+		for (int i = 0; i < count; ++i)
+			m_weighted[i] = Vec4(values[i].X(), values[i].Y(), values[i].Z(), 1.0f) * Vec4(weights[i]);
+
+#if SQUISH_USE_AVX2
+		// evaluate the four cluster partitions eight at a time where the processor allows
+		static const bool avx2 = HasAvx2();
+		m_wide = avx2;
+#endif
 	}
 
 	bool ClusterFit::ConstructOrdering(const Vec3& axis, int iteration) {
@@ -62,47 +248,82 @@ namespace squish {
 		const Vec3* values = m_colours->GetPoints();
 
 		// build the list of dot products
-		float dps[16];
+		float dps[16] = {};
 		u8* order = (u8*)m_order + 16 * iteration;
-		for (int i = 0; i < count; ++i) {
-			dps[i] = Dot(values[i], axis);
+		for (int i = 0; i < 16; ++i)
 			order[i] = (u8)i;
-		}
+		for (int i = 0; i < count; ++i)
+			dps[i] = Dot(values[i], axis);
 
 		// stable sort using them
+#if SQUISH_USE_SSE
+		// place each point by the number that sort before it: the smaller products and
+		// the equal ones of earlier points, found with four compares against all 16
+		__m128 keys[4];
+		for (int k = 0; k < 4; ++k)
+			keys[k] = _mm_loadu_ps(dps + 4 * k);
+		const int valid = (1 << count) - 1;
+		for (int i = 0; i < count; ++i) {
+			__m128 key = _mm_set1_ps(dps[i]);
+			int less = 0, greater = 0;
+			for (int k = 0; k < 4; ++k) {
+				less |= _mm_movemask_ps(_mm_cmplt_ps(keys[k], key)) << (4 * k);
+				greater |= _mm_movemask_ps(_mm_cmpgt_ps(keys[k], key)) << (4 * k);
+			}
+			int equal = ~(less | greater) & ((1 << i) - 1);
+			order[BitCount(less & valid) + BitCount(equal)] = (u8)i;
+		}
+#else
 		for (int i = 0; i < count; ++i) {
 			for (int j = i; j > 0 && dps[j] < dps[j - 1]; --j) {
 				std::swap(dps[j], dps[j - 1]);
 				std::swap(order[j], order[j - 1]);
 			}
 		}
+#endif
 
-		// check this ordering is unique
+		// check this ordering is unique; unused entries hold their own index, so whole rows compare
 		for (int it = 0; it < iteration; ++it) {
 			const u8* prev = (u8*)m_order + 16 * it;
-			bool same = true;
-			for (int i = 0; i < count; ++i) {
-				if (order[i] != prev[i]) {
-					same = false;
-					break;
-				}
-			}
-			if (same)
+#if SQUISH_USE_SSE > 1
+			__m128i rows = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)order), _mm_loadu_si128((const __m128i*)prev));
+			bool same = _mm_movemask_epi8(rows) == 0xffff;
+#else
+			bool same = std::memcmp(order, prev, 16) == 0;
+#endif
+			if (same) {
+				if (m_statistics != nullptr)
+					++m_statistics->orderingExits;
 				return false;
+			}
 		}
 
-		// copy the ordering and weight all the points
-		const Vec3* unweighted = m_colours->GetPoints();
-		const float* weights = m_colours->GetWeights();
-		m_xsum_wsum = VEC4_CONST(0.0f);
-		for (int i = 0; i < count; ++i) {
-			int j = order[i];
-			Vec4 p(unweighted[j].X(), unweighted[j].Y(), unweighted[j].Z(), 1.0f);
-			Vec4 w(weights[j]);
-			Vec4 x = p * w;
-			m_points_weights[i] = x;
-			m_xsum_wsum += x;
+		// sum the weighted points of every run [i,j) of the ordering, adding in order so
+		// the partition loops read the same values they would accumulate
+		for (int i = 0; i <= count; ++i) {
+			Vec4* sums = m_sums + 17 * i;
+			auto sum = VEC4_CONST(0.0f);
+			sums[i] = sum;
+			for (int j = i; j < count; ++j) {
+				sum += m_weighted[order[j]];
+				sums[j + 1] = sum;
+			}
 		}
+
+#if SQUISH_USE_AVX2
+		// the same sums with the components split apart for the wide search
+		if (m_wide) {
+			for (int i = 0; i <= count; ++i) {
+				for (int j = 17 * i + i; j <= 17 * i + count; ++j) {
+					Vec3 rgb = m_sums[j].GetVec3();
+					m_wideSums[0][j] = rgb.X();
+					m_wideSums[1][j] = rgb.Y();
+					m_wideSums[2][j] = rgb.Z();
+					m_wideSums[3][j] = m_sums[j].SplatW().GetVec3().X();
+				}
+			}
+		}
+#endif
 		return true;
 	}
 
@@ -129,16 +350,24 @@ namespace squish {
 		int besti = 0, bestj = 0;
 
 		// loop over iterations (we avoid the case that all points in first or last cluster)
+		int passes = 0;
 		for (int iterationIndex = 0;;) {
+			++passes;
+
+			const Vec4 xsum_wsum = m_sums[count];
+
 			// first cluster [0,i) is at the start
-			auto part0 = VEC4_CONST(0.0f);
 			for (int i = 0; i < count; ++i) {
+				const Vec4 part0 = m_sums[i];
+
 				// second cluster [i,j) is half along
-				Vec4 part1 = (i == 0) ? m_points_weights[0] : VEC4_CONST(0.0f);
+				const Vec4* runs = m_sums + 17 * i;
 				int jmin = (i == 0) ? 1 : i;
-				for (int j = jmin;;) {
+				for (int j = jmin; j <= count; ++j) {
+					const Vec4 part1 = runs[j];
+
 					// last cluster [j,count) is at the end
-					Vec4 part2 = m_xsum_wsum - part1 - part0;
+					Vec4 part2 = xsum_wsum - part1 - part0;
 
 					// compute least squares terms directly
 					Vec4 alphax_sum = MultiplyAdd(part1, half_half2, part0);
@@ -179,16 +408,7 @@ namespace squish {
 						besterror = error;
 						bestiteration = iterationIndex;
 					}
-
-					// advance
-					if (j == count)
-						break;
-					part1 += m_points_weights[j];
-					++j;
 				}
-
-				// advance
-				part0 += m_points_weights[i];
 			}
 
 			// stop if we didn't improve in this iteration
@@ -206,6 +426,10 @@ namespace squish {
 				break;
 		}
 
+		// count the orderings searched
+		if (m_statistics != nullptr)
+			++m_statistics->clusterIterations[passes];
+
 		// save the block if necessary
 		if (CompareAnyLessThan(besterror, m_besterror)) {
 			// remap the indices
@@ -252,21 +476,51 @@ namespace squish {
 		u8 bestindices[16];
 		int bestiteration = 0;
 		int besti = 0, bestj = 0, bestk = 0;
+#if SQUISH_USE_AVX2
+		const Vec3 metric = m_metric.GetVec3();
+		const std::vector<int>& splits = Splits4(count);
+#endif
 
 		// loop over iterations (we avoid the case that all points in first or last cluster)
+		int passes = 0;
 		for (int iterationIndex = 0;;) {
+			++passes;
+
+			const Vec4 xsum_wsum = m_sums[count];
+
+#if SQUISH_USE_AVX2
+			// search eight partitions at a time, in the order of the loops below
+			if (m_wide) {
+				float error = besterror.GetVec3().X();
+				Vec3 start(0.0f), end(0.0f);
+				int n = FindBestSplit4(m_wideSums, count, splits.data(), (int)splits.size(), metric, error, start, end);
+				if (n >= 0) {
+					beststart = Vec4(start.X(), start.Y(), start.Z(), 0.0f);
+					bestend = Vec4(end.X(), end.Y(), end.Z(), 0.0f);
+					besterror = Vec4(error);
+					besti = splits[n] & 0xff;
+					bestj = (splits[n] >> 8) & 0xff;
+					bestk = splits[n] >> 16;
+					bestiteration = iterationIndex;
+				}
+			} else
+#endif
 			// first cluster [0,i) is at the start
-			auto part0 = VEC4_CONST(0.0f);
 			for (int i = 0; i < count; ++i) {
+				const Vec4 part0 = m_sums[i];
+
 				// second cluster [i,j) is one third along
-				auto part1 = VEC4_CONST(0.0f);
-				for (int j = i;;) {
+				for (int j = i; j <= count; ++j) {
+					const Vec4 part1 = m_sums[17 * i + j];
+
 					// third cluster [j,k) is two thirds along
-					Vec4 part2 = (j == 0) ? m_points_weights[0] : VEC4_CONST(0.0f);
+					const Vec4* runs = m_sums + 17 * j;
 					int kmin = (j == 0) ? 1 : j;
-					for (int k = kmin;;) {
+					for (int k = kmin; k <= count; ++k) {
+						const Vec4 part2 = runs[k];
+
 						// last cluster [k,count) is at the end
-						Vec4 part3 = m_xsum_wsum - part2 - part1 - part0;
+						Vec4 part3 = xsum_wsum - part2 - part1 - part0;
 
 						// compute least squares terms directly
 						const Vec4 alphax_sum = MultiplyAdd(part2, onethird_onethird2, MultiplyAdd(part1, twothirds_twothirds2, part0));
@@ -308,23 +562,8 @@ namespace squish {
 							bestk = k;
 							bestiteration = iterationIndex;
 						}
-
-						// advance
-						if (k == count)
-							break;
-						part2 += m_points_weights[k];
-						++k;
 					}
-
-					// advance
-					if (j == count)
-						break;
-					part1 += m_points_weights[j];
-					++j;
 				}
-
-				// advance
-				part0 += m_points_weights[i];
 			}
 
 			// stop if we didn't improve in this iteration
@@ -342,6 +581,10 @@ namespace squish {
 				break;
 		}
 
+		// count the orderings searched
+		if (m_statistics != nullptr)
+			++m_statistics->clusterIterations[passes];
+
 		// save the block if necessary
 		if (CompareAnyLessThan(besterror, m_besterror)) {
 			// remap the indices
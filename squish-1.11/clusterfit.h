@@ -35,7 +35,7 @@
 namespace squish {
 	class ClusterFit : public ColourFit {
 		public:
-			ClusterFit(const ColourSet* colours, int flags);
+			ClusterFit(const ColourSet* colours, int flags, Statistics* statistics = nullptr);
 
 		private:
 			bool ConstructOrdering(const Vec3& axis, int iteration);
@@ -48,10 +48,15 @@ namespace squish {
 			int m_iterationCount;
 			Vec3 m_principle;
 			u8 m_order[16 * kMaxIterations];
-			Vec4 m_points_weights[16];
-			Vec4 m_xsum_wsum;
+			Vec4 m_weighted[16];
+			Vec4 m_sums[17 * 17];
+#if SQUISH_USE_AVX2
+			bool m_wide;
+			float m_wideSums[4][17 * 17];
+#endif
 			Vec4 m_metric;
 			Vec4 m_besterror;
+			Statistics* m_statistics;
 	};
 } // namespace squish
 
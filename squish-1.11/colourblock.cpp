@@ -68,10 +68,10 @@ namespace squish {
 	}
 
 	void WriteColourBlock3(Vec3::Arg start, Vec3::Arg end, const u8* indices, void* block) {
-		// get the packed values
-		int a = FloatTo565(start);
-		int b = FloatTo565(end);
+		WriteColourBlock3(FloatTo565(start), FloatTo565(end), indices, block);
+	}
 
+	void WriteColourBlock3(int a, int b, const u8* indices, void* block) {
 		// remap the indices
 		u8 remapped[16];
 		if (a <= b) {
@@ -97,10 +97,10 @@ namespace squish {
 	}
 
 	void WriteColourBlock4(Vec3::Arg start, Vec3::Arg end, const u8* indices, void* block) {
-		// get the packed values
-		int a = FloatTo565(start);
-		int b = FloatTo565(end);
+		WriteColourBlock4(FloatTo565(start), FloatTo565(end), indices, block);
+	}
 
+	void WriteColourBlock4(int a, int b, const u8* indices, void* block) {
 		// remap the indices
 		u8 remapped[16];
 		if (a < b) {
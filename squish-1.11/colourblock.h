@@ -33,6 +33,10 @@ namespace squish {
 	void WriteColourBlock3(Vec3::Arg start, Vec3::Arg end, const u8* indices, void* block);
 	void WriteColourBlock4(Vec3::Arg start, Vec3::Arg end, const u8* indices, void* block);
 
+	//! Writes a block from endpoints already packed as 5:6:5.
+	void WriteColourBlock3(int start, int end, const u8* indices, void* block);
+	void WriteColourBlock4(int start, int end, const u8* indices, void* block);
+
 	void DecompressColour(u8* rgba, const void* block, bool isDxt1);
 } // namespace squish
 
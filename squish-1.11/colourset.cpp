@@ -24,8 +24,106 @@
    -------------------------------------------------------------------------- */
 
 #include "colourset.h"
+#if SQUISH_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace squish {
+	//! Returns the index of the lowest set bit of a non-zero mask.
+	static int LowestBit(int bits) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, (unsigned long)bits);
+		return (int)index;
+#else
+		return __builtin_ctz((unsigned)bits);
+#endif
+	}
+
+	/*! @brief The 16 pixels of a block, set up for finding equal colours
+
+		Colours are compared as 24 bit keys, four pixels per register where SSE2
+		is available, and every pixel is converted to float in one pass.
+	*/
+	class BlockPixels {
+		public:
+			explicit BlockPixels(const u8* rgba) : m_rgba(rgba) {
+#if SQUISH_USE_SSE > 1
+				const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+				const __m128i zero = _mm_setzero_si128();
+				const __m128 scale = _mm_set1_ps(255.0f);
+				m_opaque = 0;
+				for (int k = 0; k < 4; ++k) {
+					__m128i pixels = _mm_loadu_si128((const __m128i*)rgba + k);
+
+					// the alpha byte is the top of each lane, so its high bit gives alpha >= 128
+					m_opaque |= _mm_movemask_ps(_mm_castsi128_ps(pixels)) << (4 * k);
+					m_colours[k] = _mm_and_si128(pixels, rgb);
+
+					// widen to 32 bit lanes and normalise to [0,1]; the division rounds as the scalar one does
+					__m128i low = _mm_unpacklo_epi8(pixels, zero);
+					__m128i high = _mm_unpackhi_epi8(pixels, zero);
+					_mm_storeu_ps(m_values + 16 * k, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), scale));
+					_mm_storeu_ps(m_values + 16 * k + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), scale));
+					_mm_storeu_ps(m_values + 16 * k + 8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), scale));
+					_mm_storeu_ps(m_values + 16 * k + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), scale));
+				}
+#else
+				m_opaque = 0;
+				for (int i = 0; i < 16; ++i) {
+					m_colours[i] = Key(i);
+					m_opaque |= (rgba[4 * i + 3] >> 7) << i;
+				}
+#endif
+			}
+
+			//! One bit per pixel with alpha >= 128.
+			int Opaque() const { return m_opaque; }
+
+			//! One bit per pixel with the same colour as pixel i, alpha not counted.
+			int Matches(int i) const {
+#if SQUISH_USE_SSE > 1
+				__m128i key = _mm_set1_epi32((int)Key(i));
+				int matches = 0;
+				for (int k = 0; k < 4; ++k)
+					matches |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(m_colours[k], key))) << (4 * k);
+				return matches;
+#else
+				unsigned key = m_colours[i];
+				int matches = 0;
+				for (int j = 0; j < 16; ++j)
+					matches |= (int)(m_colours[j] == key) << j;
+				return matches;
+#endif
+			}
+
+			//! Pixel i normalised to [0,1].
+			Vec3 Point(int i) const {
+#if SQUISH_USE_SSE > 1
+				return Vec3(m_values[4 * i], m_values[4 * i + 1], m_values[4 * i + 2]);
+#else
+				return Vec3((float)m_rgba[4 * i] / 255.0f, (float)m_rgba[4 * i + 1] / 255.0f, (float)m_rgba[4 * i + 2] / 255.0f);
+#endif
+			}
+
+		private:
+			unsigned Key(int i) const {
+				return (unsigned)m_rgba[4 * i] | ((unsigned)m_rgba[4 * i + 1] << 8) | ((unsigned)m_rgba[4 * i + 2] << 16);
+			}
+
+			const u8* m_rgba;
+			int m_opaque;
+#if SQUISH_USE_SSE > 1
+			__m128i m_colours[4];
+			float m_values[64];
+#else
+			unsigned m_colours[16];
+#endif
+	};
+
 	ColourSet::ColourSet(const u8* rgba, int mask, int flags)
 		: m_count(0),
 		  m_transparent(false) {
@@ -33,69 +131,51 @@ namespace squish {
 		bool isDxt1 = ((flags & kDxt1) != 0);
 		bool weightByAlpha = ((flags & kWeightColourByAlpha) != 0);
 
-		// create the minimal set
+		BlockPixels pixels(rgba);
+
+		// the enabled pixels, without the transparent ones when using dxt1
+		int active = mask & 0xffff;
+		if (isDxt1) {
+			m_transparent = (active & ~pixels.Opaque()) != 0;
+			active &= pixels.Opaque();
+		}
+
+		// create the minimal set, with each point where its colour first appears
+		int assigned = 0;
 		for (int i = 0; i < 16; ++i) {
-			// check this pixel is enabled
 			int bit = 1 << i;
-			if ((mask & bit) == 0) {
+			if ((active & bit) == 0) {
 				m_remap[i] = -1;
 				continue;
 			}
-
-			// check for transparent pixels when using dxt1
-			if (isDxt1 && rgba[4 * i + 3] < 128) {
-				m_remap[i] = -1;
-				m_transparent = true;
+			if ((assigned & bit) != 0)
 				continue;
-			}
-
-			// loop over previous points for a match
-			for (int j = 0;; ++j) {
-				// allocate a new point
-				if (j == i) {
-					// normalise coordinates to [0,1]
-					float x = (float)rgba[4 * i] / 255.0f;
-					float y = (float)rgba[4 * i + 1] / 255.0f;
-					float z = (float)rgba[4 * i + 2] / 255.0f;
-
-					// ensure there is always non-zero weight even for zero alpha
-					float w = (float)(rgba[4 * i + 3] + 1) / 256.0f;
-
-					// add the point
-					m_points[m_count] = Vec3(x, y, z);
-					m_weights[m_count] = (weightByAlpha ? w : 1.0f);
-					m_remap[i] = m_count;
-
-					// advance
-					++m_count;
-					break;
-				}
 
-				// check for a match
-				int oldbit = 1 << j;
-				bool match = ((mask & oldbit) != 0)
-					&& (rgba[4 * i] == rgba[4 * j])
-					&& (rgba[4 * i + 1] == rgba[4 * j + 1])
-					&& (rgba[4 * i + 2] == rgba[4 * j + 2])
-					&& (rgba[4 * j + 3] >= 128 || !isDxt1);
-				if (match) {
-					// get the index of the match
-					int index = m_remap[j];
-
-					// ensure there is always non-zero weight even for zero alpha
-					float w = (float)(rgba[4 * i + 3] + 1) / 256.0f;
-
-					// map to this point and increase the weight
-					m_weights[index] += (weightByAlpha ? w : 1.0f);
-					m_remap[i] = index;
-					break;
-				}
-			}
+			// map this pixel and every later one of the same colour to a new point
+			int matches = pixels.Matches(i) & active;
+			assigned |= matches;
+
+			// ensure there is always non-zero weight even for zero alpha; the weights are
+			// multiples of 1/256, so summing them as integers gives the same floats
+			int sum = 0;
+			if (weightByAlpha) {
+				for (int rest = matches; rest != 0; rest &= rest - 1)
+					sum += rgba[4 * LowestBit(rest) + 3] + 1;
+			} else
+				sum = BitCount(matches);
+			float weight = weightByAlpha ? (float)sum / 256.0f : (float)sum;
+
+			for (int rest = matches; rest != 0; rest &= rest - 1)
+				m_remap[LowestBit(rest)] = m_count;
+
+			// add the point, square rooting the weight
+			m_points[m_count] = pixels.Point(i);
+			m_weights[m_count] = std::sqrt(weight);
+			m_integerWeights[m_count] = sum;
+			for (int c = 0; c < 4; ++c)
+				m_colours[4 * m_count + c] = rgba[4 * i + c];
+			++m_count;
 		}
-
-		// square root the weights
-		for (int i = 0; i < m_count; ++i)
-			m_weights[i] = std::sqrt(m_weights[i]);
 	}
 
 	void ColourSet::RemapIndices(const u8* source, u8* target) const {
@@ -41,12 +41,20 @@ namespace squish {
 			const float* GetWeights() const { return m_weights; }
 			bool IsTransparent() const { return m_transparent; }
 
+			//! The points as bytes, four per point with the alpha of the first pixel.
+			const u8* GetColours() const { return m_colours; }
+
+			//! The weights before the square root: pixel counts, or sums of alpha + 1.
+			const int* GetIntegerWeights() const { return m_integerWeights; }
+
 			void RemapIndices(const u8* source, u8* target) const;
 
 		private:
 			int m_count;
 			Vec3 m_points[16];
 			float m_weights[16];
+			u8 m_colours[16 * 4];
+			int m_integerWeights[16];
 			int m_remap[16];
 			bool m_transparent;
 	};
@@ -36,6 +36,16 @@
 #define SQUISH_USE_SSE 0
 #endif
 
+// Set to 0 to leave out the AVX2 cluster fit kernel. It is only built with SSE2
+// and is chosen at run time on processors that support it.
+#ifndef SQUISH_USE_AVX2
+#if ( SQUISH_USE_SSE > 1 ) && ( defined( __GNUC__ ) || defined( _MSC_VER ) )
+#define SQUISH_USE_AVX2 1
+#else
+#define SQUISH_USE_AVX2 0
+#endif
+#endif
+
 // Internally et SQUISH_USE_SIMD when either Altivec or SSE is available.
 #if SQUISH_USE_ALTIVEC && SQUISH_USE_SSE
 #error "Cannot enable both Altivec and SSE!"
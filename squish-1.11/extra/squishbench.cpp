@@ -0,0 +1,730 @@
+/* -----------------------------------------------------------------------------
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+/*! @file
+
+	@brief	Throughput and quality benchmark for every compression flag combination.
+
+	A fixed corpus of generated sprite-like images (transparent sprites with
+	anti-aliased edges, soft glow effects, opaque tiles, flat UI panels and an
+	odd-sized sprite for the masked edge blocks) is compressed with every
+	combination of DXT format, colour fit, colour metric and alpha weighting.
+	Each combination is timed block by block through Compress and image by image
+	through CompressImage, the latter on 1, 2, 4, ... threads. The compressed
+	data is decompressed again to measure RMSE and PSNR, and hashed so that
+	a change in output between builds or thread counts shows up.
+
+	The corpus is built with basic float arithmetic only, so every compiler
+	and platform generates the same pixels. That makes the hashes comparable
+	across builds: -w stores them in a golden file and -g checks a build
+	(a SIMD backend, a threading or batching change) against it, byte for byte
+	or, with -e, within an RMSE bound for modes that are meant to differ.
+*/
+
+#include <squish.h>
+#include <trace.h>
+#include "config.h"
+#include <fstream>
+#include <map>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace squish;
+
+struct Image {
+	std::string name;
+	int width;
+	int height;
+	std::vector<u8> rgba;
+};
+
+struct Result {
+	double seconds;
+	int blocks;
+	double bytes;
+	double colourError;
+	double alphaError;
+	unsigned hash;
+	unsigned decoded;
+};
+
+// stored output of one flag combination at one level
+struct Golden {
+	unsigned hash;
+	unsigned decoded;
+	double colourError;
+	double alphaError;
+};
+
+// -----------------------------------------------------------------------------
+// corpus
+
+static unsigned s_seed;
+
+static float Random() {
+	s_seed = s_seed * 1664525u + 1013904223u;
+	return (float)(s_seed >> 8) / (float)(1 << 24);
+}
+
+// a sine approximation from basic arithmetic, so that it gives the same result on every platform
+static float Wave(float t) {
+	float x = t * 0.15915494f;
+	x -= (float)(int)x - (x < 0.0f ? 1.0f : 0.0f);
+	float y = 8.0f * x * (1.0f - 2.0f * x);
+	return x < 0.5f ? y : -8.0f * (x - 0.5f) * (1.0f - 2.0f * (x - 0.5f));
+}
+
+static u8 ToByte(float value) {
+	return (u8)std::min(255.0f, std::max(0.0f, value + 0.5f));
+}
+
+// composites a straight alpha colour over the pixel
+static void Blend(u8* pixel, float r, float g, float b, float a) {
+	float da = (float)pixel[3] / 255.0f;
+	float oa = a + da * (1.0f - a);
+	if (oa <= 0.0f)
+		return;
+	float source[3] = {r, g, b};
+	for (int c = 0; c < 3; ++c)
+		pixel[c] = ToByte((source[c] * a + (float)pixel[c] * da * (1.0f - a)) / oa);
+	pixel[3] = ToByte(oa * 255.0f);
+}
+
+static Image NewImage(const char* name, int width, int height) {
+	Image image;
+	image.name = name;
+	image.width = width;
+	image.height = height;
+	image.rgba.assign(width * height * 4, 0);
+	return image;
+}
+
+// shaded blobs with dark outlines and anti-aliased edges on a transparent background
+static Image MakeSprite(const char* name, int width, int height, unsigned seed) {
+	Image image = NewImage(name, width, height);
+	s_seed = seed;
+	for (int blob = 0; blob < 12; ++blob) {
+		float cx = width * (0.2f + 0.6f * Random());
+		float cy = height * (0.2f + 0.6f * Random());
+		float rx = width * (0.05f + 0.15f * Random());
+		float ry = height * (0.05f + 0.15f * Random());
+		float r = 255.0f * Random(), g = 255.0f * Random(), b = 255.0f * Random();
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				float dx = ((float)x + 0.5f - cx) / rx;
+				float dy = ((float)y + 0.5f - cy) / ry;
+				float d = (std::sqrt(dx * dx + dy * dy) - 1.0f) * std::min(rx, ry);
+				if (d > 1.0f)
+					continue;
+
+				// one pixel of coverage falloff, a two pixel outline and top-down shading
+				float coverage = std::min(1.0f, 1.0f - d);
+				float shade = d > -2.0f ? 0.3f : 1.2f - 0.5f * (dy + 1.0f) * 0.5f;
+				u8* pixel = &image.rgba[4 * (y * width + x)];
+				Blend(pixel, r * shade, g * shade, b * shade, coverage);
+			}
+		}
+	}
+	return image;
+}
+
+// soft radial glows, nearly all of the alpha range
+static Image MakeEffect(const char* name, int width, int height, unsigned seed) {
+	Image image = NewImage(name, width, height);
+	s_seed = seed;
+	for (int glow = 0; glow < 6; ++glow) {
+		float cx = width * Random(), cy = height * Random();
+		float radius = width * (0.1f + 0.3f * Random());
+		float r = 128.0f + 127.0f * Random(), g = 128.0f + 127.0f * Random(), b = 128.0f + 127.0f * Random();
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				float dx = (float)x - cx, dy = (float)y - cy;
+				float falloff = 1.0f - std::sqrt(dx * dx + dy * dy) / radius;
+				if (falloff > 0.0f)
+					Blend(&image.rgba[4 * (y * width + x)], r, g, b, falloff * falloff);
+			}
+		}
+	}
+	return image;
+}
+
+// opaque textured ground tile: low frequency waves plus fine noise
+static Image MakeTile(const char* name, int width, int height, unsigned seed) {
+	Image image = NewImage(name, width, height);
+	s_seed = seed;
+	float base[3] = {60.0f + 80.0f * Random(), 60.0f + 80.0f * Random(), 40.0f + 60.0f * Random()};
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			float wave = 30.0f * Wave((float)x * 0.07f) * Wave((float)y * 0.05f + 1.5707964f)
+				+ 15.0f * Wave((float)(x + y) * 0.21f);
+			u8* pixel = &image.rgba[4 * (y * width + x)];
+			for (int c = 0; c < 3; ++c)
+				pixel[c] = ToByte(base[c] + wave * (1.0f - 0.3f * c) + 24.0f * (Random() - 0.5f));
+			pixel[3] = 255;
+		}
+	}
+	return image;
+}
+
+// flat panels with one pixel borders, glyph-like detail and cut-out corners
+static Image MakeInterface(const char* name, int width, int height, unsigned seed) {
+	Image image = NewImage(name, width, height);
+	s_seed = seed;
+	for (int panel = 0; panel < 8; ++panel) {
+		int x0 = (int)(width * 0.8f * Random()), y0 = (int)(height * 0.8f * Random());
+		int x1 = std::min(width, x0 + 16 + (int)(width * 0.4f * Random()));
+		int y1 = std::min(height, y0 + 16 + (int)(height * 0.3f * Random()));
+		u8 fill[4] = {(u8)(255 * Random()), (u8)(255 * Random()), (u8)(255 * Random()), (u8)(Random() < 0.3f ? 192 : 255)};
+		for (int y = y0; y < y1; ++y) {
+			for (int x = x0; x < x1; ++x) {
+				int edge = std::min(std::min(x - x0, x1 - 1 - x), std::min(y - y0, y1 - 1 - y));
+				int corner = std::min(x - x0, x1 - 1 - x) + std::min(y - y0, y1 - 1 - y);
+				if (corner < 3)
+					continue;
+				u8* pixel = &image.rgba[4 * (y * width + x)];
+				bool glyph = edge > 3 && ((x * 7 + y * 3) % 11 < 2) && ((x / 6 + y / 9) % 3 == 0);
+				for (int c = 0; c < 3; ++c)
+					pixel[c] = edge == 0 ? 16 : glyph ? (u8)(255 - fill[c]) : fill[c];
+				pixel[3] = edge == 0 ? 255 : fill[3];
+			}
+		}
+	}
+	return image;
+}
+
+static std::vector<Image> MakeCorpus() {
+	std::vector<Image> corpus;
+	corpus.push_back(MakeSprite("sprite", 256, 256, 1));
+	corpus.push_back(MakeEffect("effect", 256, 256, 2));
+	corpus.push_back(MakeTile("tile", 256, 128, 3));
+	corpus.push_back(MakeInterface("interface", 256, 256, 4));
+	corpus.push_back(MakeSprite("odd", 250, 138, 5));
+	return corpus;
+}
+
+// -----------------------------------------------------------------------------
+// measurement
+
+static double Now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// runs the work at least runs times and for at least minimum seconds, returns the best time
+template <typename Work>
+static double Time(Work work, int runs, double minimum) {
+	double best = 1e30, total = 0.0;
+	for (int run = 0; run < runs || total < minimum; ++run) {
+		double start = Now();
+		work();
+		double elapsed = Now() - start;
+		best = std::min(best, elapsed);
+		total += elapsed;
+	}
+	return best;
+}
+
+static unsigned Hash(const std::vector<u8>& data, unsigned hash) {
+	for (u8 byte : data)
+		hash = (hash ^ byte) * 16777619u;
+	return hash;
+}
+
+// squared error sums: colour weighted by the source alpha, as it shows when blended, alpha unweighted
+static void AddError(const u8* source, const u8* result, int pixels, double* colour, double* colourCount,
+	double* alpha) {
+	for (int i = 0; i < pixels; ++i, source += 4, result += 4) {
+		double weight = (double)source[3] / 255.0;
+		for (int c = 0; c < 3; ++c) {
+			double diff = (double)source[c] - (double)result[c];
+			*colour += weight * diff * diff;
+		}
+		*colourCount += 3.0 * weight;
+		double diff = (double)source[3] - (double)result[3];
+		*alpha += diff * diff;
+	}
+}
+
+static Result BenchBlocks(const std::vector<Image>& corpus, int flags, int runs, double minimum) {
+	// gather every complete 4x4 block as 16 contiguous pixels
+	std::vector<u8> blocks;
+	for (const Image& image : corpus) {
+		for (int y = 0; y + 4 <= image.height; y += 4) {
+			for (int x = 0; x + 4 <= image.width; x += 4) {
+				for (int py = 0; py < 4; ++py) {
+					const u8* row = &image.rgba[4 * ((y + py) * image.width + x)];
+					blocks.insert(blocks.end(), row, row + 16);
+				}
+			}
+		}
+	}
+	int count = (int)blocks.size() / 64;
+	int bytesPerBlock = (flags & kDxt1) != 0 ? 8 : 16;
+	std::vector<u8> compressed(count * bytesPerBlock);
+
+	Result result = {};
+	result.seconds = Time([&] {
+		for (int i = 0; i < count; ++i)
+			Compress(&blocks[64 * i], &compressed[bytesPerBlock * i], flags);
+	}, runs, minimum);
+	result.blocks = count;
+	result.bytes = (double)blocks.size();
+
+	std::vector<u8> decompressed(blocks.size());
+	for (int i = 0; i < count; ++i)
+		Decompress(&decompressed[64 * i], &compressed[bytesPerBlock * i], flags);
+	double colour = 0.0, colourCount = 0.0, alpha = 0.0;
+	AddError(blocks.data(), decompressed.data(), count * 16, &colour, &colourCount, &alpha);
+	result.colourError = colourCount > 0.0 ? std::sqrt(colour / colourCount) : 0.0;
+	result.alphaError = std::sqrt(alpha / (count * 16));
+	result.hash = Hash(compressed, 2166136261u);
+	result.decoded = Hash(decompressed, 2166136261u);
+	return result;
+}
+
+static Result BenchImages(const std::vector<Image>& corpus, int flags, int threads, int runs, double minimum) {
+	int bytesPerBlock = (flags & kDxt1) != 0 ? 8 : 16;
+	std::vector<std::vector<u8>> compressed;
+	Result result = {};
+	for (const Image& image : corpus) {
+		compressed.push_back(std::vector<u8>(GetStorageRequirements(image.width, image.height, flags)));
+		result.blocks += ((image.width + 3) / 4) * ((image.height + 3) / 4);
+		result.bytes += (double)image.rgba.size();
+	}
+
+	// each thread compresses its own band of block rows of every image
+	auto band = [&](int thread) {
+		for (size_t i = 0; i < corpus.size(); ++i) {
+			const Image& image = corpus[i];
+			int rows = (image.height + 3) / 4;
+			int first = rows * thread / threads;
+			int last = rows * (thread + 1) / threads;
+			if (first == last)
+				continue;
+			int height = std::min(image.height, 4 * last) - 4 * first;
+			CompressImage(&image.rgba[16 * first * image.width], image.width, height,
+				&compressed[i][first * ((image.width + 3) / 4) * bytesPerBlock], flags);
+		}
+	};
+	result.seconds = Time([&] {
+		std::vector<std::thread> workers;
+		for (int thread = 1; thread < threads; ++thread)
+			workers.push_back(std::thread(band, thread));
+		band(0);
+		for (std::thread& worker : workers)
+			worker.join();
+	}, runs, minimum);
+
+	double colour = 0.0, colourCount = 0.0, alpha = 0.0, pixels = 0.0;
+	result.hash = 2166136261u;
+	result.decoded = 2166136261u;
+	for (size_t i = 0; i < corpus.size(); ++i) {
+		const Image& image = corpus[i];
+		std::vector<u8> decompressed(image.rgba.size());
+		DecompressImage(decompressed.data(), image.width, image.height, compressed[i].data(), flags);
+		AddError(image.rgba.data(), decompressed.data(), image.width * image.height, &colour, &colourCount, &alpha);
+		pixels += image.width * image.height;
+		result.hash = Hash(compressed[i], result.hash);
+		result.decoded = Hash(decompressed, result.decoded);
+	}
+	result.colourError = colourCount > 0.0 ? std::sqrt(colour / colourCount) : 0.0;
+	result.alphaError = std::sqrt(alpha / pixels);
+	return result;
+}
+
+// -----------------------------------------------------------------------------
+// reporting
+
+// compresses the corpus once with statistics and returns the output hash
+static unsigned GatherStatistics(const std::vector<Image>& corpus, int flags, Statistics* statistics) {
+	unsigned hash = 2166136261u;
+	for (const Image& image : corpus) {
+		std::vector<u8> compressed(GetStorageRequirements(image.width, image.height, flags));
+		CompressImage(image.rgba.data(), image.width, image.height, compressed.data(), flags, statistics);
+		hash = Hash(compressed, hash);
+	}
+	return hash;
+}
+
+static void PrintHistogram(const char* prefix, const char* name, const int* counts, int size, const char* const* labels) {
+	std::cout << prefix << "  " << std::left << std::setw(12) << name << std::right;
+	for (int i = 0; i < size; ++i)
+		if (counts[i] != 0)
+			std::cout << ' ' << labels[i] << ':' << counts[i];
+	std::cout << std::endl;
+}
+
+static void PrintStatistics(bool csv, const Statistics& statistics) {
+	static const char* const passes[] = {"0", "1", "2", "3", "4", "5", "6", "7", "8"};
+	static const char* const colours[] = {"0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14",
+		"15", "16"};
+	static const char* const errors[] = {"<1", "<2", "<4", "<8", "<16", "<32", "<64", "<128", ">=128"};
+
+	// csv readers can skip these as comments
+	const char* prefix = csv ? "#" : "";
+	std::cout << prefix << "  " << std::left << std::setw(12) << "fits" << std::right
+		<< " single:" << statistics.singleColourFit << " (" << std::fixed << std::setprecision(3)
+		<< statistics.singleColourSeconds * 1000.0 << " ms)"
+		<< " range:" << statistics.rangeFit << " (" << statistics.rangeFitSeconds * 1000.0 << " ms)"
+		<< " cluster:" << statistics.clusterFit << " (" << statistics.clusterFitSeconds * 1000.0 << " ms)"
+		<< " integer:" << statistics.integerFit << " (" << statistics.integerFitSeconds * 1000.0 << " ms)"
+		<< std::defaultfloat << " of " << statistics.blocks << std::endl;
+	PrintHistogram(prefix, "orderings", statistics.clusterIterations, 9, passes);
+	std::cout << prefix << "  " << std::left << std::setw(12) << "repeats" << std::right << ' '
+		<< statistics.orderingExits << std::endl;
+	PrintHistogram(prefix, "colours", statistics.colours, 17, colours);
+	PrintHistogram(prefix, "rms error", statistics.error, 9, errors);
+}
+
+static double Psnr(double rmse) {
+	return rmse > 0.0 ? 20.0 * std::log10(255.0 / rmse) : 99.0;
+}
+
+static const char* FitName(int flags) {
+	if ((flags & kColourRangeFit) != 0)
+		return "range";
+	if ((flags & kColourIterativeClusterFit) != 0)
+		return "iterative";
+	if ((flags & kColourIntegerFit) != 0)
+		return "integer";
+	return "cluster";
+}
+
+static std::string Describe(int flags) {
+	std::ostringstream name;
+	name << ((flags & kDxt1) != 0 ? "dxt1" : (flags & kDxt3) != 0 ? "dxt3" : "dxt5");
+	name << ' ' << FitName(flags);
+	name << ((flags & kColourMetricUniform) != 0 ? " uniform" : " perceptual");
+	if ((flags & kWeightColourByAlpha) != 0)
+		name << " weighted";
+	return name.str();
+}
+
+// format, fit, metric and weighting as separate fields
+static std::string Fields(int flags, char separator) {
+	std::ostringstream fields;
+	fields << ((flags & kDxt1) != 0 ? "dxt1" : (flags & kDxt3) != 0 ? "dxt3" : "dxt5") << separator
+		<< FitName(flags) << separator
+		<< ((flags & kColourMetricUniform) != 0 ? "uniform" : "perceptual") << separator
+		<< ((flags & kWeightColourByAlpha) != 0 ? 1 : 0);
+	return fields.str();
+}
+
+static void Report(bool csv, int flags, const char* level, int threads, const Result& result, double speedup) {
+	double megabytes = result.bytes / (1024.0 * 1024.0) / result.seconds;
+	double blocks = result.blocks / result.seconds;
+	if (csv) {
+		std::cout << Fields(flags, ',') << ',' << level << ',' << threads << ','
+			<< std::setprecision(6) << result.seconds << ',' << megabytes << ',' << blocks << ','
+			<< result.colourError << ',' << Psnr(result.colourError) << ','
+			<< result.alphaError << ',' << Psnr(result.alphaError) << ','
+			<< speedup << ",0x" << std::hex << std::setw(8) << std::setfill('0') << result.hash
+			<< std::dec << std::setfill(' ') << std::endl;
+	}
+	else {
+		std::cout << std::left << std::setw(36) << Describe(flags) << std::setw(7) << level << std::right
+			<< std::setw(3) << threads << std::fixed << std::setprecision(2)
+			<< std::setw(10) << megabytes << std::setw(12) << std::setprecision(0) << blocks
+			<< std::setprecision(2) << std::setw(9) << result.colourError << std::setw(8) << Psnr(result.colourError)
+			<< std::setw(9) << result.alphaError << std::setw(8) << Psnr(result.alphaError)
+			<< std::setw(8) << speedup << "x  " << std::hex << std::setw(8) << std::setfill('0') << result.hash
+			<< std::dec << std::setfill(' ') << std::defaultfloat << std::endl;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// golden output
+
+static const char* Backend() {
+#if SQUISH_USE_SSE
+	return "sse";
+#elif SQUISH_USE_ALTIVEC
+	return "altivec";
+#else
+	return "float";
+#endif
+}
+
+static std::string GoldenKey(int flags, const char* level) {
+	return Fields(flags, ' ') + ' ' + level;
+}
+
+static bool ReadGolden(const char* path, std::map<std::string, unsigned>* corpus, std::map<std::string, Golden>* golden) {
+	std::ifstream file(path);
+	if (!file)
+		return false;
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream fields(line);
+		std::string first;
+		fields >> first;
+		if (first == "corpus") {
+			std::string name;
+			unsigned hash;
+			fields >> name >> std::hex >> hash;
+			(*corpus)[name] = hash;
+			continue;
+		}
+		std::string fit, metric, weighted, level;
+		Golden entry;
+		fields >> fit >> metric >> weighted >> level >> std::hex >> entry.hash >> entry.decoded >> std::dec
+			>> entry.colourError >> entry.alphaError;
+		if (!fields)
+			return false;
+		(*golden)[first + ' ' + fit + ' ' + metric + ' ' + weighted + ' ' + level] = entry;
+	}
+	return true;
+}
+
+static bool WriteGolden(const char* path, const std::vector<Image>& corpus,
+	const std::vector<std::pair<std::string, Golden>>& golden) {
+	std::ofstream file(path);
+	file << "# squishbench golden output, written by squishbench -w" << std::endl
+		<< "# corpus name input_hash" << std::endl
+		<< "# format fit metric weighted level compressed_hash decompressed_hash colour_rmse alpha_rmse" << std::endl;
+	for (const Image& image : corpus)
+		file << "corpus " << image.name << " 0x" << std::hex << std::setw(8) << std::setfill('0')
+			<< Hash(image.rgba, 2166136261u) << std::dec << std::setfill(' ') << std::endl;
+	for (const auto& entry : golden)
+		file << entry.first << std::hex << std::setfill('0') << " 0x" << std::setw(8) << entry.second.hash
+			<< " 0x" << std::setw(8) << entry.second.decoded << std::dec << std::setfill(' ') << std::fixed
+			<< std::setprecision(4) << ' ' << entry.second.colourError << ' ' << entry.second.alphaError
+			<< std::defaultfloat << std::endl;
+	return (bool)file;
+}
+
+// compares a result with the golden file and returns the number of failures; a
+// different compressed output passes when tolerance >= 0 and neither RMSE is
+// worse than stored by more than tolerance
+static int CheckGolden(const std::map<std::string, Golden>& golden, int flags, const char* level, int threads,
+	const Result& result, double tolerance) {
+	auto found = golden.find(GoldenKey(flags, level));
+	if (found == golden.end()) {
+		std::cerr << Describe(flags) << ' ' << level << ": not in the golden file" << std::endl;
+		return 0;
+	}
+	const Golden& expected = found->second;
+	if (result.hash == expected.hash && result.decoded == expected.decoded)
+		return 0;
+
+	std::cerr << Describe(flags) << ' ' << level << " on " << threads << " threads: ";
+	if (result.hash == expected.hash) {
+		std::cerr << "same blocks decompress differently" << std::endl;
+		return 1;
+	}
+	double colour = result.colourError - expected.colourError;
+	double alpha = result.alphaError - expected.alphaError;
+	std::cerr << "output differs, rmse " << std::fixed << std::setprecision(4) << result.colourError << " / "
+		<< result.alphaError << " against " << expected.colourError << " / " << expected.alphaError << std::defaultfloat;
+	if (tolerance >= 0.0 && colour <= tolerance + 1e-4 && alpha <= tolerance + 1e-4) {
+		std::cerr << ", within the tolerance" << std::endl;
+		return 0;
+	}
+	std::cerr << std::endl;
+	return 1;
+}
+
+int main(int argc, char* argv[]) {
+	// parse the command-line
+	bool csv = false;
+	bool quick = false;
+	bool statistics = false;
+	bool trace = false;
+	bool help = false;
+	const char* check = nullptr;
+	const char* write = nullptr;
+	double tolerance = -1.0;
+	int maxThreads = (int)std::thread::hardware_concurrency();
+	for (int i = 1; i < argc; ++i) {
+		const char* word = argv[i];
+		if (word[0] == '-') {
+			for (int j = 1; word[j] != '\0'; ++j) {
+				switch (word[j]) {
+					case 'h': help = true;
+						break;
+					case 'c': csv = true;
+						break;
+					case 'q': quick = true;
+						break;
+					case 's': statistics = true;
+						break;
+					case 't': trace = true;
+						break;
+					case 'g':
+					case 'w':
+					case 'e':
+						if (i + 1 == argc) {
+							std::cerr << "option '" << word[j] << "' needs a value" << std::endl;
+							return -1;
+						}
+						if (word[j] == 'g')
+							check = argv[++i];
+						else if (word[j] == 'w')
+							write = argv[++i];
+						else
+							tolerance = std::atof(argv[++i]);
+						break;
+					default:
+						std::cerr << "unknown option '" << word[j] << "'" << std::endl;
+						return -1;
+				}
+			}
+		}
+		else
+			maxThreads = std::atoi(word);
+	}
+	if (help) {
+		std::cout
+			<< "SYNTAX" << std::endl
+			<< "\tsquishbench [-chqst] [-g file] [-w file] [-e rmse] [threads]" << std::endl
+			<< "OPTIONS" << std::endl
+			<< "\t-c\tWrite comma separated values instead of a table" << std::endl
+			<< "\t-q\tQuick run: time every test once and skip the iterative fit" << std::endl
+			<< "\t-s\tPrint which colour fit each combination used, with block histograms" << std::endl
+			<< "\t-t\tWrite a Chrome trace of the image level runs to squishbench.json" << std::endl
+			<< "\t-g\tCheck every output against a golden file, such as extra/squishbench.golden" << std::endl
+			<< "\t-w\tWrite the output of this build to a golden file" << std::endl
+			<< "\t-e\tWith -g, pass different output whose RMSE is at most this much worse" << std::endl
+			<< "\tthreads\tHighest thread count for the image level scaling runs (default: one per core)" << std::endl
+			<< "NOTES" << std::endl
+			<< "\tColour error is weighted by the source alpha; alpha error is not." << std::endl
+			<< "\tThe hash covers the compressed output and must not change with the thread count." << std::endl
+			<< "\tGolden files hold the compressed and decompressed hashes of the block and image levels;" << std::endl
+			<< "\tevery thread count and the -s pass are checked against the image level." << std::endl;
+		return 0;
+	}
+	maxThreads = std::max(1, maxThreads);
+
+	int runs = quick ? 1 : 3;
+	double minimum = quick ? 0.0 : 0.25;
+	std::vector<Image> corpus = MakeCorpus();
+
+	std::map<std::string, unsigned> goldenCorpus;
+	std::map<std::string, Golden> golden;
+	std::vector<std::pair<std::string, Golden>> written;
+	if (check != nullptr) {
+		if (!ReadGolden(check, &goldenCorpus, &golden)) {
+			std::cerr << "cannot read " << check << std::endl;
+			return -1;
+		}
+		for (const Image& image : corpus) {
+			auto found = goldenCorpus.find(image.name);
+			if (found == goldenCorpus.end() || found->second != Hash(image.rgba, 2166136261u)) {
+				std::cerr << "the " << image.name << " image differs from the one " << check << " was written for" << std::endl;
+				return 1;
+			}
+		}
+		std::cerr << "checking the " << Backend() << " build against " << check << std::endl;
+	}
+
+	const int formats[] = {kDxt1, kDxt3, kDxt5};
+	const int fits[] = {kColourRangeFit, kColourIntegerFit, kColourClusterFit, kColourIterativeClusterFit};
+	const int metrics[] = {kColourMetricPerceptual, kColourMetricUniform};
+	const int weights[] = {0, kWeightColourByAlpha};
+
+	if (csv)
+		std::cout << "format,fit,metric,weighted,level,threads,seconds,mb_per_s,blocks_per_s,colour_rmse,colour_psnr,"
+			"alpha_rmse,alpha_psnr,speedup,hash" << std::endl;
+	else
+		std::cout << std::left << std::setw(36) << "flags" << std::setw(7) << "level" << std::right << std::setw(3) << "t"
+			<< std::setw(10) << "MB/s" << std::setw(12) << "blocks/s" << std::setw(9) << "rgb rmse" << std::setw(8) << "psnr"
+			<< std::setw(9) << "a rmse" << std::setw(8) << "psnr" << std::setw(9) << "speedup" << "  hash" << std::endl;
+
+	if (trace && !TraceStart(1 << 22)) {
+		std::cerr << "cannot start the trace" << std::endl;
+		return -1;
+	}
+
+	int mismatches = 0;
+	for (int format : formats) {
+		for (int fit : fits) {
+			if (quick && fit == kColourIterativeClusterFit)
+				continue;
+			for (int metric : metrics) {
+				for (int weight : weights) {
+					int flags = format | fit | metric | weight;
+					Result block = BenchBlocks(corpus, flags, runs, minimum);
+					Report(csv, flags, "block", 1, block, 1.0);
+
+					Result single = BenchImages(corpus, flags, 1, runs, minimum);
+					Report(csv, flags, "image", 1, single, 1.0);
+					if (check != nullptr) {
+						mismatches += CheckGolden(golden, flags, "block", 1, block, tolerance);
+						mismatches += CheckGolden(golden, flags, "image", 1, single, tolerance);
+					}
+					if (write != nullptr) {
+						written.push_back({GoldenKey(flags, "block"), {block.hash, block.decoded, block.colourError, block.alphaError}});
+						written.push_back({GoldenKey(flags, "image"), {single.hash, single.decoded, single.colourError, single.alphaError}});
+					}
+					for (int threads = 2; threads <= maxThreads; threads *= 2) {
+						Result result = BenchImages(corpus, flags, threads, runs, minimum);
+						Report(csv, flags, "image", threads, result, single.seconds / result.seconds);
+						if (result.hash != single.hash) {
+							std::cerr << Describe(flags) << ": output on " << threads << " threads differs" << std::endl;
+							++mismatches;
+						}
+					}
+
+					if (statistics) {
+						Statistics counters = {};
+						if (GatherStatistics(corpus, flags, &counters) != single.hash) {
+							std::cerr << Describe(flags) << ": output with statistics differs" << std::endl;
+							++mismatches;
+						}
+						PrintStatistics(csv, counters);
+					}
+				}
+			}
+		}
+	}
+
+	if (trace) {
+		TraceStop();
+		if (TraceDropped() != 0)
+			std::cerr << "the trace buffer overflowed, the first " << TraceDropped() << " events are missing" << std::endl;
+		if (!TraceWrite("squishbench.json")) {
+			std::cerr << "cannot write squishbench.json" << std::endl;
+			return -1;
+		}
+	}
+
+	if (write != nullptr && !WriteGolden(write, corpus, written)) {
+		std::cerr << "cannot write " << write << std::endl;
+		return -1;
+	}
+	if (check != nullptr)
+		std::cerr << (mismatches != 0 ? "FAILED" : "passed") << ": " << Backend() << " build against " << check << std::endl;
+
+	// done
+	return mismatches != 0 ? 1 : 0;
+}
@@ -493,6 +493,8 @@ int main(int argc, char* argv[]) {
 							break;
 						case 'i': fit = kColourIterativeClusterFit;
 							break;
+						case 'n': fit = kColourIntegerFit;
+							break;
 						case 'w': extra = kWeightColourByAlpha;
 							break;
 						case '-': arguments = false;
@@ -525,6 +527,7 @@ int main(int argc, char* argv[]) {
 				<< "\t-u\tUse a uniform colour metric during colour compression" << std::endl
 				<< "\t-r\tUse the fast but inferior range-based colour compressor" << std::endl
 				<< "\t-i\tUse the very slow but slightly better iterative colour compressor" << std::endl
+				<< "\t-n\tUse the integer colour compressor, which gives the same output on every machine" << std::endl
 				<< "\t-w\tWeight colour values by alpha in the cluster colour compressor" << std::endl
 				<< "\t-d\tDecompress source raw dxt to target png" << std::endl
 				<< "\t-e\tDiff source and target png" << std::endl;
@@ -0,0 +1,299 @@
+/* -----------------------------------------------------------------------------
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+
+#include "integerfit.h"
+#include "colourset.h"
+#include "colourblock.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#if SQUISH_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
+namespace squish {
+	//! Divides, rounding halves away from zero; d must be positive.
+	static long long RoundDivide(long long n, long long d) {
+		return (n >= 0) ? (n + d / 2) / d : -((-n + d / 2) / d);
+	}
+
+	static int Pack565(const int* rgb) {
+		int r = (int)RoundDivide(31 * rgb[0], 255);
+		int g = (int)RoundDivide(63 * rgb[1], 255);
+		int b = (int)RoundDivide(31 * rgb[2], 255);
+		return (r << 11) | (g << 5) | b;
+	}
+
+	static void Unpack565(int value, int* rgb) {
+		int r = (value >> 11) & 0x1f;
+		int g = (value >> 5) & 0x3f;
+		int b = value & 0x1f;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+
+	//! Scales a vector by a power of two so its largest component has 15 bits.
+	static void Normalise(long long* v) {
+		long long largest = 0;
+		for (int i = 0; i < 3; ++i)
+			largest = std::max(largest, v[i] < 0 ? -v[i] : v[i]);
+		if (largest == 0)
+			return;
+		for (; largest >= (1 << 15); largest /= 2)
+			for (int i = 0; i < 3; ++i)
+				v[i] /= 2;
+		for (; largest < (1 << 14); largest *= 2)
+			for (int i = 0; i < 3; ++i)
+				v[i] *= 2;
+	}
+
+	IntegerFit::IntegerFit(const ColourSet* colours, int flags)
+		: ColourFit(colours, flags),
+		  m_besterror(LLONG_MAX) {
+		// the metric in 1/128ths, small enough that a weighted difference fits in 16 bits
+		bool perceptual = ((m_flags & kColourMetricPerceptual) != 0);
+		m_metric[0] = perceptual ? 27 : 1;
+		m_metric[1] = perceptual ? 92 : 1;
+		m_metric[2] = perceptual ? 9 : 1;
+
+		// cache the points, padding to 16 with empty ones
+		m_count = m_colours->GetCount();
+		const u8* values = m_colours->GetColours();
+		const int* weights = m_colours->GetIntegerWeights();
+		for (int i = 0; i < 16; ++i) {
+			for (int c = 0; c < 3; ++c)
+				m_points[i][c] = (i < m_count) ? values[4 * i + c] : 0;
+			m_weights[i] = (i < m_count) ? weights[i] : 0;
+			m_packed[0][i] = m_points[i][0] | (m_points[i][1] << 16);
+			m_packed[1][i] = m_points[i][2];
+		}
+
+		// get the covariance matrix, scaled by the total weight squared
+		long long total = 0, sums[3] = {0, 0, 0}, products[3][3] = {};
+		for (int i = 0; i < m_count; ++i) {
+			total += m_weights[i];
+			for (int a = 0; a < 3; ++a) {
+				sums[a] += (long long)m_weights[i] * m_points[i][a];
+				for (int b = 0; b < 3; ++b)
+					products[a][b] += (long long)m_weights[i] * m_points[i][a] * m_points[i][b];
+			}
+		}
+		long long covariance[3][3];
+		for (int a = 0; a < 3; ++a)
+			for (int b = 0; b < 3; ++b)
+				covariance[a][b] = total * products[a][b] - sums[a] * sums[b];
+
+		// compute the principle component by power iteration, from the row with the most variance
+		int row = 0;
+		for (int a = 1; a < 3; ++a)
+			if (covariance[a][a] > covariance[row][row])
+				row = a;
+		long long axis[3] = {covariance[row][0], covariance[row][1], covariance[row][2]};
+		Normalise(axis);
+		for (int iteration = 0; iteration < 8; ++iteration) {
+			long long next[3];
+			for (int a = 0; a < 3; ++a)
+				next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+			Normalise(next);
+			std::memcpy(axis, next, sizeof(axis));
+		}
+
+		// start from the points at either end of the axis
+		int min = 0, max = 0;
+		long long lowest = 0, highest = 0;
+		for (int i = 0; i < m_count; ++i) {
+			long long dot = axis[0] * m_points[i][0] + axis[1] * m_points[i][1] + axis[2] * m_points[i][2];
+			if (i == 0 || dot < lowest) {
+				lowest = dot;
+				min = i;
+			}
+			if (i == 0 || dot > highest) {
+				highest = dot;
+				max = i;
+			}
+		}
+		m_start = Pack565(m_points[max]);
+		m_end = Pack565(m_points[min]);
+	}
+
+	void IntegerFit::Compress3(void* block) {
+		Fit(3, block);
+	}
+
+	void IntegerFit::Compress4(void* block) {
+		Fit(4, block);
+	}
+
+	void IntegerFit::Fit(int steps, void* block) {
+		int start = m_start;
+		int end = m_end;
+		u8 indices[16];
+		long long error = ChooseIndices(start, end, steps, indices);
+
+		// refine the endpoints by least squares while the error drops
+		for (int iteration = 0; iteration < kRefinements; ++iteration) {
+			int nextStart, nextEnd;
+			if (!SolveEndpoints(indices, steps, &nextStart, &nextEnd) || (nextStart == start && nextEnd == end))
+				break;
+
+			u8 nextIndices[16];
+			long long nextError = ChooseIndices(nextStart, nextEnd, steps, nextIndices);
+			if (nextError >= error)
+				break;
+
+			start = nextStart;
+			end = nextEnd;
+			error = nextError;
+			std::memcpy(indices, nextIndices, sizeof(indices));
+		}
+
+		// save the block if necessary
+		if (error < m_besterror) {
+			u8 remapped[16];
+			m_colours->RemapIndices(indices, remapped);
+			if (steps == 3)
+				WriteColourBlock3(start, end, remapped, block);
+			else
+				WriteColourBlock4(start, end, remapped, block);
+			m_besterror = error;
+		}
+	}
+
+	/*! @brief Picks the nearest palette entry for every point.
+
+		The palette is built as the decoder builds it from the packed endpoints,
+		and ties go to the lower entry. Returns the weighted error.
+	*/
+	long long IntegerFit::ChooseIndices(int start, int end, int steps, u8* indices) const {
+		int codes[4][3];
+		Unpack565(start, codes[0]);
+		Unpack565(end, codes[1]);
+		for (int c = 0; c < 3; ++c) {
+			if (steps == 3)
+				codes[2][c] = (codes[0][c] + codes[1][c]) / 2;
+			else {
+				codes[2][c] = (2 * codes[0][c] + codes[1][c]) / 3;
+				codes[3][c] = (codes[0][c] + 2 * codes[1][c]) / 3;
+			}
+		}
+
+		int best[16], choice[16];
+#if SQUISH_USE_SSE > 1
+		// four points per register, with red and green paired for pmaddwd
+		const __m128i metricRg = _mm_set1_epi32(m_metric[0] | (m_metric[1] << 16));
+		const __m128i metricB = _mm_set1_epi32(m_metric[2]);
+		__m128i errors[4], entries[4];
+		for (int p = 0; p < steps; ++p) {
+			__m128i codeRg = _mm_set1_epi32(codes[p][0] | (codes[p][1] << 16));
+			__m128i codeB = _mm_set1_epi32(codes[p][2]);
+			__m128i entry = _mm_set1_epi32(p);
+			for (int k = 0; k < 4; ++k) {
+				__m128i rg = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)m_packed[0] + k), codeRg);
+				__m128i b = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)m_packed[1] + k), codeB);
+				__m128i error = _mm_add_epi32(_mm_madd_epi16(rg, _mm_mullo_epi16(rg, metricRg)),
+					_mm_madd_epi16(b, _mm_mullo_epi16(b, metricB)));
+				if (p == 0) {
+					errors[k] = error;
+					entries[k] = entry;
+					continue;
+				}
+				__m128i better = _mm_cmplt_epi32(error, errors[k]);
+				errors[k] = _mm_or_si128(_mm_and_si128(better, error), _mm_andnot_si128(better, errors[k]));
+				entries[k] = _mm_or_si128(_mm_and_si128(better, entry), _mm_andnot_si128(better, entries[k]));
+			}
+		}
+		for (int k = 0; k < 4; ++k) {
+			_mm_storeu_si128((__m128i*)best + k, errors[k]);
+			_mm_storeu_si128((__m128i*)choice + k, entries[k]);
+		}
+#else
+		for (int i = 0; i < m_count; ++i) {
+			for (int p = 0; p < steps; ++p) {
+				int error = 0;
+				for (int c = 0; c < 3; ++c) {
+					int d = m_points[i][c] - codes[p][c];
+					error += d * d * m_metric[c];
+				}
+				if (p == 0 || error < best[i]) {
+					best[i] = error;
+					choice[i] = p;
+				}
+			}
+		}
+#endif
+
+		long long total = 0;
+		for (int i = 0; i < m_count; ++i) {
+			indices[i] = (u8)choice[i];
+			total += (long long)m_weights[i] * best[i];
+		}
+		return total;
+	}
+
+	/*! @brief Solves for the endpoints that best fit the given indices.
+
+		Each index stands for a fixed mix of the endpoints, so the weighted least
+		squares problem is a 2x2 system. It is solved exactly and the result is
+		rounded straight to the 5:6:5 grid. Returns false if every point has the
+		same mix, which leaves the system singular.
+	*/
+	bool IntegerFit::SolveEndpoints(const u8* indices, int steps, int* start, int* end) const {
+		// the share of the start in each palette entry, in 1/scale steps
+		static const int shares3[3] = {2, 0, 1};
+		static const int shares4[4] = {3, 0, 2, 1};
+		const int* shares = (steps == 3) ? shares3 : shares4;
+		const long long scale = steps - 1;
+
+		long long alpha2 = 0, beta2 = 0, alphabeta = 0, alphax[3] = {0, 0, 0}, betax[3] = {0, 0, 0};
+		for (int i = 0; i < m_count; ++i) {
+			long long alpha = shares[indices[i]];
+			long long beta = scale - alpha;
+			long long w = m_weights[i];
+			alpha2 += w * alpha * alpha;
+			beta2 += w * beta * beta;
+			alphabeta += w * alpha * beta;
+			for (int c = 0; c < 3; ++c) {
+				alphax[c] += w * alpha * m_points[i][c];
+				betax[c] += w * beta * m_points[i][c];
+			}
+		}
+
+		long long determinant = alpha2 * beta2 - alphabeta * alphabeta;
+		if (determinant <= 0)
+			return false;
+
+		int a[3], b[3];
+		for (int c = 0; c < 3; ++c) {
+			int limit = (c == 1) ? 63 : 31;
+			long long numeratorA = scale * (beta2 * alphax[c] - alphabeta * betax[c]);
+			long long numeratorB = scale * (alpha2 * betax[c] - alphabeta * alphax[c]);
+			a[c] = (int)std::min<long long>(limit, std::max<long long>(0, RoundDivide(numeratorA * limit, determinant * 255)));
+			b[c] = (int)std::min<long long>(limit, std::max<long long>(0, RoundDivide(numeratorB * limit, determinant * 255)));
+		}
+		*start = (a[0] << 11) | (a[1] << 5) | a[2];
+		*end = (b[0] << 11) | (b[1] << 5) | b[2];
+		return true;
+	}
+} // namespace squish
@@ -0,0 +1,66 @@
+/* -----------------------------------------------------------------------------
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+
+#ifndef SQUISH_INTEGERFIT_H
+#define SQUISH_INTEGERFIT_H
+
+#include <squish.h>
+#include "colourfit.h"
+
+namespace squish {
+	class ColourSet;
+
+	/*! @brief A colour fit done entirely in integer arithmetic
+
+		The points are fit along their principal axis, found by power iteration
+		on the integer covariance, and the endpoints are then refined by least
+		squares on the chosen indices. No floating point is involved, so every
+		build and processor writes the same blocks.
+	*/
+	class IntegerFit : public ColourFit {
+		public:
+			IntegerFit(const ColourSet* colours, int flags);
+
+		private:
+			void Compress3(void* block) override;
+			void Compress4(void* block) override;
+
+			void Fit(int steps, void* block);
+			long long ChooseIndices(int start, int end, int steps, u8* indices) const;
+			bool SolveEndpoints(const u8* indices, int steps, int* start, int* end) const;
+
+			enum { kRefinements = 3 };
+
+			int m_count;
+			int m_points[16][3];
+			int m_weights[16];
+			int m_packed[2][16]; // red | green << 16, and blue, for pmaddwd
+			int m_metric[3];
+			int m_start;
+			int m_end;
+			long long m_besterror;
+	};
+} // namespace squish
+
+#endif // ndef SQUISH_INTEGERFIT_H
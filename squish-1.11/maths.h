@@ -174,6 +174,14 @@ namespace squish {
 		return Dot(v, v);
 	}
 
+	//! Counts the set bits of a 16 bit mask.
+	inline int BitCount(int bits) {
+		bits = bits - ((bits >> 1) & 0x5555);
+		bits = (bits & 0x3333) + ((bits >> 2) & 0x3333);
+		bits = (bits + (bits >> 4)) & 0x0f0f;
+		return (bits + (bits >> 8)) & 0x1f;
+	}
+
 	class Sym3x3 {
 		public:
 			Sym3x3() {
@@ -28,22 +28,26 @@
 #include "maths.h"
 #include "rangefit.h"
 #include "clusterfit.h"
+#include "integerfit.h"
 #include "colourblock.h"
 #include "alpha.h"
 #include "singlecolourfit.h"
+#include "trace.h"
+#include <chrono>
+#include <cmath>
 
 namespace squish {
 	static int FixFlags(int flags) {
 		// grab the flag bits
 		int method = flags & (kDxt1 | kDxt3 | kDxt5);
-		int fit = flags & (kColourIterativeClusterFit | kColourClusterFit | kColourRangeFit);
+		int fit = flags & (kColourIterativeClusterFit | kColourClusterFit | kColourRangeFit | kColourIntegerFit);
 		int metric = flags & (kColourMetricPerceptual | kColourMetricUniform);
 		int extra = flags & kWeightColourByAlpha;
 
 		// set defaults
 		if (method != kDxt3 && method != kDxt5)
 			method = kDxt1;
-		if (fit != kColourRangeFit)
+		if (fit != kColourRangeFit && fit != kColourIterativeClusterFit && fit != kColourIntegerFit)
 			fit = kColourClusterFit;
 		if (metric != kColourMetricUniform)
 			metric = kColourMetricPerceptual;
@@ -52,12 +56,42 @@ namespace squish {
 		return method | fit | metric | extra;
 	}
 
-	void Compress(const u8* rgba, void* block, int flags) {
+	void Compress(const u8* rgba, void* block, int flags, Statistics* statistics) {
 		// compress with full mask
-		CompressMasked(rgba, 0xffff, block, flags);
+		CompressMasked(rgba, 0xffff, block, flags, statistics);
 	}
 
-	void CompressMasked(const u8* rgba, int mask, void* block, int flags) {
+	static double Seconds(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	static void RecordError(const u8* rgba, int mask, const void* colourBlock, int flags, Statistics* statistics) {
+		// decompress the colour we just wrote
+		u8 decoded[16 * 4];
+		bool isDxt1 = ((flags & kDxt1) != 0);
+		DecompressColour(decoded, colourBlock, isDxt1);
+
+		// sum the squared error over the enabled pixels
+		int sum = 0, pixels = 0;
+		for (int i = 0; i < 16; ++i) {
+			if ((mask & (1 << i)) == 0 || (isDxt1 && decoded[4 * i + 3] == 0))
+				continue;
+			for (int j = 0; j < 3; ++j) {
+				int d = (int)rgba[4 * i + j] - (int)decoded[4 * i + j];
+				sum += d * d;
+			}
+			++pixels;
+		}
+
+		// bucket by powers of two
+		float rms = (pixels == 0) ? 0.0f : std::sqrt((float)sum / (float)(3 * pixels));
+		int bucket = 0;
+		for (float limit = 1.0f; bucket < 8 && rms >= limit; limit *= 2.0f)
+			++bucket;
+		++statistics->error[bucket];
+	}
+
+	void CompressMasked(const u8* rgba, int mask, void* block, int flags, Statistics* statistics) {
 		// fix any bad flags
 		flags = FixFlags(flags);
 
@@ -69,22 +103,46 @@ namespace squish {
 
 		// create the minimal point set
 		ColourSet colours(rgba, mask, flags);
+		auto start = std::chrono::steady_clock::time_point();
+		if (statistics != nullptr)
+			start = std::chrono::steady_clock::now();
 
 		// check the compression type and compress colour
 		if (colours.GetCount() == 1) {
 			// always do a single colour fit
 			SingleColourFit fit(&colours, flags);
 			fit.Compress(colourBlock);
+			if (statistics != nullptr) {
+				++statistics->singleColourFit;
+				statistics->singleColourSeconds += Seconds(start);
+			}
 		}
 		else if ((flags & kColourRangeFit) != 0 || colours.GetCount() == 0) {
 			// do a range fit
 			RangeFit fit(&colours, flags);
 			fit.Compress(colourBlock);
+			if (statistics != nullptr) {
+				++statistics->rangeFit;
+				statistics->rangeFitSeconds += Seconds(start);
+			}
+		}
+		else if ((flags & kColourIntegerFit) != 0) {
+			// do an integer fit
+			IntegerFit fit(&colours, flags);
+			fit.Compress(colourBlock);
+			if (statistics != nullptr) {
+				++statistics->integerFit;
+				statistics->integerFitSeconds += Seconds(start);
+			}
 		}
 		else {
 			// default to a cluster fit (could be iterative or not)
-			ClusterFit fit(&colours, flags);
+			ClusterFit fit(&colours, flags, statistics);
 			fit.Compress(colourBlock);
+			if (statistics != nullptr) {
+				++statistics->clusterFit;
+				statistics->clusterFitSeconds += Seconds(start);
+			}
 		}
 
 		// compress alpha separately if necessary
@@ -92,6 +150,13 @@ namespace squish {
 			CompressAlphaDxt3(rgba, mask, alphaBock);
 		else if ((flags & kDxt5) != 0)
 			CompressAlphaDxt5(rgba, mask, alphaBock);
+
+		// record the block
+		if (statistics != nullptr) {
+			++statistics->blocks;
+			++statistics->colours[colours.GetCount()];
+			RecordError(rgba, mask, colourBlock, flags, statistics);
+		}
 	}
 
 	void Decompress(u8* rgba, const void* block_source, int flags) {
@@ -124,7 +189,9 @@ namespace squish {
 		return blockcount * blocksize;
 	}
 
-	void CompressImage(const u8* rgba, int width, int height, void* blocks, int flags) {
+	void CompressImage(const u8* rgba, int width, int height, void* blocks, int flags, Statistics* statistics) {
+		TraceScope trace("CompressImage");
+
 		// fix any bad flags
 		flags = FixFlags(flags);
 
@@ -163,7 +230,7 @@ namespace squish {
 				}
 
 				// compress it into the output
-				CompressMasked(sourceRgba, mask, targetBlock, flags);
+				CompressMasked(sourceRgba, mask, targetBlock, flags, statistics);
 
 				// advance
 				targetBlock += bytesPerBlock;
@@ -172,6 +239,8 @@ namespace squish {
 	}
 
 	void DecompressImage(u8* rgba, int width, int height, const void* blocks, int flags) {
+		TraceScope trace("DecompressImage");
+
 		// fix any bad flags
 		flags = FixFlags(flags);
 
@@ -214,35 +283,73 @@ namespace squish {
 	}
 
 
+#ifdef _WIN32
+#define SQUISH_EXPORT __declspec(dllexport)
+#else
+#define SQUISH_EXPORT __attribute__((visibility("default")))
+#endif
+
 	// DLL EXPORTS
 	extern "C" {
-	__declspec(dllexport) int _DLLEXPORT_FixFlags(int flags) {
+	SQUISH_EXPORT int _DLLEXPORT_FixFlags(int flags) {
 		return FixFlags(flags);
 	}
 
-	__declspec(dllexport) void _DLLEXPORT_Compress(const u8* rgba, void* block, int flags) {
+	SQUISH_EXPORT void _DLLEXPORT_Compress(const u8* rgba, void* block, int flags) {
 		Compress(rgba, block, flags);
 	}
 
-	__declspec(dllexport) void _DLLEXPORT_CompressMasked(const u8* rgba, int mask, void* block, int flags) {
+	SQUISH_EXPORT void _DLLEXPORT_CompressMasked(const u8* rgba, int mask, void* block, int flags) {
 		CompressMasked(rgba, mask, block, flags);
 	}
 
-	__declspec(dllexport) void _DLLEXPORT_Decompress(u8* rgba, const void* block_source, int flags) {
+	SQUISH_EXPORT void _DLLEXPORT_CompressMaskedWithStatistics(const u8* rgba, int mask, void* block, int flags, Statistics* statistics) {
+		CompressMasked(rgba, mask, block, flags, statistics);
+	}
+
+	SQUISH_EXPORT void _DLLEXPORT_Decompress(u8* rgba, const void* block_source, int flags) {
 		Decompress(rgba, block_source, flags);
 	}
 
-	__declspec(dllexport) int _DLLEXPORT_GetStorageRequirements(int width, int height, int flags) {
+	SQUISH_EXPORT int _DLLEXPORT_GetStorageRequirements(int width, int height, int flags) {
 		return GetStorageRequirements(width, height, flags);
 	}
 
-	__declspec(dllexport) void _DLLEXPORT_CompressImage(const u8* rgba, int width, int height, void* blocks_dest, int flags) {
+	SQUISH_EXPORT void _DLLEXPORT_CompressImage(const u8* rgba, int width, int height, void* blocks_dest, int flags) {
 		CompressImage(rgba, width, height, blocks_dest, flags);
 	}
 
-	__declspec(dllexport) void _DLLEXPORT_DecompressImage(u8* rgba, int width, int height, const void* blocks_source, int flags) {
+	SQUISH_EXPORT void _DLLEXPORT_CompressImageWithStatistics(const u8* rgba, int width, int height, void* blocks_dest, int flags, Statistics* statistics) {
+		CompressImage(rgba, width, height, blocks_dest, flags, statistics);
+	}
+
+	SQUISH_EXPORT void _DLLEXPORT_DecompressImage(u8* rgba, int width, int height, const void* blocks_source, int flags) {
 		DecompressImage(rgba, width, height, blocks_source, flags);
 	}
+
+	SQUISH_EXPORT int _DLLEXPORT_TraceStart(int capacity) {
+		return TraceStart(capacity) ? 1 : 0;
+	}
+
+	SQUISH_EXPORT void _DLLEXPORT_TraceStop() {
+		TraceStop();
+	}
+
+	SQUISH_EXPORT void _DLLEXPORT_TraceSetCallback(TraceCallback callback, void* user) {
+		TraceSetCallback(callback, user);
+	}
+
+	SQUISH_EXPORT int _DLLEXPORT_TraceRead(TraceEvent* events, int max) {
+		return TraceRead(events, max);
+	}
+
+	SQUISH_EXPORT int _DLLEXPORT_TraceDropped() {
+		return TraceDropped();
+	}
+
+	SQUISH_EXPORT int _DLLEXPORT_TraceWrite(const char* path) {
+		return TraceWrite(path) ? 1 : 0;
+	}
 	}
 }
 
@@ -61,7 +61,63 @@ namespace squish {
 		kColourMetricUniform = (1 << 6),
 
 		//! Weight the colour by alpha during cluster fit (disabled by default).
-		kWeightColourByAlpha = (1 << 7)
+		kWeightColourByAlpha = (1 << 7),
+
+		//! Use a fast colour compressor with no floating point, which writes the same blocks on every build and machine.
+		kColourIntegerFit = (1 << 9)
+	};
+
+	// -----------------------------------------------------------------------------
+
+	/*! @brief Counters gathered while compressing.
+
+		Pass a zeroed Statistics to Compress, CompressMasked or CompressImage to
+		find out which colour fit each block took and how well it did. The
+		counters accumulate, so the same structure can be passed for many calls.
+		They are not synchronised; give each thread its own and add them up.
+	*/
+	struct Statistics {
+		//! Blocks compressed.
+		int blocks;
+
+		//! Blocks with a single colour, fit from the lookup tables.
+		int singleColourFit;
+
+		//! Blocks fit with the range fit.
+		int rangeFit;
+
+		//! Blocks fit with the cluster fit.
+		int clusterFit;
+
+		//! Blocks fit with the integer fit.
+		int integerFit;
+
+		/*! @brief Cluster fits by the number of orderings searched (1 to 8).
+
+			Counted once for each 3 and 4 colour search, so a DXT1 block adds two.
+			Only kColourIterativeClusterFit goes beyond one ordering.
+		*/
+		int clusterIterations[9];
+
+		//! Iterations cut short because the new ordering had already been tried.
+		int orderingExits;
+
+		//! Blocks by the number of distinct colours after masking (0 to 16).
+		int colours[17];
+
+		/*! @brief Blocks by their RMS colour error, in steps of 0-255 per channel.
+
+			The buckets are [0,1), [1,2), [2,4), [4,8) and so on, with the last one
+			holding everything from 128. Only enabled pixels count, and with DXT1
+			pixels that become transparent are skipped.
+		*/
+		int error[9];
+
+		//! Seconds spent in each colour fit.
+		double singleColourSeconds;
+		double rangeFitSeconds;
+		double clusterFitSeconds;
+		double integerFitSeconds;
 	};
 
 	// -----------------------------------------------------------------------------
@@ -71,6 +127,7 @@ namespace squish {
 		@param rgba		The rgba values of the 16 source pixels.
 		@param block	Storage for the compressed DXT block.
 		@param flags	Compression flags.
+		@param statistics	Optional counters to add this block to.
 		
 		The source pixels should be presented as a contiguous array of 16 rgba
 		values, with each component as 1 byte each. In memory this should be:
@@ -85,17 +142,17 @@ namespace squish {
 		The flags parameter can also specify a preferred colour compressor and 
 		colour error metric to use when fitting the RGB components of the data. 
 		Possible colour compressors are: kColourClusterFit (the default), 
-		kColourRangeFit or kColourIterativeClusterFit. Possible colour error metrics 
-		are: kColourMetricPerceptual (the default) or kColourMetricUniform. If no 
-		flags are specified in any particular category then the default will be 
-		used. Unknown flags are ignored.
+		kColourRangeFit, kColourIterativeClusterFit or kColourIntegerFit. Possible
+		colour error metrics are: kColourMetricPerceptual (the default) or
+		kColourMetricUniform. If no flags are specified in any particular category
+		then the default will be used. Unknown flags are ignored.
 		
 		When using kColourClusterFit, an additional flag can be specified to
 		weight the colour of each pixel by its alpha value. For images that are
 		rendered using alpha blending, this can significantly increase the 
 		perceived quality.
 	*/
-	void Compress(const u8* rgba, void* block, int flags);
+	void Compress(const u8* rgba, void* block, int flags, Statistics* statistics = nullptr);
 
 	// -----------------------------------------------------------------------------
 
@@ -105,6 +162,7 @@ namespace squish {
 		@param mask		The valid pixel mask.
 		@param block	Storage for the compressed DXT block.
 		@param flags	Compression flags.
+		@param statistics	Optional counters to add this block to.
 		
 		The source pixels should be presented as a contiguous array of 16 rgba
 		values, with each component as 1 byte each. In memory this should be:
@@ -126,17 +184,17 @@ namespace squish {
 		The flags parameter can also specify a preferred colour compressor and 
 		colour error metric to use when fitting the RGB components of the data. 
 		Possible colour compressors are: kColourClusterFit (the default), 
-		kColourRangeFit or kColourIterativeClusterFit. Possible colour error metrics 
-		are: kColourMetricPerceptual (the default) or kColourMetricUniform. If no 
-		flags are specified in any particular category then the default will be 
-		used. Unknown flags are ignored.
+		kColourRangeFit, kColourIterativeClusterFit or kColourIntegerFit. Possible
+		colour error metrics are: kColourMetricPerceptual (the default) or
+		kColourMetricUniform. If no flags are specified in any particular category
+		then the default will be used. Unknown flags are ignored.
 		
 		When using kColourClusterFit, an additional flag can be specified to
 		weight the colour of each pixel by its alpha value. For images that are
 		rendered using alpha blending, this can significantly increase the 
 		perceived quality.
 	*/
-	void CompressMasked(const u8* rgba, int mask, void* block, int flags);
+	void CompressMasked(const u8* rgba, int mask, void* block, int flags, Statistics* statistics = nullptr);
 
 	// -----------------------------------------------------------------------------
 
@@ -184,6 +242,7 @@ namespace squish {
 		@param height	The height of the source image.
 		@param blocks	Storage for the compressed output.
 		@param flags	Compression flags.
+		@param statistics	Optional counters to add every block to.
 		
 		The source pixels should be presented as a contiguous array of width*height
 		rgba values, with each component as 1 byte each. In memory this should be:
@@ -198,10 +257,10 @@ namespace squish {
 		The flags parameter can also specify a preferred colour compressor and 
 		colour error metric to use when fitting the RGB components of the data. 
 		Possible colour compressors are: kColourClusterFit (the default), 
-		kColourRangeFit or kColourIterativeClusterFit. Possible colour error metrics 
-		are: kColourMetricPerceptual (the default) or kColourMetricUniform. If no 
-		flags are specified in any particular category then the default will be 
-		used. Unknown flags are ignored.
+		kColourRangeFit, kColourIterativeClusterFit or kColourIntegerFit. Possible
+		colour error metrics are: kColourMetricPerceptual (the default) or
+		kColourMetricUniform. If no flags are specified in any particular category
+		then the default will be used. Unknown flags are ignored.
 		
 		When using kColourClusterFit, an additional flag can be specified to
 		weight the colour of each pixel by its alpha value. For images that are
@@ -212,7 +271,7 @@ namespace squish {
 		much memory is required in the compressed image, use
 		squish::GetStorageRequirements.
 	*/
-	void CompressImage(const u8* rgba, int width, int height, void* blocks, int flags);
+	void CompressImage(const u8* rgba, int width, int height, void* blocks, int flags, Statistics* statistics = nullptr);
 
 	// -----------------------------------------------------------------------------
 
@@ -0,0 +1,217 @@
+/* -----------------------------------------------------------------------------
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+#include "trace.h"
+#include <chrono>
+#include <cstdio>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <functional>
+#include <thread>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace squish {
+	std::atomic<int> g_traceEnabled(0);
+
+	namespace {
+		// one ring buffer entry; sequence is the event index + 1 once the fields are
+		// complete and 0 while a writer is filling them in
+		struct TraceSlot {
+			std::atomic<unsigned long long> sequence;
+			std::atomic<const char*> name;
+			std::atomic<long long> ns;
+			std::atomic<unsigned> thread;
+			std::atomic<int> phase;
+		};
+
+		TraceSlot* s_ring = nullptr;
+		unsigned long long s_capacity = 0;
+		long long s_origin = 0;
+		std::atomic<unsigned long long> s_next(0);
+		std::atomic<bool> s_recording(false);
+		std::atomic<TraceCallback> s_callback(nullptr);
+		std::atomic<void*> s_user(nullptr);
+
+		long long Now() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		unsigned CurrentThread() {
+			thread_local unsigned id = 0;
+			if (id == 0) {
+#if defined(_WIN32)
+				id = (unsigned)GetCurrentThreadId();
+#elif defined(__linux__)
+				id = (unsigned)syscall(SYS_gettid);
+#else
+				id = (unsigned)std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+			}
+			return id;
+		}
+
+		unsigned CurrentProcess() {
+#ifdef _WIN32
+			return (unsigned)GetCurrentProcessId();
+#else
+			return (unsigned)getpid();
+#endif
+		}
+
+		void UpdateEnabled() {
+			bool enabled = s_recording.load(std::memory_order_relaxed) || s_callback.load(std::memory_order_relaxed) != nullptr;
+			g_traceEnabled.store(enabled ? 1 : 0, std::memory_order_release);
+		}
+	}
+
+	bool TraceStart(int capacity) {
+		if (capacity < 1 || capacity > (1 << 26))
+			return false;
+
+		// round up to a power of two so the index can be masked
+		unsigned long long size = 1;
+		while (size < (unsigned long long)capacity)
+			size <<= 1;
+
+		s_recording.store(false, std::memory_order_relaxed);
+		if (size != s_capacity) {
+			TraceSlot* ring = new(std::nothrow) TraceSlot[size];
+			if (ring == nullptr) {
+				UpdateEnabled();
+				return false;
+			}
+			delete[] s_ring;
+			s_ring = ring;
+			s_capacity = size;
+		}
+		for (unsigned long long i = 0; i < size; ++i)
+			s_ring[i].sequence.store(0, std::memory_order_relaxed);
+		s_next.store(0, std::memory_order_relaxed);
+		s_origin = Now();
+		s_recording.store(true, std::memory_order_release);
+		UpdateEnabled();
+		return true;
+	}
+
+	void TraceStop() {
+		s_recording.store(false, std::memory_order_release);
+		UpdateEnabled();
+	}
+
+	void TraceSetCallback(TraceCallback callback, void* user) {
+		s_callback.store(nullptr, std::memory_order_release);
+		s_user.store(user, std::memory_order_relaxed);
+		s_callback.store(callback, std::memory_order_release);
+		UpdateEnabled();
+	}
+
+	void TraceEmit(const char* name, int phase) {
+		long long ns = Now();
+		unsigned thread = CurrentThread();
+
+		TraceCallback callback = s_callback.load(std::memory_order_acquire);
+		if (callback != nullptr) {
+			TraceEvent event = {ns, name, thread, phase};
+			callback(s_user.load(std::memory_order_relaxed), &event);
+		}
+
+		if (!s_recording.load(std::memory_order_acquire))
+			return;
+
+		// claim a slot and fill it in, marking it incomplete while we do
+		unsigned long long index = s_next.fetch_add(1, std::memory_order_relaxed);
+		TraceSlot& slot = s_ring[index & (s_capacity - 1)];
+		slot.sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.name.store(name, std::memory_order_relaxed);
+		slot.ns.store(ns, std::memory_order_relaxed);
+		slot.thread.store(thread, std::memory_order_relaxed);
+		slot.phase.store(phase, std::memory_order_relaxed);
+		slot.sequence.store(index + 1, std::memory_order_release);
+	}
+
+	int TraceRead(TraceEvent* events, int max) {
+		if (s_ring == nullptr)
+			return 0;
+
+		unsigned long long total = s_next.load(std::memory_order_acquire);
+		unsigned long long first = total > s_capacity ? total - s_capacity : 0;
+		if (events == nullptr)
+			return (int)(total - first);
+
+		int count = 0;
+		for (unsigned long long i = first; i < total && count < max; ++i) {
+			// skip slots that are being written or have been overwritten
+			const TraceSlot& slot = s_ring[i & (s_capacity - 1)];
+			unsigned long long before = slot.sequence.load(std::memory_order_acquire);
+			TraceEvent event;
+			event.name = slot.name.load(std::memory_order_relaxed);
+			event.ns = slot.ns.load(std::memory_order_relaxed);
+			event.thread = slot.thread.load(std::memory_order_relaxed);
+			event.phase = slot.phase.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (before != i + 1 || slot.sequence.load(std::memory_order_relaxed) != before)
+				continue;
+			events[count++] = event;
+		}
+		return count;
+	}
+
+	int TraceDropped() {
+		unsigned long long total = s_next.load(std::memory_order_acquire);
+		return total > s_capacity ? (int)(total - s_capacity) : 0;
+	}
+
+	bool TraceWrite(const char* path) {
+		std::vector<TraceEvent> events(TraceRead(nullptr, 0));
+		events.resize(TraceRead(events.data(), (int)events.size()));
+
+		FILE* file = std::fopen(path, "w");
+		if (file == nullptr)
+			return false;
+
+		unsigned pid = CurrentProcess();
+		std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		for (size_t i = 0; i < events.size(); ++i) {
+			const TraceEvent& event = events[i];
+			std::fprintf(file, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u}%s\n", event.name,
+				(char)event.phase, (double)(event.ns - s_origin) / 1000.0, pid, event.thread,
+				i + 1 < events.size() ? "," : "");
+		}
+		std::fprintf(file, "]}\n");
+
+		bool ok = std::ferror(file) == 0;
+		return std::fclose(file) == 0 && ok;
+	}
+} // namespace squish
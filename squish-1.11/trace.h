@@ -0,0 +1,137 @@
+/* -----------------------------------------------------------------------------
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+#ifndef SQUISH_TRACE_H
+#define SQUISH_TRACE_H
+
+#include <atomic>
+
+//! Begin and end events for profiling the native imaging code.
+namespace squish {
+	// -----------------------------------------------------------------------------
+
+	//! A begin or end event.
+	struct TraceEvent {
+		//! steady_clock time in nanoseconds.
+		long long ns;
+
+		//! A string literal naming the span; it stays valid while the module is loaded.
+		const char* name;
+
+		//! The operating system id of the thread.
+		unsigned thread;
+
+		//! 'B' for begin or 'E' for end, as in the Chrome trace event format.
+		int phase;
+	};
+
+	//! Receives every event as it happens, on the thread that produced it.
+	using TraceCallback = void (*)(void* user, const TraceEvent* event);
+
+	// -----------------------------------------------------------------------------
+
+	/*! @brief Starts recording events into a ring buffer.
+
+		@param capacity	Events to keep, rounded up to a power of two.
+
+		When the buffer is full the oldest events are overwritten. Recording is
+		lock free, so any number of threads can trace at once. Start and stop
+		the trace while no compression is running.
+	*/
+	bool TraceStart(int capacity);
+
+	//! Stops recording; the events stay readable until the next TraceStart.
+	void TraceStop();
+
+	/*! @brief Sends every event to a callback, or stops doing so when it is null.
+
+		The callback can be used with or without the ring buffer.
+	*/
+	void TraceSetCallback(TraceCallback callback, void* user);
+
+	/*! @brief Copies the oldest recorded events that are still in the buffer.
+
+		@param events	Storage for up to max events, or null to only count them.
+		@param max		Size of events.
+
+		Returns the number of events copied, or the number available when events
+		is null. Events overwritten before they were read are counted by
+		TraceDropped.
+	*/
+	int TraceRead(TraceEvent* events, int max);
+
+	//! Events lost because the ring buffer was full.
+	int TraceDropped();
+
+	/*! @brief Writes the recorded events as Chrome trace event JSON.
+
+		The file can be opened in chrome://tracing or ui.perfetto.dev. Returns
+		false if the file could not be written.
+	*/
+	bool TraceWrite(const char* path);
+
+	// -----------------------------------------------------------------------------
+
+	//! Non-zero while there is a ring buffer or callback to trace to.
+	extern std::atomic<int> g_traceEnabled;
+
+	//! Records an event; call only when TraceEnabled() is true.
+	void TraceEmit(const char* name, int phase);
+
+	//! Whether tracing is on. This is the only cost of a trace point when it is off.
+	inline bool TraceEnabled() {
+		return g_traceEnabled.load(std::memory_order_relaxed) != 0;
+	}
+
+	inline void TraceBegin(const char* name) {
+		if (TraceEnabled())
+			TraceEmit(name, 'B');
+	}
+
+	inline void TraceEnd(const char* name) {
+		if (TraceEnabled())
+			TraceEmit(name, 'E');
+	}
+
+	//! Traces the enclosing scope.
+	class TraceScope {
+		public:
+			explicit TraceScope(const char* name) : m_name(TraceEnabled() ? name : nullptr) {
+				if (m_name != nullptr)
+					TraceEmit(m_name, 'B');
+			}
+
+			~TraceScope() {
+				if (m_name != nullptr)
+					TraceEmit(m_name, 'E');
+			}
+
+			TraceScope(const TraceScope&) = delete;
+			TraceScope& operator=(const TraceScope&) = delete;
+
+		private:
+			const char* m_name;
+	};
+} // namespace squish
+
+#endif // ndef SQUISH_TRACE_H